@@ -13,23 +13,44 @@ CONFIG += console static
 
 SOURCES += \
     mqttpacket.cpp \
+    mqttinputbuffer.cpp \
+    mqttoutputqueue.cpp \
+    mqttadmissioncontrol.cpp \
+    mqtttimerwheel.cpp \
+    mqttpacketidallocator.cpp \
+    mqttinflightwindow.cpp \
+    mqttserverstatistics.cpp \
     mqttsubscription.cpp \
+    mqttsubscriptionindex.cpp \
+    mqttretainedmessageindex.cpp \
     mqttserver.cpp \
+    mqttfilepersistence.cpp \
     mqttclient.cpp \
     transports/mqttservertransport.cpp \
     transports/mqtttcpservertransport.cpp \
     transports/mqttwebsocketservertransport.cpp \
+    transports/mqttthreadedserverclient.cpp \
     transports/mqttclienttransport.cpp \
     transports/mqtttcpclienttransport.cpp \
     transports/mqttwebsocketclienttransport.cpp \
 
 PRIVATE_HEADERS = \
     mqttpacket_p.h \
+    mqttinputbuffer.h \
+    mqttoutputqueue.h \
+    mqttadmissioncontrol.h \
+    mqtttimerwheel.h \
+    mqttpacketidallocator.h \
+    mqttinflightwindow.h \
+    mqttserverstatistics.h \
     mqttclient_p.h \
     mqttserver_p.h \
+    mqttsubscriptionindex.h \
+    mqttretainedmessageindex.h \
     transports/mqttservertransport.h \
     transports/mqtttcpservertransport.h \
     transports/mqttwebsocketservertransport.h \
+    transports/mqttthreadedserverclient.h \
     transports/mqttclienttransport.h \
     transports/mqtttcpclienttransport.h \
     transports/mqttwebsocketclienttransport.h \
@@ -39,6 +60,8 @@ PUBLIC_HEADERS = \
     mqttpacket.h \
     mqttsubscription.h \
     mqttserver.h \
+    mqttpersistence.h \
+    mqttfilepersistence.h \
     mqttclient.h \
 
 HEADERS += $$PRIVATE_HEADERS $$PUBLIC_HEADERS
@@ -0,0 +1,211 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* nymea-mqtt
+* MQTT library for nymea
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public License
+* as published by the Free Software Foundation, either version 3
+* of the License, or (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "mqttadmissioncontrol.h"
+
+#include <QLoggingCategory>
+
+Q_DECLARE_LOGGING_CATEGORY(dbgServer)
+
+MqttAdmissionControl::MqttAdmissionControl(QObject *parent):
+    QObject(parent)
+{
+    m_clock.start();
+}
+
+int MqttAdmissionControl::maximumConcurrentHandshakes() const
+{
+    return m_maximumConcurrentHandshakes;
+}
+
+void MqttAdmissionControl::setMaximumConcurrentHandshakes(int maximumConcurrentHandshakes)
+{
+    m_maximumConcurrentHandshakes = qMax(0, maximumConcurrentHandshakes);
+    admitQueued();
+}
+
+int MqttAdmissionControl::maximumQueueLength() const
+{
+    return m_maximumQueueLength;
+}
+
+void MqttAdmissionControl::setMaximumQueueLength(int maximumQueueLength)
+{
+    m_maximumQueueLength = qMax(0, maximumQueueLength);
+    updateAcceptingPaused();
+}
+
+int MqttAdmissionControl::maximumConnectionRatePerAddress() const
+{
+    return m_maximumConnectionRatePerAddress;
+}
+
+void MqttAdmissionControl::setMaximumConnectionRatePerAddress(int maximumConnectionRatePerAddress)
+{
+    m_maximumConnectionRatePerAddress = qMax(0, maximumConnectionRatePerAddress);
+    m_rateWindows.clear();
+}
+
+quint64 MqttAdmissionControl::accept(const QHostAddress &peerAddress)
+{
+    const qint64 now = m_clock.elapsed();
+
+    if (m_maximumConnectionRatePerAddress > 0) {
+        if (m_rateWindows.count() >= 10000) {
+            // Forget about addresses which haven't connected within the current second
+            QHash<QHostAddress, RateWindow>::iterator it = m_rateWindows.begin();
+            while (it != m_rateWindows.end()) {
+                if (now - it.value().start >= 1000) {
+                    it = m_rateWindows.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+
+        RateWindow &window = m_rateWindows[peerAddress];
+        if (window.count == 0 || now - window.start >= 1000) {
+            window.start = now;
+            window.count = 0;
+        }
+        if (window.count >= m_maximumConnectionRatePerAddress) {
+            qCDebug(dbgServer) << "Connection rate of" << m_maximumConnectionRatePerAddress << "per second exceeded by" << peerAddress << ". Rejecting connection.";
+            m_rejectedConnections++;
+            return 0;
+        }
+        window.count++;
+    }
+
+    m_acceptTimes.insert(++m_lastTicket, now);
+    return m_lastTicket;
+}
+
+void MqttAdmissionControl::requestHandshake(quint64 ticket, std::function<void()> start)
+{
+    if (!m_acceptTimes.contains(ticket)) {
+        return;
+    }
+
+    if (m_queuedConnections.isEmpty() && (m_maximumConcurrentHandshakes == 0 || m_admittedConnections.count() < m_maximumConcurrentHandshakes)) {
+        m_admittedConnections.insert(ticket);
+        start();
+        return;
+    }
+
+    m_queuedConnections.insert(ticket, start);
+    m_queue.enqueue(ticket);
+    updateAcceptingPaused();
+}
+
+void MqttAdmissionControl::finish(quint64 ticket, bool succeeded)
+{
+    if (!m_acceptTimes.contains(ticket)) {
+        return;
+    }
+
+    const qint64 acceptTime = m_acceptTimes.take(ticket);
+    if (m_queuedConnections.remove(ticket) > 0) {
+        // The queue entry is skipped when it comes up
+        updateAcceptingPaused();
+        return;
+    }
+
+    m_admittedConnections.remove(ticket);
+    if (succeeded) {
+        m_handshakeCount++;
+        m_handshakeLatencySum += m_clock.elapsed() - acceptTime;
+    }
+    admitQueued();
+}
+
+bool MqttAdmissionControl::isAcceptingPaused() const
+{
+    return m_acceptingPaused;
+}
+
+int MqttAdmissionControl::queueLength() const
+{
+    return m_queuedConnections.count();
+}
+
+int MqttAdmissionControl::handshakesInProgress() const
+{
+    return m_admittedConnections.count();
+}
+
+quint64 MqttAdmissionControl::handshakeCount() const
+{
+    return m_handshakeCount;
+}
+
+qint64 MqttAdmissionControl::handshakeLatencySum() const
+{
+    return m_handshakeLatencySum;
+}
+
+quint64 MqttAdmissionControl::rejectedConnectionsCount() const
+{
+    return m_rejectedConnections;
+}
+
+void MqttAdmissionControl::admitQueued()
+{
+    while (!m_queue.isEmpty() && (m_maximumConcurrentHandshakes == 0 || m_admittedConnections.count() < m_maximumConcurrentHandshakes)) {
+        const quint64 ticket = m_queue.dequeue();
+        if (!m_queuedConnections.contains(ticket)) {
+            continue;
+        }
+        std::function<void()> start = m_queuedConnections.take(ticket);
+        m_admittedConnections.insert(ticket);
+        // Starting may finish handshakes right away, which calls into here again
+        start();
+    }
+    updateAcceptingPaused();
+}
+
+void MqttAdmissionControl::updateAcceptingPaused()
+{
+    bool paused = m_acceptingPaused;
+    if (m_maximumQueueLength == 0) {
+        paused = false;
+    } else if (m_queuedConnections.count() >= m_maximumQueueLength) {
+        paused = true;
+    } else if (m_queuedConnections.count() <= m_maximumQueueLength / 2) {
+        paused = false;
+    }
+
+    if (m_queuedConnections.isEmpty()) {
+        // Skipped entries of finished connections don't need to be kept around anymore
+        m_queue.clear();
+    }
+
+    if (paused != m_acceptingPaused) {
+        m_acceptingPaused = paused;
+        qCDebug(dbgServer) << (paused ? "Accept queue full, pausing accepting new connections" : "Resuming accepting new connections");
+        emit acceptingPausedChanged(paused);
+    }
+}
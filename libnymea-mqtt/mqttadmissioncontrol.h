@@ -0,0 +1,107 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* nymea-mqtt
+* MQTT library for nymea
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public License
+* as published by the Free Software Foundation, either version 3
+* of the License, or (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef MQTTADMISSIONCONTROL_H
+#define MQTTADMISSIONCONTROL_H
+
+#include <QObject>
+#include <QHash>
+#include <QQueue>
+#include <QSet>
+#include <QHostAddress>
+#include <QElapsedTimer>
+
+#include <functional>
+
+// Protects the server against connection storms, e.g. when thousands of devices reconnect after a power cut.
+// Transports announce each new connection before its handshake. Connections exceeding the connection rate of
+// their address are rejected right away, the others wait in the accept queue while the maximum number of
+// handshakes is in progress. A handshake lasts from accepting the connection until the CONNACK has been sent.
+class MqttAdmissionControl: public QObject
+{
+    Q_OBJECT
+public:
+    explicit MqttAdmissionControl(QObject *parent = nullptr);
+
+    // 0 means unlimited for all limits
+    int maximumConcurrentHandshakes() const;
+    void setMaximumConcurrentHandshakes(int maximumConcurrentHandshakes);
+    int maximumQueueLength() const;
+    void setMaximumQueueLength(int maximumQueueLength);
+    int maximumConnectionRatePerAddress() const;
+    void setMaximumConnectionRatePerAddress(int maximumConnectionRatePerAddress);
+
+    // Returns the ticket identifying the connection until finish() has been called, or 0 if the connection
+    // exceeds the connection rate of its address and is to be closed
+    quint64 accept(const QHostAddress &peerAddress);
+    // Calls start once the connection is admitted, right away or when other handshakes have finished
+    void requestHandshake(quint64 ticket, std::function<void()> start);
+    // The handshake ended, successfully or because the connection went away. Drops the connection from
+    // the queue if it hasn't been admitted yet.
+    void finish(quint64 ticket, bool succeeded);
+
+    bool isAcceptingPaused() const;
+    int queueLength() const;
+    int handshakesInProgress() const;
+    quint64 handshakeCount() const;
+    qint64 handshakeLatencySum() const;
+    quint64 rejectedConnectionsCount() const;
+
+signals:
+    // Transports stop accepting while the queue is full, leaving new connections to the network stack's backlog
+    void acceptingPausedChanged(bool paused);
+
+private:
+    void admitQueued();
+    void updateAcceptingPaused();
+
+    struct RateWindow {
+        qint64 start = 0;
+        int count = 0;
+    };
+
+    int m_maximumConcurrentHandshakes = 0;
+    int m_maximumQueueLength = 1000;
+    int m_maximumConnectionRatePerAddress = 0;
+
+    QElapsedTimer m_clock;
+    quint64 m_lastTicket = 0;
+    // Accept times of all connections which haven't finished their handshake
+    QHash<quint64, qint64> m_acceptTimes;
+    QHash<quint64, std::function<void()> > m_queuedConnections;
+    // Tickets in the order they have been queued, may contain finished ones which are skipped
+    QQueue<quint64> m_queue;
+    QSet<quint64> m_admittedConnections;
+    QHash<QHostAddress, RateWindow> m_rateWindows;
+    bool m_acceptingPaused = false;
+
+    quint64 m_handshakeCount = 0;
+    qint64 m_handshakeLatencySum = 0;
+    quint64 m_rejectedConnections = 0;
+};
+
+#endif // MQTTADMISSIONCONTROL_H
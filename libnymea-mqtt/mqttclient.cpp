@@ -52,8 +52,11 @@ MqttClientPrivate::MqttClientPrivate(MqttClient *q):
     qRegisterMetaType<Mqtt::SubscribeReturnCodes>();
     qRegisterMetaType<Mqtt::ConnackFlags>();
     reconnectTimer.setSingleShot(true);
+    retransmissionTimer.setSingleShot(true);
+    clock.start();
     connect(&keepAliveTimer, &QTimer::timeout, this, &MqttClientPrivate::sendPingreq);
     connect(&reconnectTimer, &QTimer::timeout, this, &MqttClientPrivate::reconnectTimerTimeout);
+    connect(&retransmissionTimer, &QTimer::timeout, this, &MqttClientPrivate::retransmissionTimerTimeout);
 }
 
 void MqttClientPrivate::connectToHost(const QString &hostName, quint16 port, bool cleanSession, bool useSsl, const QSslConfiguration &sslConfiguration)
@@ -174,6 +177,101 @@ void MqttClient::setKeepAlive(quint16 keepAlive)
     d_ptr->keepAlive = keepAlive;
 }
 
+/*!
+ * \brief Returns the maximum size in bytes of a packet accepted from the server.
+ */
+quint32 MqttClient::maximumPacketSize() const
+{
+    return d_ptr->maximumPacketSize;
+}
+
+/*!
+ * \brief Sets the maximum size in bytes of a packet accepted from the server.
+ * \param maximumPacketSize The maximum packet size, including the fixed header.
+ *
+ * The size is checked as soon as the fixed header of a packet has been received. If the server
+ * announces a larger packet, the connection is dropped without buffering the rest of the packet.
+ * Defaults to the protocol limit of 268435460 bytes.
+ */
+void MqttClient::setMaximumPacketSize(quint32 maximumPacketSize)
+{
+    d_ptr->maximumPacketSize = maximumPacketSize;
+}
+
+/*!
+ * \brief Returns the maximum number of QoS 1 and 2 publishes sent without being acknowledged yet.
+ */
+int MqttClient::maximumInFlightMessages() const
+{
+    return d_ptr->unackedPackets.maximum();
+}
+
+/*!
+ * \brief Sets the maximum number of QoS 1 and 2 publishes sent without being acknowledged yet.
+ * \param maximumInFlightMessages The maximum number of publishes in flight, 0 means unlimited.
+ *
+ * Further publishes are queued and sent in order as acknowledgements arrive, like with the receive
+ * maximum of MQTT 5. Defaults to 0.
+ */
+void MqttClient::setMaximumInFlightMessages(int maximumInFlightMessages)
+{
+    d_ptr->unackedPackets.setMaximum(maximumInFlightMessages);
+    if (isConnected()) {
+        d_ptr->sendWaitingPackets();
+    }
+}
+
+/*!
+ * \brief Returns the time in milliseconds after which unacknowledged publishes are sent again.
+ */
+int MqttClient::retransmissionInterval() const
+{
+    return d_ptr->retransmissionInterval;
+}
+
+/*!
+ * \brief Sets the time in milliseconds after which unacknowledged publishes are sent again.
+ * \param retransmissionInterval The time to wait for an acknowledgement, 0 disables retransmission.
+ *
+ * QoS 1 and 2 publishes and PUBRELs which haven't been acknowledged within the interval are sent
+ * again on the same connection, doubling the interval with every retransmission up to the
+ * maximumRetransmissionInterval(). Useful on lossy links where connections stay half alive.
+ * Defaults to 0, which only resends them when the session resumes on a new connection.
+ */
+void MqttClient::setRetransmissionInterval(int retransmissionInterval)
+{
+    d_ptr->retransmissionInterval = qMax(0, retransmissionInterval);
+    d_ptr->retransmissionTimer.stop();
+    if (isConnected()) {
+        d_ptr->scheduleRetransmission();
+    }
+}
+
+/*!
+ * \brief Returns the limit for the retransmission interval growing with every retransmission.
+ */
+int MqttClient::maximumRetransmissionInterval() const
+{
+    return d_ptr->maximumRetransmissionInterval;
+}
+
+/*!
+ * \brief Sets the limit for the retransmission interval growing with every retransmission.
+ * \param maximumRetransmissionInterval The maximum interval in milliseconds. Defaults to 60 seconds.
+ */
+void MqttClient::setMaximumRetransmissionInterval(int maximumRetransmissionInterval)
+{
+    d_ptr->maximumRetransmissionInterval = qMax(0, maximumRetransmissionInterval);
+}
+
+/*!
+ * \brief Returns the number of publishes and PUBRELs sent again due to the retransmission interval.
+ */
+quint64 MqttClient::retransmittedMessagesCount() const
+{
+    return d_ptr->retransmittedMessages;
+}
+
 QString MqttClient::willTopic() const
 {
     return d_ptr->willTopic;
@@ -273,10 +371,14 @@ quint16 MqttClient::subscribe(const QString &topicFilter, Mqtt::QoS qos)
 
 quint16 MqttClient::subscribe(const MqttSubscriptions &subscriptions)
 {
-    MqttPacket packet(MqttPacket::TypeSubscribe, d_ptr->newPacketId());
+    quint16 packetId = d_ptr->newPacketId();
+    if (packetId == 0) {
+        qCWarning(dbgClient) << "All packet IDs are in use. Not subscribing.";
+        return 0;
+    }
+    MqttPacket packet(MqttPacket::TypeSubscribe, packetId);
     packet.setSubscriptions(subscriptions);
-    d_ptr->unackedPackets.insert(packet.packetId(), packet);
-    d_ptr->unackedPacketList.append(packet.packetId());
+    d_ptr->unackedPackets.append(packet);
     d_ptr->transport->write(packet.serialize());
     return packet.packetId();
 }
@@ -294,34 +396,48 @@ quint16 MqttClient::unsubscribe(const QString &topicFilter)
 
 quint16 MqttClient::unsubscribe(const MqttSubscriptions &subscriptions)
 {
-    MqttPacket packet(MqttPacket::TypeUnsubscribe, d_ptr->newPacketId());
+    quint16 packetId = d_ptr->newPacketId();
+    if (packetId == 0) {
+        qCWarning(dbgClient) << "All packet IDs are in use. Not unsubscribing.";
+        return 0;
+    }
+    MqttPacket packet(MqttPacket::TypeUnsubscribe, packetId);
     packet.setSubscriptions(subscriptions);
-    d_ptr->unackedPackets.insert(packet.packetId(), packet);
-    d_ptr->unackedPacketList.append(packet.packetId());
+    d_ptr->unackedPackets.append(packet);
     d_ptr->transport->write(packet.serialize());
     return packet.packetId();
 }
 
 quint16 MqttClient::publish(const QString &topic, const QByteArray &payload, Mqtt::QoS qos, bool retain)
 {
-    quint16 packetId = qos >= Mqtt::QoS1 ? d_ptr->newPacketId() : 0;
+    quint16 packetId = 0;
+    if (qos >= Mqtt::QoS1) {
+        packetId = d_ptr->newPacketId();
+        if (packetId == 0) {
+            qCWarning(dbgClient) << "All packet IDs are in use. Not publishing on topic" << topic;
+            return 0;
+        }
+    }
     MqttPacket packet(MqttPacket::TypePublish, packetId, qos, retain, false);
     packet.setTopic(topic.toUtf8());
     packet.setPayload(payload);
-    d_ptr->transport->write(packet.serialize());
     if (qos == Mqtt::QoS0) {
+        d_ptr->transport->write(packet.serialize());
         QTimer::singleShot(0, this, [this, packet](){
             emit published(packet.packetId(), packet.topic());
         });
-    } else {
-        d_ptr->unackedPackets.insert(packet.packetId(), packet);
-        d_ptr->unackedPacketList.append(packetId);
+    } else if (d_ptr->unackedPackets.append(packet, d_ptr->clock.elapsed())) {
+        d_ptr->transport->write(packet.serialize());
+        d_ptr->scheduleRetransmission();
     }
     return packetId;
 }
 
 void MqttClientPrivate::onConnected()
 {
+    // Whatever was left over from a previous connection is of no use anymore
+    inputBuffer.clear();
+
     MqttPacket packet(MqttPacket::TypeConnect);
     packet.setProtocolLevel(Mqtt::Protocol311);
     packet.setCleanSession(cleanSession);
@@ -339,6 +455,7 @@ void MqttClientPrivate::onConnected()
 void MqttClientPrivate::onDisconnected()
 {
     qCDebug(dbgClient) << "Disconnected from server";
+    retransmissionTimer.stop();
     emit q_ptr->disconnected();
     if (sessionActive && autoReconnect) {
         reconnectAttempt = qMin(maxReconnectTimeout / 60 / 60, reconnectAttempt * 2);
@@ -352,38 +469,57 @@ void MqttClientPrivate::onDataReceived(const QByteArray &data)
 {
     inputBuffer.append(data);
 //    qCDebug(dbgClient) << "Received data from server:" << data.toHex() << "\n" << data;
-    MqttPacket packet;
-    int ret = packet.parse(inputBuffer);
-    if (ret == -1) {
-        qCDebug(dbgClient) << "Bad data from server. Dropping connection.";
-        inputBuffer.clear();
-        transport->abort();
-        return;
-    }
-    if (ret == 0) {
-        qCDebug(dbgClient) << "Not enough data from server...";
-        return;
-    }
-    inputBuffer.remove(0, ret);
+    do {
+        const qint64 packetLength = MqttPacket::packetLength(inputBuffer.data(), inputBuffer.size());
+        if (packetLength > maximumPacketSize) {
+            qCWarning(dbgClient) << "Server announced a packet of" << packetLength << "bytes, exceeding the maximum packet size of" << maximumPacketSize << "bytes. Dropping connection.";
+            inputBuffer.clear();
+            transport->abort();
+            return;
+        }
+        MqttPacket packet;
+        int ret = packet.parse(inputBuffer.data(), inputBuffer.size());
+        if (ret == -1) {
+            qCDebug(dbgClient) << "Bad data from server. Dropping connection.";
+            inputBuffer.clear();
+            transport->abort();
+            return;
+        }
+        if (ret == 0) {
+            qCDebug(dbgClient) << "Not enough data from server...";
+            return;
+        }
+        inputBuffer.consume(ret);
 
+        // Note: Processing the packet may drop the connection, which clears the input buffer
+        processPacket(packet);
+
+    } while (!inputBuffer.isEmpty());
+}
+
+void MqttClientPrivate::processPacket(const MqttPacket &packet)
+{
     switch (packet.type()) {
     case MqttPacket::TypeConnack:
         if (packet.connectReturnCode() != Mqtt::ConnectReturnCodeAccepted) {
             qCWarning(dbgClient) << "MQTT connection refused:" << packet.connectReturnCode();
             // Always emit connected, even if just to indicate a "ClientRefusedError"
             emit q_ptr->connected(packet.connectReturnCode(), packet.connackFlags());
+            inputBuffer.clear();
             transport->abort();
             emit q_ptr->error(QAbstractSocket::ConnectionRefusedError);
             return;
         }
-        foreach (quint16 retryPacketId, unackedPacketList) {
-            MqttPacket retryPacket = unackedPackets.value(retryPacketId);
+        // Everything is sent again in its original order, as far as the in-flight window allows
+        unackedPackets.resetSent();
+        foreach (MqttPacket retryPacket, unackedPackets.takeSendable(clock.elapsed())) {
             if (retryPacket.type() == MqttPacket::TypePublish) {
                 retryPacket.setDup(true);
             }
             transport->write(retryPacket.serialize());
         }
         restartKeepAliveTimer();
+        scheduleRetransmission();
         // Make sure we emit connected after having handled all the retransmission queue
         emit q_ptr->connected(packet.connectReturnCode(), packet.connackFlags());
         break;
@@ -400,17 +536,17 @@ void MqttClientPrivate::onDataReceived(const QByteArray &data)
             break;
         }
         case Mqtt::QoS2: {
-            if (!packet.dup() && unackedPacketList.contains(packet.packetId())) {
+            if (!packet.dup() && receivedQoS2PacketIds.contains(packet.packetId())) {
                 // Hmm... Server says it's not a duplicate, but packet id is not released yet... Drop connection.
+                inputBuffer.clear();
                 transport->disconnectFromHost();
                 return;
             }
 
             MqttPacket response(MqttPacket::TypePubrec, packet.packetId());
 
-            if (!unackedPacketList.contains(packet.packetId())) {
-                unackedPackets.insert(packet.packetId(), response);
-                unackedPacketList.append(packet.packetId());
+            if (!receivedQoS2PacketIds.contains(packet.packetId())) {
+                receivedQoS2PacketIds.insert(packet.packetId());
                 emit q_ptr->publishReceived(packet.topic(), packet.payload(), packet.retain());
             }
             transport->write(response.serialize());
@@ -419,8 +555,8 @@ void MqttClientPrivate::onDataReceived(const QByteArray &data)
         }
         break;
     case MqttPacket::TypePuback: {
-        MqttPacket publishPacket = unackedPackets.take(packet.packetId());
-        unackedPacketList.removeAll(packet.packetId());
+        MqttPacket publishPacket = unackedPackets.value(packet.packetId());
+        removeUnackedPacket(packet.packetId());
         emit q_ptr->published(packet.packetId(), publishPacket.topic());
         restartKeepAliveTimer();
         break;
@@ -428,30 +564,32 @@ void MqttClientPrivate::onDataReceived(const QByteArray &data)
     case MqttPacket::TypePubrec: {
         MqttPacket publishPacket = unackedPackets.value(packet.packetId());
         MqttPacket response(MqttPacket::TypePubrel, packet.packetId());
-        unackedPackets[packet.packetId()] = response;
+        unackedPackets.replace(response, clock.elapsed());
         transport->write(response.serialize());
+        scheduleRetransmission();
         emit q_ptr->published(packet.packetId(), publishPacket.topic());
         restartKeepAliveTimer();
         break;
     }
     case MqttPacket::TypePubrel: {
+        // The QoS 2 flow of a publish received from the server is complete, its ID may be used again
         MqttPacket response(MqttPacket::TypePubcomp, packet.packetId());
-        unackedPackets[packet.packetId()] = response;
+        receivedQoS2PacketIds.remove(packet.packetId());
         transport->write(response.serialize());
         restartKeepAliveTimer();
         break;
     }
     case MqttPacket::TypePubcomp:
-        unackedPackets.remove(packet.packetId());
-        unackedPacketList.removeAll(packet.packetId());
+        removeUnackedPacket(packet.packetId());
         restartKeepAliveTimer();
         break;
     case MqttPacket::TypeSuback: {
-        MqttPacket subscribePacket = unackedPackets.take(packet.packetId());
-        unackedPacketList.removeAll(packet.packetId());
+        MqttPacket subscribePacket = unackedPackets.value(packet.packetId());
+        removeUnackedPacket(packet.packetId());
 
         if (subscribePacket.subscriptions().count() != packet.subscribeReturnCodes().count()) {
             qCWarning(dbgClient) << "Subscription return code count not matching subscribe packet!";
+            inputBuffer.clear();
             transport->abort();
             return;
         }
@@ -469,11 +607,11 @@ void MqttClientPrivate::onDataReceived(const QByteArray &data)
     case MqttPacket::TypeUnsuback:
         if (!unackedPackets.contains(packet.packetId())) {
             qCWarning(dbgClient) << "UNSUBACK received but not waiting for it. Dropping connection. Packet ID:" << packet.packetId();
+            inputBuffer.clear();
             transport->abort();
             return;
         }
-        unackedPackets.remove(packet.packetId());
-        unackedPacketList.removeAll(packet.packetId());
+        removeUnackedPacket(packet.packetId());
         emit q_ptr->unsubscribed(packet.packetId());
         restartKeepAliveTimer();
         break;
@@ -483,10 +621,6 @@ void MqttClientPrivate::onDataReceived(const QByteArray &data)
         qCDebug(dbgClient).noquote().nospace() << "Unhandled packet type: 0x" << QString::number(packet.type(), 16);
         Q_ASSERT(false);
     }
-
-    if (!inputBuffer.isEmpty()) {
-        onDataReceived(QByteArray());
-    }
 }
 
 void MqttClientPrivate::onSocketStateChanged(QAbstractSocket::SocketState socketState)
@@ -508,11 +642,52 @@ void MqttClientPrivate::onSslErrors(const QList<QSslError> &errors)
 
 quint16 MqttClientPrivate::newPacketId()
 {
-    static quint16 packetId = 1;
-    do {
-        packetId++;
-    } while (unackedPacketList.contains(packetId));
-    return packetId;
+    return packetIds.allocate();
+}
+
+void MqttClientPrivate::removeUnackedPacket(quint16 packetId)
+{
+    packetIds.release(packetId);
+    if (unackedPackets.remove(packetId)) {
+        sendWaitingPackets();
+    }
+}
+
+void MqttClientPrivate::sendWaitingPackets()
+{
+    foreach (const MqttPacket &packet, unackedPackets.takeSendable(clock.elapsed())) {
+        transport->write(packet.serialize());
+    }
+    scheduleRetransmission();
+}
+
+void MqttClientPrivate::scheduleRetransmission()
+{
+    if (retransmissionInterval == 0 || retransmissionTimer.isActive()) {
+        return;
+    }
+    const qint64 deadline = unackedPackets.nextRetransmission(retransmissionInterval, maximumRetransmissionInterval);
+    if (deadline < 0) {
+        return;
+    }
+    retransmissionTimer.start(static_cast<int>(qMax<qint64>(0, deadline - clock.elapsed())));
+}
+
+void MqttClientPrivate::retransmissionTimerTimeout()
+{
+    if (retransmissionInterval == 0 || !q_ptr->isConnected()) {
+        // Resent along with the CONNACK of the next connection
+        return;
+    }
+    foreach (MqttPacket packet, unackedPackets.takeOverdue(clock.elapsed(), retransmissionInterval, maximumRetransmissionInterval)) {
+        qCDebug(dbgClient) << "Retransmitting unacked packet" << packet.packetId();
+        if (packet.type() == MqttPacket::TypePublish) {
+            packet.setDup(true);
+        }
+        transport->write(packet.serialize());
+        retransmittedMessages++;
+    }
+    scheduleRetransmission();
 }
 
 void MqttClientPrivate::sendPingreq()
@@ -54,6 +54,18 @@ public:
     quint16 keepAlive() const;
     void setKeepAlive(quint16 keepAlive);
 
+    quint32 maximumPacketSize() const;
+    void setMaximumPacketSize(quint32 maximumPacketSize);
+
+    int maximumInFlightMessages() const;
+    void setMaximumInFlightMessages(int maximumInFlightMessages);
+
+    int retransmissionInterval() const;
+    void setRetransmissionInterval(int retransmissionInterval);
+    int maximumRetransmissionInterval() const;
+    void setMaximumRetransmissionInterval(int maximumRetransmissionInterval);
+    quint64 retransmittedMessagesCount() const;
+
     QString willTopic() const;
     void setWillTopic(const QString &willTopic);
 
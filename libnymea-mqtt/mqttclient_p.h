@@ -32,10 +32,15 @@
 #include <QTcpSocket>
 #include <QWebSocket>
 #include <QTimer>
+#include <QElapsedTimer>
 #include <QLoggingCategory>
+#include <QSet>
 
 #include "mqttpacket.h"
 #include "mqttsubscription.h"
+#include "mqttinputbuffer.h"
+#include "mqttpacketidallocator.h"
+#include "mqttinflightwindow.h"
 #include "mqttclient.h"
 #include "transports/mqttclienttransport.h"
 
@@ -52,6 +57,7 @@ public:
     void connectToHost(const QNetworkRequest &request, bool cleanSession);
     void connectToHost(MqttClientTransport *transport, bool cleanSession = true);
     void disconnectFromHost();
+    void processPacket(const MqttPacket &packet);
 
 public slots:
     void onConnected();
@@ -62,6 +68,12 @@ public slots:
     void onSslErrors(const QList<QSslError> &errors);
 
     quint16 newPacketId();
+    void removeUnackedPacket(quint16 packetId);
+    // Sends the packets which fit into the in-flight window now
+    void sendWaitingPackets();
+    // Starts the retransmission timer for the next packet in flight unless it is running already
+    void scheduleRetransmission();
+    void retransmissionTimerTimeout();
     void sendPingreq();
     void restartKeepAliveTimer();
 
@@ -85,11 +97,23 @@ public:
     bool willRetain = false;
     QString username;
     QString password;
+    // The protocol limit: 268435455 bytes Remaining Length plus a 5 bytes fixed header
+    quint32 maximumPacketSize = 268435460;
+    int retransmissionInterval = 0;
+    int maximumRetransmissionInterval = 60000;
+    quint64 retransmittedMessages = 0;
+    // Send and retransmission times of packets in flight are milliseconds on this clock
+    QElapsedTimer clock;
+    QTimer retransmissionTimer;
 
-    QVector<quint16> unackedPacketList;
-    QHash<quint16, MqttPacket> unackedPackets;
+    MqttInFlightWindow unackedPackets;
+    // The IDs of all unacked packets sent to the server
+    MqttPacketIdAllocator packetIds;
+    // The IDs of QoS 2 publishes received from the server which are waiting for the PUBREL.
+    // The server picks them from its own ID space, so they may be in use in packetIds at the same time.
+    QSet<quint16> receivedQoS2PacketIds;
 
-    QByteArray inputBuffer;
+    MqttInputBuffer inputBuffer;
 };
 
 #endif // MQTTCLIENT_P_H
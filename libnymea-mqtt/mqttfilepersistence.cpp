@@ -0,0 +1,512 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* nymea-mqtt
+* MQTT library for nymea
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public License
+* as published by the Free Software Foundation, either version 3
+* of the License, or (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "mqttfilepersistence.h"
+
+#include <QDataStream>
+#include <QSaveFile>
+#include <QtEndian>
+#include <QLoggingCategory>
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+Q_DECLARE_LOGGING_CATEGORY(dbgServer)
+
+// The log starts with this line, followed by the records. Each record is framed by its length
+// (4 bytes) and a CRC-16 (2 bytes) so that a record torn by a crash can be detected and dropped.
+static const QByteArray logHeader = QByteArrayLiteral("nymea-mqtt log 1\n");
+static const int recordFrameLength = 6;
+
+static quint16 recordChecksum(const char *data, int length)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+    return qChecksum(QByteArrayView(data, length));
+#else
+    return qChecksum(data, static_cast<uint>(length));
+#endif
+}
+
+MqttFilePersistence::MqttFilePersistence(const QString &fileName, QObject *parent):
+    QObject(parent),
+    m_file(fileName)
+{
+    m_syncTimer.setInterval(1000);
+    connect(&m_syncTimer, &QTimer::timeout, this, &MqttFilePersistence::sync);
+}
+
+MqttFilePersistence::~MqttFilePersistence()
+{
+    sync();
+}
+
+QString MqttFilePersistence::fileName() const
+{
+    return m_file.fileName();
+}
+
+MqttFilePersistence::SyncPolicy MqttFilePersistence::syncPolicy() const
+{
+    return m_syncPolicy;
+}
+
+void MqttFilePersistence::setSyncPolicy(SyncPolicy syncPolicy)
+{
+    m_syncPolicy = syncPolicy;
+    if (m_syncPolicy == SyncPeriodically && m_file.isOpen()) {
+        m_syncTimer.start();
+    } else {
+        m_syncTimer.stop();
+        sync();
+    }
+}
+
+int MqttFilePersistence::syncInterval() const
+{
+    return m_syncTimer.interval();
+}
+
+void MqttFilePersistence::setSyncInterval(int syncInterval)
+{
+    m_syncTimer.setInterval(syncInterval);
+}
+
+int MqttFilePersistence::compactionThreshold() const
+{
+    return m_compactionThreshold;
+}
+
+void MqttFilePersistence::setCompactionThreshold(int compactionThreshold)
+{
+    m_compactionThreshold = compactionThreshold;
+}
+
+bool MqttFilePersistence::compact()
+{
+    QSaveFile file(m_file.fileName());
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCWarning(dbgServer) << "Failed to open" << file.fileName() << "for compacting:" << file.errorString();
+        return false;
+    }
+
+    file.write(logHeader);
+    for (QHash<QByteArray, MqttPackets>::const_iterator it = m_retainedMessages.constBegin(); it != m_retainedMessages.constEnd(); ++it) {
+        foreach (const MqttPacket &packet, it.value()) {
+            file.write(frameRecord(retainedMessageRecord(packet)));
+        }
+    }
+    foreach (const MqttPersistentSession &session, m_sessions) {
+        foreach (const MqttSubscription &subscription, session.subscriptions) {
+            file.write(frameRecord(subscriptionRecord(session.clientId, subscription)));
+        }
+        foreach (const MqttPacket &packet, session.unackedPackets) {
+            file.write(frameRecord(unackedPacketRecord(session.clientId, packet)));
+        }
+    }
+
+    // Replaces the log atomically, after syncing it to disk
+    if (!file.commit()) {
+        qCWarning(dbgServer) << "Failed to write compacted log" << file.fileName() << ":" << file.errorString();
+        return false;
+    }
+
+    m_file.close();
+    m_recordCount = m_liveRecordCount;
+    m_unsynced = false;
+    return openLog();
+}
+
+bool MqttFilePersistence::restore(MqttPackets *retainedMessages, QList<MqttPersistentSession> *sessions)
+{
+    m_file.close();
+    m_retainedMessages.clear();
+    m_sessions.clear();
+    m_recordCount = 0;
+    m_liveRecordCount = 0;
+
+    bool success = true;
+    if (m_file.exists()) {
+        if (!m_file.open(QIODevice::ReadOnly)) {
+            qCWarning(dbgServer) << "Failed to open" << m_file.fileName() << ":" << m_file.errorString();
+            return false;
+        }
+        const QByteArray data = m_file.readAll();
+        m_file.close();
+
+        if (!data.startsWith(logHeader)) {
+            qCWarning(dbgServer) << m_file.fileName() << "is not a valid log. Moving it aside and starting with an empty state.";
+            QFile::remove(m_file.fileName() + ".invalid");
+            QFile::rename(m_file.fileName(), m_file.fileName() + ".invalid");
+            success = false;
+        } else {
+            int position = logHeader.length();
+            while (data.length() - position >= recordFrameLength) {
+                const quint32 length = qFromBigEndian<quint32>(data.constData() + position);
+                const quint16 checksum = qFromBigEndian<quint16>(data.constData() + position + 4);
+                if (length > static_cast<quint32>(data.length() - position - recordFrameLength)) {
+                    break;
+                }
+                const char *recordData = data.constData() + position + recordFrameLength;
+                if (recordChecksum(recordData, length) != checksum) {
+                    break;
+                }
+                if (!applyRecord(QByteArray::fromRawData(recordData, length))) {
+                    break;
+                }
+                position += recordFrameLength + length;
+                m_recordCount++;
+            }
+            if (position < data.length()) {
+                // Most likely the last record has not been written completely, e.g. on power loss
+                qCWarning(dbgServer) << "Discarding" << data.length() - position << "bytes of incomplete or corrupt data at the end of" << m_file.fileName();
+            }
+        }
+    }
+
+    for (QHash<QByteArray, MqttPackets>::const_iterator it = m_retainedMessages.constBegin(); it != m_retainedMessages.constEnd(); ++it) {
+        retainedMessages->append(it.value());
+    }
+    foreach (const MqttPersistentSession &session, m_sessions) {
+        sessions->append(session);
+    }
+    qCDebug(dbgServer) << "Restored" << m_retainedMessages.count() << "retained topics and" << m_sessions.count() << "sessions from" << m_file.fileName() << "(" << m_recordCount << "log records )";
+
+    // Start over with a compacted log, this also drops any corrupt data at the end
+    if (!compact()) {
+        return false;
+    }
+    return success;
+}
+
+void MqttFilePersistence::storeRetainedMessage(const MqttPacket &packet)
+{
+    applyRetainedMessage(packet);
+    appendRecord(retainedMessageRecord(packet));
+}
+
+void MqttFilePersistence::removeRetainedMessages(const QByteArray &topic)
+{
+    if (!m_retainedMessages.contains(topic)) {
+        return;
+    }
+    applyRetainedMessagesRemoved(topic);
+
+    QByteArray record;
+    QDataStream stream(&record, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << static_cast<quint8>(RecordRetainedMessagesRemoved) << topic;
+    appendRecord(record);
+}
+
+void MqttFilePersistence::storeSubscription(const QString &clientId, const MqttSubscription &subscription)
+{
+    applySubscription(clientId, subscription);
+    appendRecord(subscriptionRecord(clientId, subscription));
+}
+
+void MqttFilePersistence::removeSubscription(const QString &clientId, const QByteArray &topicFilter)
+{
+    applySubscriptionRemoved(clientId, topicFilter);
+
+    QByteArray record;
+    QDataStream stream(&record, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << static_cast<quint8>(RecordSubscriptionRemoved) << clientId << topicFilter;
+    appendRecord(record);
+}
+
+void MqttFilePersistence::storeUnackedPacket(const QString &clientId, const MqttPacket &packet)
+{
+    applyUnackedPacket(clientId, packet);
+    appendRecord(unackedPacketRecord(clientId, packet));
+}
+
+void MqttFilePersistence::removeUnackedPacket(const QString &clientId, quint16 packetId)
+{
+    applyUnackedPacketRemoved(clientId, packetId);
+
+    QByteArray record;
+    QDataStream stream(&record, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << static_cast<quint8>(RecordUnackedPacketRemoved) << clientId << packetId;
+    appendRecord(record);
+}
+
+void MqttFilePersistence::removeSession(const QString &clientId)
+{
+    if (!m_sessions.contains(clientId)) {
+        return;
+    }
+    applySessionRemoved(clientId);
+
+    QByteArray record;
+    QDataStream stream(&record, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << static_cast<quint8>(RecordSessionRemoved) << clientId;
+    appendRecord(record);
+}
+
+void MqttFilePersistence::sync()
+{
+    if (!m_unsynced || !m_file.isOpen()) {
+        return;
+    }
+    m_file.flush();
+#ifdef Q_OS_UNIX
+    ::fsync(m_file.handle());
+#endif
+    m_unsynced = false;
+}
+
+bool MqttFilePersistence::openLog()
+{
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Unbuffered)) {
+        qCWarning(dbgServer) << "Failed to open" << m_file.fileName() << "for writing:" << m_file.errorString();
+        return false;
+    }
+    if (m_file.size() == 0) {
+        m_file.write(logHeader);
+    }
+    if (m_syncPolicy == SyncPeriodically) {
+        m_syncTimer.start();
+    }
+    return true;
+}
+
+void MqttFilePersistence::appendRecord(const QByteArray &record)
+{
+    if (!m_file.isOpen()) {
+        return;
+    }
+
+    m_file.write(frameRecord(record));
+    m_recordCount++;
+    m_unsynced = true;
+    if (m_syncPolicy == SyncAlways) {
+        sync();
+    }
+
+    if (m_recordCount > m_compactionThreshold && m_recordCount > 2 * m_liveRecordCount) {
+        qCDebug(dbgServer) << "Compacting" << m_file.fileName() << "from" << m_recordCount << "to" << m_liveRecordCount << "records";
+        compact();
+    }
+}
+
+bool MqttFilePersistence::applyRecord(const QByteArray &record)
+{
+    QDataStream stream(record);
+    stream.setVersion(QDataStream::Qt_5_0);
+    quint8 type = 0;
+    stream >> type;
+
+    switch (type) {
+    case RecordRetainedMessage: {
+        QByteArray packetData;
+        stream >> packetData;
+        MqttPacket packet;
+        if (stream.status() != QDataStream::Ok || packet.parse(packetData) <= 0) {
+            return false;
+        }
+        applyRetainedMessage(packet);
+        return true;
+    }
+    case RecordRetainedMessagesRemoved: {
+        QByteArray topic;
+        stream >> topic;
+        if (stream.status() != QDataStream::Ok) {
+            return false;
+        }
+        applyRetainedMessagesRemoved(topic);
+        return true;
+    }
+    case RecordSubscription: {
+        QString clientId;
+        QByteArray topicFilter;
+        quint8 qos = 0;
+        stream >> clientId >> topicFilter >> qos;
+        if (stream.status() != QDataStream::Ok || qos > Mqtt::QoS2) {
+            return false;
+        }
+        applySubscription(clientId, MqttSubscription(topicFilter, static_cast<Mqtt::QoS>(qos)));
+        return true;
+    }
+    case RecordSubscriptionRemoved: {
+        QString clientId;
+        QByteArray topicFilter;
+        stream >> clientId >> topicFilter;
+        if (stream.status() != QDataStream::Ok) {
+            return false;
+        }
+        applySubscriptionRemoved(clientId, topicFilter);
+        return true;
+    }
+    case RecordUnackedPacket: {
+        QString clientId;
+        QByteArray packetData;
+        stream >> clientId >> packetData;
+        MqttPacket packet;
+        if (stream.status() != QDataStream::Ok || packet.parse(packetData) <= 0) {
+            return false;
+        }
+        applyUnackedPacket(clientId, packet);
+        return true;
+    }
+    case RecordUnackedPacketRemoved: {
+        QString clientId;
+        quint16 packetId = 0;
+        stream >> clientId >> packetId;
+        if (stream.status() != QDataStream::Ok) {
+            return false;
+        }
+        applyUnackedPacketRemoved(clientId, packetId);
+        return true;
+    }
+    case RecordSessionRemoved: {
+        QString clientId;
+        stream >> clientId;
+        if (stream.status() != QDataStream::Ok) {
+            return false;
+        }
+        applySessionRemoved(clientId);
+        return true;
+    }
+    }
+    qCWarning(dbgServer) << "Unknown record type" << type << "in" << m_file.fileName();
+    return false;
+}
+
+void MqttFilePersistence::applyRetainedMessage(const MqttPacket &packet)
+{
+    m_retainedMessages[packet.topic()].append(packet);
+    m_liveRecordCount++;
+}
+
+void MqttFilePersistence::applyRetainedMessagesRemoved(const QByteArray &topic)
+{
+    m_liveRecordCount -= m_retainedMessages.take(topic).count();
+}
+
+void MqttFilePersistence::applySubscription(const QString &clientId, const MqttSubscription &subscription)
+{
+    MqttPersistentSession &session = m_sessions[clientId];
+    session.clientId = clientId;
+    for (int i = 0; i < session.subscriptions.count(); i++) {
+        if (session.subscriptions.at(i).topicFilter() == subscription.topicFilter()) {
+            session.subscriptions.replace(i, subscription);
+            return;
+        }
+    }
+    session.subscriptions.append(subscription);
+    m_liveRecordCount++;
+}
+
+void MqttFilePersistence::applySubscriptionRemoved(const QString &clientId, const QByteArray &topicFilter)
+{
+    QHash<QString, MqttPersistentSession>::iterator session = m_sessions.find(clientId);
+    if (session == m_sessions.end()) {
+        return;
+    }
+    for (int i = 0; i < session->subscriptions.count(); i++) {
+        if (session->subscriptions.at(i).topicFilter() == topicFilter) {
+            session->subscriptions.remove(i);
+            m_liveRecordCount--;
+            return;
+        }
+    }
+}
+
+void MqttFilePersistence::applyUnackedPacket(const QString &clientId, const MqttPacket &packet)
+{
+    MqttPersistentSession &session = m_sessions[clientId];
+    session.clientId = clientId;
+    for (int i = 0; i < session.unackedPackets.count(); i++) {
+        if (session.unackedPackets.at(i).packetId() == packet.packetId()) {
+            session.unackedPackets.replace(i, packet);
+            return;
+        }
+    }
+    session.unackedPackets.append(packet);
+    m_liveRecordCount++;
+}
+
+void MqttFilePersistence::applyUnackedPacketRemoved(const QString &clientId, quint16 packetId)
+{
+    QHash<QString, MqttPersistentSession>::iterator session = m_sessions.find(clientId);
+    if (session == m_sessions.end()) {
+        return;
+    }
+    for (int i = 0; i < session->unackedPackets.count(); i++) {
+        if (session->unackedPackets.at(i).packetId() == packetId) {
+            session->unackedPackets.removeAt(i);
+            m_liveRecordCount--;
+            return;
+        }
+    }
+}
+
+void MqttFilePersistence::applySessionRemoved(const QString &clientId)
+{
+    MqttPersistentSession session = m_sessions.take(clientId);
+    m_liveRecordCount -= session.subscriptions.count() + session.unackedPackets.count();
+}
+
+QByteArray MqttFilePersistence::frameRecord(const QByteArray &record)
+{
+    QByteArray frame(recordFrameLength, Qt::Uninitialized);
+    qToBigEndian<quint32>(record.length(), frame.data());
+    qToBigEndian<quint16>(recordChecksum(record.constData(), record.length()), frame.data() + 4);
+    frame.append(record);
+    return frame;
+}
+
+QByteArray MqttFilePersistence::retainedMessageRecord(const MqttPacket &packet)
+{
+    QByteArray record;
+    QDataStream stream(&record, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << static_cast<quint8>(RecordRetainedMessage) << packet.serialize();
+    return record;
+}
+
+QByteArray MqttFilePersistence::subscriptionRecord(const QString &clientId, const MqttSubscription &subscription)
+{
+    QByteArray record;
+    QDataStream stream(&record, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << static_cast<quint8>(RecordSubscription) << clientId << subscription.topicFilter() << static_cast<quint8>(subscription.qoS());
+    return record;
+}
+
+QByteArray MqttFilePersistence::unackedPacketRecord(const QString &clientId, const MqttPacket &packet)
+{
+    QByteArray record;
+    QDataStream stream(&record, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << static_cast<quint8>(RecordUnackedPacket) << clientId << packet.serialize();
+    return record;
+}
@@ -0,0 +1,129 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* nymea-mqtt
+* MQTT library for nymea
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public License
+* as published by the Free Software Foundation, either version 3
+* of the License, or (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef MQTTFILEPERSISTENCE_H
+#define MQTTFILEPERSISTENCE_H
+
+#include <QObject>
+#include <QFile>
+#include <QHash>
+#include <QTimer>
+
+#include "mqttpersistence.h"
+
+// Stores the server state in an append-only log file. Every change is appended as a record. Once the log
+// holds considerably more records than needed to describe the current state, it is rewritten (compacted).
+class MqttFilePersistence: public QObject, public MqttPersistence
+{
+    Q_OBJECT
+public:
+    enum SyncPolicy {
+        // Leave it to the operating system to write the log to disk
+        SyncNever,
+        // Sync the log to disk every syncInterval() milliseconds, if it has been changed
+        SyncPeriodically,
+        // Sync the log to disk after every record. Safest, but slow.
+        SyncAlways
+    };
+    Q_ENUM(SyncPolicy)
+
+    explicit MqttFilePersistence(const QString &fileName, QObject *parent = nullptr);
+    ~MqttFilePersistence() override;
+
+    QString fileName() const;
+
+    SyncPolicy syncPolicy() const;
+    void setSyncPolicy(SyncPolicy syncPolicy);
+
+    // Defaults to 1000 ms
+    int syncInterval() const;
+    void setSyncInterval(int syncInterval);
+
+    // The log is compacted when it holds more than this many records and twice as many records as
+    // needed for the current state. Defaults to 10000.
+    int compactionThreshold() const;
+    void setCompactionThreshold(int compactionThreshold);
+
+    bool compact();
+
+    bool restore(MqttPackets *retainedMessages, QList<MqttPersistentSession> *sessions) override;
+
+    void storeRetainedMessage(const MqttPacket &packet) override;
+    void removeRetainedMessages(const QByteArray &topic) override;
+
+    void storeSubscription(const QString &clientId, const MqttSubscription &subscription) override;
+    void removeSubscription(const QString &clientId, const QByteArray &topicFilter) override;
+    void storeUnackedPacket(const QString &clientId, const MqttPacket &packet) override;
+    void removeUnackedPacket(const QString &clientId, quint16 packetId) override;
+    void removeSession(const QString &clientId) override;
+
+private slots:
+    void sync();
+
+private:
+    enum RecordType {
+        RecordRetainedMessage = 1,
+        RecordRetainedMessagesRemoved = 2,
+        RecordSubscription = 3,
+        RecordSubscriptionRemoved = 4,
+        RecordUnackedPacket = 5,
+        RecordUnackedPacketRemoved = 6,
+        RecordSessionRemoved = 7
+    };
+
+    bool openLog();
+    void appendRecord(const QByteArray &record);
+    bool applyRecord(const QByteArray &record);
+
+    void applyRetainedMessage(const MqttPacket &packet);
+    void applyRetainedMessagesRemoved(const QByteArray &topic);
+    void applySubscription(const QString &clientId, const MqttSubscription &subscription);
+    void applySubscriptionRemoved(const QString &clientId, const QByteArray &topicFilter);
+    void applyUnackedPacket(const QString &clientId, const MqttPacket &packet);
+    void applyUnackedPacketRemoved(const QString &clientId, quint16 packetId);
+    void applySessionRemoved(const QString &clientId);
+
+    static QByteArray frameRecord(const QByteArray &record);
+    static QByteArray retainedMessageRecord(const MqttPacket &packet);
+    static QByteArray subscriptionRecord(const QString &clientId, const MqttSubscription &subscription);
+    static QByteArray unackedPacketRecord(const QString &clientId, const MqttPacket &packet);
+
+    QFile m_file;
+    SyncPolicy m_syncPolicy = SyncPeriodically;
+    QTimer m_syncTimer;
+    bool m_unsynced = false;
+    int m_compactionThreshold = 10000;
+    // Records in the log and records needed to describe the current state
+    int m_recordCount = 0;
+    int m_liveRecordCount = 0;
+
+    // The current state, needed to compact the log
+    QHash<QByteArray, MqttPackets> m_retainedMessages;
+    QHash<QString, MqttPersistentSession> m_sessions;
+};
+
+#endif // MQTTFILEPERSISTENCE_H
@@ -0,0 +1,244 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* nymea-mqtt
+* MQTT library for nymea
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public License
+* as published by the Free Software Foundation, either version 3
+* of the License, or (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "mqttinflightwindow.h"
+
+MqttInFlightWindow::MqttInFlightWindow(int maximum):
+    m_maximum(qMax(0, maximum))
+{
+
+}
+
+int MqttInFlightWindow::maximum() const
+{
+    return m_maximum;
+}
+
+void MqttInFlightWindow::setMaximum(int maximum)
+{
+    m_maximum = qMax(0, maximum);
+}
+
+bool MqttInFlightWindow::append(const MqttPacket &packet, qint64 now)
+{
+    if (m_nodes.contains(packet.packetId())) {
+        replace(packet, now);
+        return true;
+    }
+
+    Node node;
+    node.packet = packet;
+    node.sentAt = now;
+    node.previous = m_last;
+    // Publishes are sent in order, so only if none is waiting already
+    const bool counts = countsAgainstWindow(packet);
+    node.sent = !counts || (m_firstUnsent == 0 && !windowFull());
+    if (node.sent && counts) {
+        m_inFlightCount++;
+    } else if (!node.sent && m_firstUnsent == 0) {
+        m_firstUnsent = packet.packetId();
+    }
+
+    if (m_last != 0) {
+        m_nodes[m_last].next = packet.packetId();
+    } else {
+        m_first = packet.packetId();
+    }
+    m_last = packet.packetId();
+    m_nodes.insert(packet.packetId(), node);
+    return node.sent;
+}
+
+void MqttInFlightWindow::replace(const MqttPacket &packet, qint64 now)
+{
+    QHash<quint16, Node>::iterator it = m_nodes.find(packet.packetId());
+    if (it == m_nodes.end()) {
+        return;
+    }
+    if (it->sent && countsAgainstWindow(it->packet) != countsAgainstWindow(packet)) {
+        m_inFlightCount += countsAgainstWindow(packet) ? 1 : -1;
+    }
+    it->packet = packet;
+    if (it->sent) {
+        it->sentAt = now;
+        it->retransmissions = 0;
+    }
+}
+
+MqttPacket MqttInFlightWindow::take(quint16 packetId)
+{
+    QHash<quint16, Node>::iterator it = m_nodes.find(packetId);
+    if (it == m_nodes.end()) {
+        return MqttPacket();
+    }
+
+    const Node node = it.value();
+    m_nodes.erase(it);
+
+    if (node.previous != 0) {
+        m_nodes[node.previous].next = node.next;
+    } else {
+        m_first = node.next;
+    }
+    if (node.next != 0) {
+        m_nodes[node.next].previous = node.previous;
+    } else {
+        m_last = node.previous;
+    }
+    if (m_firstUnsent == packetId) {
+        m_firstUnsent = node.next;
+    }
+    if (node.sent && countsAgainstWindow(node.packet)) {
+        m_inFlightCount--;
+    }
+    return node.packet;
+}
+
+bool MqttInFlightWindow::remove(quint16 packetId)
+{
+    if (!m_nodes.contains(packetId)) {
+        return false;
+    }
+    take(packetId);
+    return true;
+}
+
+bool MqttInFlightWindow::contains(quint16 packetId) const
+{
+    return m_nodes.contains(packetId);
+}
+
+MqttPacket MqttInFlightWindow::value(quint16 packetId) const
+{
+    return m_nodes.value(packetId).packet;
+}
+
+MqttPackets MqttInFlightWindow::packets() const
+{
+    MqttPackets packets;
+    for (quint16 packetId = m_first; packetId != 0; packetId = m_nodes.value(packetId).next) {
+        packets.append(m_nodes.value(packetId).packet);
+    }
+    return packets;
+}
+
+int MqttInFlightWindow::count() const
+{
+    return m_nodes.count();
+}
+
+bool MqttInFlightWindow::isEmpty() const
+{
+    return m_nodes.isEmpty();
+}
+
+int MqttInFlightWindow::inFlightCount() const
+{
+    return m_inFlightCount;
+}
+
+MqttPackets MqttInFlightWindow::takeSendable(qint64 now)
+{
+    MqttPackets packets;
+    while (m_firstUnsent != 0) {
+        Node &node = m_nodes[m_firstUnsent];
+        if (!node.sent) {
+            const bool counts = countsAgainstWindow(node.packet);
+            if (counts && windowFull()) {
+                break;
+            }
+            node.sent = true;
+            node.sentAt = now;
+            node.retransmissions = 0;
+            if (counts) {
+                m_inFlightCount++;
+            }
+            packets.append(node.packet);
+        }
+        m_firstUnsent = node.next;
+    }
+    return packets;
+}
+
+void MqttInFlightWindow::resetSent()
+{
+    for (QHash<quint16, Node>::iterator it = m_nodes.begin(); it != m_nodes.end(); ++it) {
+        it->sent = false;
+    }
+    m_inFlightCount = 0;
+    m_firstUnsent = m_first;
+}
+
+MqttPackets MqttInFlightWindow::takeOverdue(qint64 now, qint64 interval, qint64 maximumInterval)
+{
+    MqttPackets packets;
+    // Publishes are sent in order, all of them in flight come before the first unsent packet
+    for (quint16 packetId = m_first; packetId != m_firstUnsent; ) {
+        Node &node = m_nodes[packetId];
+        if (node.sent && countsAgainstWindow(node.packet)
+                && node.sentAt + retransmissionTimeout(node.retransmissions, interval, maximumInterval) <= now) {
+            node.sentAt = now;
+            node.retransmissions++;
+            packets.append(node.packet);
+        }
+        packetId = node.next;
+    }
+    return packets;
+}
+
+qint64 MqttInFlightWindow::nextRetransmission(qint64 interval, qint64 maximumInterval) const
+{
+    qint64 next = -1;
+    for (quint16 packetId = m_first; packetId != m_firstUnsent; ) {
+        const Node &node = m_nodes.constFind(packetId).value();
+        if (node.sent && countsAgainstWindow(node.packet)) {
+            const qint64 deadline = node.sentAt + retransmissionTimeout(node.retransmissions, interval, maximumInterval);
+            if (next < 0 || deadline < next) {
+                next = deadline;
+            }
+        }
+        packetId = node.next;
+    }
+    return next;
+}
+
+bool MqttInFlightWindow::countsAgainstWindow(const MqttPacket &packet)
+{
+    return packet.type() == MqttPacket::TypePublish || packet.type() == MqttPacket::TypePubrel;
+}
+
+qint64 MqttInFlightWindow::retransmissionTimeout(int retransmissions, qint64 interval, qint64 maximumInterval)
+{
+    // Doubling more often would exceed any sensible maximum anyways
+    const qint64 timeout = interval << qMin(retransmissions, 20);
+    return qMax(interval, qMin(timeout, maximumInterval));
+}
+
+bool MqttInFlightWindow::windowFull() const
+{
+    return m_maximum > 0 && m_inFlightCount >= m_maximum;
+}
@@ -0,0 +1,103 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* nymea-mqtt
+* MQTT library for nymea
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public License
+* as published by the Free Software Foundation, either version 3
+* of the License, or (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef MQTTINFLIGHTWINDOW_H
+#define MQTTINFLIGHTWINDOW_H
+
+#include <QHash>
+#include <QList>
+
+#include "mqttpacket.h"
+
+// The packets of a session waiting for acknowledgement, in the order they have been added, with lookups
+// and removals by packet ID in constant time. Of the publishes and PUBRELs, only the given maximum is sent
+// at a time, the following ones wait in order until acknowledgements free up the window. Other packets,
+// like SUBSCRIBEs or PUBRECs, don't count against the window and are sent right away.
+// Times are milliseconds on the caller's monotonic clock and are used to retransmit publishes and PUBRELs
+// which haven't been acknowledged in time.
+class MqttInFlightWindow
+{
+public:
+    explicit MqttInFlightWindow(int maximum = 0);
+
+    // 0 means unlimited
+    int maximum() const;
+    void setMaximum(int maximum);
+
+    // Appends the packet, returns true if it is to be sent right away and false if it waits for the window
+    bool append(const MqttPacket &packet, qint64 now = 0);
+    // Replaces the packet with the same ID keeping its position and state, e.g. a PUBLISH with its PUBREL
+    void replace(const MqttPacket &packet, qint64 now = 0);
+    // Returns a packet of type 0 if there is none with the given ID
+    MqttPacket take(quint16 packetId);
+    bool remove(quint16 packetId);
+
+    bool contains(quint16 packetId) const;
+    MqttPacket value(quint16 packetId) const;
+    // All packets in the order they have been added
+    MqttPackets packets() const;
+    int count() const;
+    bool isEmpty() const;
+    // The publishes and PUBRELs which have been sent and not acknowledged yet
+    int inFlightCount() const;
+
+    // Packets waiting for the window which fit into it now. They count as sent afterwards.
+    MqttPackets takeSendable(qint64 now = 0);
+    // Everything counts as not sent again, e.g. when the session resumes on a new connection
+    void resetSent();
+
+    // Packets in flight which haven't been acknowledged within the interval, doubled with every retransmission
+    // up to the maximum interval. They count as retransmitted afterwards.
+    MqttPackets takeOverdue(qint64 now, qint64 interval, qint64 maximumInterval);
+    // The time the next packet in flight is due for retransmission, -1 if there is none
+    qint64 nextRetransmission(qint64 interval, qint64 maximumInterval) const;
+
+private:
+    static bool countsAgainstWindow(const MqttPacket &packet);
+    static qint64 retransmissionTimeout(int retransmissions, qint64 interval, qint64 maximumInterval);
+    bool windowFull() const;
+
+    struct Node {
+        MqttPacket packet;
+        quint16 previous = 0;
+        quint16 next = 0;
+        bool sent = false;
+        qint64 sentAt = 0;
+        int retransmissions = 0;
+    };
+
+    int m_maximum = 0;
+    // 0 is not a valid packet ID and marks the ends of the list
+    QHash<quint16, Node> m_nodes;
+    quint16 m_first = 0;
+    quint16 m_last = 0;
+    // All packets before this one have been sent
+    quint16 m_firstUnsent = 0;
+    int m_inFlightCount = 0;
+};
+
+#endif // MQTTINFLIGHTWINDOW_H
@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* nymea-mqtt
+* MQTT library for nymea
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public License
+* as published by the Free Software Foundation, either version 3
+* of the License, or (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "mqttinputbuffer.h"
+
+void MqttInputBuffer::append(const QByteArray &data)
+{
+    if (m_readPosition >= m_buffer.size()) {
+        // Everything has been consumed, take over the new data without copying it
+        m_buffer = data;
+        m_readPosition = 0;
+        return;
+    }
+    if (m_readPosition > 0) {
+        // Only the tail of an incomplete packet is left at this point
+        m_buffer.remove(0, m_readPosition);
+        m_readPosition = 0;
+    }
+    m_buffer.append(data);
+}
+
+const char *MqttInputBuffer::data() const
+{
+    return m_buffer.constData() + m_readPosition;
+}
+
+int MqttInputBuffer::size() const
+{
+    return m_buffer.size() - m_readPosition;
+}
+
+bool MqttInputBuffer::isEmpty() const
+{
+    return m_readPosition >= m_buffer.size();
+}
+
+void MqttInputBuffer::consume(int length)
+{
+    m_readPosition = qMin(m_readPosition + length, m_buffer.size());
+}
+
+void MqttInputBuffer::clear()
+{
+    m_buffer.clear();
+    m_readPosition = 0;
+}
@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* nymea-mqtt
+* MQTT library for nymea
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public License
+* as published by the Free Software Foundation, either version 3
+* of the License, or (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef MQTTINPUTBUFFER_H
+#define MQTTINPUTBUFFER_H
+
+#include <QByteArray>
+
+// Collects incoming stream data until complete packets can be parsed from it. Parsed packets
+// are consumed by moving a read cursor instead of removing them from the front of the buffer,
+// so parsing a burst of packets doesn't move the remaining data around for each packet.
+// Consumed data is only dropped when new data is appended.
+class MqttInputBuffer
+{
+public:
+    MqttInputBuffer() = default;
+
+    void append(const QByteArray &data);
+
+    // The unread data
+    const char *data() const;
+    int size() const;
+    bool isEmpty() const;
+
+    void consume(int length);
+    void clear();
+
+private:
+    QByteArray m_buffer;
+    int m_readPosition = 0;
+};
+
+#endif // MQTTINPUTBUFFER_H
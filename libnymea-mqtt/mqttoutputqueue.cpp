@@ -0,0 +1,93 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* nymea-mqtt
+* MQTT library for nymea
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public License
+* as published by the Free Software Foundation, either version 3
+* of the License, or (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "mqttoutputqueue.h"
+
+void MqttOutputQueue::enqueue(const QByteArray &data, bool droppable)
+{
+    if (m_discarding) {
+        return;
+    }
+    if (droppable) {
+        m_droppableEntries.enqueue({data, m_nextSequence++});
+    } else {
+        m_entries.enqueue({data, m_nextSequence++});
+    }
+    m_bytes += data.size();
+}
+
+QByteArray MqttOutputQueue::dequeue()
+{
+    // The older head of both
+    QQueue<Entry> &entries = m_droppableEntries.isEmpty() || (!m_entries.isEmpty() && m_entries.head().sequence < m_droppableEntries.head().sequence)
+            ? m_entries : m_droppableEntries;
+    Entry entry = entries.dequeue();
+    m_bytes -= entry.data.size();
+    return entry.data;
+}
+
+bool MqttOutputQueue::dropOldest()
+{
+    if (m_droppableEntries.isEmpty()) {
+        return false;
+    }
+    m_bytes -= m_droppableEntries.dequeue().data.size();
+    return true;
+}
+
+int MqttOutputQueue::count() const
+{
+    return m_entries.count() + m_droppableEntries.count();
+}
+
+qint64 MqttOutputQueue::bytes() const
+{
+    return m_bytes;
+}
+
+bool MqttOutputQueue::isEmpty() const
+{
+    return m_entries.isEmpty() && m_droppableEntries.isEmpty();
+}
+
+void MqttOutputQueue::clear()
+{
+    m_entries.clear();
+    m_droppableEntries.clear();
+    m_bytes = 0;
+}
+
+void MqttOutputQueue::discard()
+{
+    clear();
+    m_discarding = true;
+}
+
+bool MqttOutputQueue::isDiscarding() const
+{
+    return m_discarding;
+}
@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* nymea-mqtt
+* MQTT library for nymea
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public License
+* as published by the Free Software Foundation, either version 3
+* of the License, or (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef MQTTOUTPUTQUEUE_H
+#define MQTTOUTPUTQUEUE_H
+
+#include <QByteArray>
+#include <QQueue>
+
+// Holds serialized packets for a connection whose write buffer is full. Keeps track of the
+// queued bytes and of which packets may be dropped (QoS 0 publishes) if the queue overflows.
+// Droppable packets are kept in a FIFO of their own, so that dropping the oldest one doesn't
+// search the queue. Sequence numbers keep the order across both FIFOs.
+class MqttOutputQueue
+{
+public:
+    MqttOutputQueue() = default;
+
+    void enqueue(const QByteArray &data, bool droppable);
+    QByteArray dequeue();
+    // Drops the oldest droppable packet. Returns false if there is none.
+    bool dropOldest();
+
+    int count() const;
+    qint64 bytes() const;
+    bool isEmpty() const;
+    void clear();
+
+    // Clears the queue and ignores everything enqueued afterwards, used when the connection is going away
+    void discard();
+    bool isDiscarding() const;
+
+private:
+    struct Entry {
+        QByteArray data;
+        quint64 sequence;
+    };
+    QQueue<Entry> m_entries;
+    QQueue<Entry> m_droppableEntries;
+    quint64 m_nextSequence = 0;
+    qint64 m_bytes = 0;
+    bool m_discarding = false;
+};
+
+#endif // MQTTOUTPUTQUEUE_H
@@ -47,6 +47,25 @@ Q_LOGGING_CATEGORY(dbgProto, "nymea.mqtt.protocol")
 #define ASSERT_LEN(a, name) if (remainingLength < a) { qCWarning(dbgProto) << "Bad" << name << "packet. Data too short."; return -1; }
 #define VERIFY_LEN(a, name) if (remainingLength != a) { qCWarning(dbgProto) << "Bad" << name << "packet. Data length unexpected."; return -1; }
 
+static inline quint8 readUInt8(const char *data, qint64 &pos)
+{
+    return static_cast<quint8>(data[pos++]);
+}
+
+static inline quint16 readUInt16(const char *data, qint64 &pos)
+{
+    const quint16 value = static_cast<quint16>((static_cast<quint8>(data[pos]) << 8) | static_cast<quint8>(data[pos + 1]));
+    pos += 2;
+    return value;
+}
+
+static inline QByteArray readBytes(const char *data, qint64 &pos, int length)
+{
+    QByteArray value(data + pos, length);
+    pos += length;
+    return value;
+}
+
 MqttPacket::MqttPacket():
     d_ptr(new MqttPacketPrivate())
 {
@@ -366,92 +385,80 @@ void MqttPacket::addSubscribeReturnCode(Mqtt::SubscribeReturnCode subscribeRetur
 
 int MqttPacket::parse(const QByteArray &buffer)
 {
-    if (buffer.length() < 2) {
+    return parse(buffer.constData(), buffer.length());
+}
+
+int MqttPacket::parse(const char *data, int size)
+{
+    quint32 remainingLength = 0;
+    const int fixedHeaderLength = MqttPacketPrivate::decodeFixedHeader(data, size, &remainingLength);
+    if (fixedHeaderLength == 0) {
         return 0;
     }
-    QDataStream inputStream(buffer);
-//    qCDebug(dbgProto()) << "MQTT input data:\n" << buffer.toHex();
-
-    inputStream >> d_ptr->header;
-
-    quint16 remainingLength = 0;
-    int multiplier = 1;
-    quint8 lengthBit;
-    quint8 lenFields = 0;
-    do {
-        inputStream >> lengthBit;
-        remainingLength += (lengthBit & 0x7F) * multiplier;
-        multiplier *= 128;
-        lenFields++;
-        if (multiplier > 128*128*128) {
-            qCWarning(dbgProto) << "Remaining Length field invalid";
-            return -1;
-        }
-    } while((lengthBit & 0x80) != 0);
+    if (fixedHeaderLength < 0) {
+        qCWarning(dbgProto) << "Remaining Length field invalid";
+        return -1;
+    }
 
-    if (remainingLength > buffer.length() - 1 - lenFields) {
-        qCDebug(dbgProto) << "Cannot process MQTT packet. Remaining Length field larger than input data size:" << remainingLength << ">" << (buffer.length() - 1 - lenFields);
+    if (remainingLength > static_cast<quint32>(size - fixedHeaderLength)) {
+        qCDebug(dbgProto) << "Cannot process MQTT packet. Remaining Length field larger than input data size:" << remainingLength << ">" << (size - fixedHeaderLength);
         return 0;
     }
 
+//    qCDebug(dbgProto()) << "MQTT input data:\n" << QByteArray(data, size).toHex();
+
+    d_ptr->header = static_cast<quint8>(data[0]);
+
     if (!d_ptr->verifyHeaderFlags()) {
         qCDebug(dbgProto) << "Bad MQTT packet. Fixed header flags invalid.";
         return -1;
     }
 
-    const quint16 fullRemainingLength = remainingLength;
+    const quint32 fullRemainingLength = remainingLength;
 
+    // All fields are read straight from the input data, strings and payload are copied exactly once into their members
+    qint64 pos = fixedHeaderLength;
     quint16 strLen;
-    const int maxStrLen = qMax(1, static_cast<int>(fullRemainingLength));
-    QByteArray str(maxStrLen, '\0');
 
     switch (type()) {
     case TypeConnect: {
         ASSERT_LEN(2, "CONNECT")
-        inputStream >> strLen;
+        strLen = readUInt16(data, pos);
         remainingLength -= 2;
 
         ASSERT_LEN(strLen, "CONNECT")
-        inputStream.readRawData(str.data(), qMin(maxStrLen, static_cast<int>(strLen)));
+        d_ptr->protocolName = readBytes(data, pos, strLen);
         remainingLength -= strLen;
-        d_ptr->protocolName = QByteArray(str.constData(), strLen);
 
         ASSERT_LEN(6, "CONNECT")
-        quint8 pl;
-        inputStream >> pl;
-        d_ptr->protocolLevel = static_cast<Mqtt::Protocol>(pl);
+        d_ptr->protocolLevel = static_cast<Mqtt::Protocol>(readUInt8(data, pos));
         remainingLength -= 1;
-        quint8 cF;
-        inputStream >> cF;
+        d_ptr->connectFlags = static_cast<Mqtt::ConnectFlags>(readUInt8(data, pos));
         remainingLength -= 1;
-        d_ptr->connectFlags = static_cast<Mqtt::ConnectFlags>(cF);
-        inputStream >> d_ptr->keepAlive;
+        d_ptr->keepAlive = readUInt16(data, pos);
         remainingLength -= 2;
 
-        inputStream >> strLen;
+        strLen = readUInt16(data, pos);
         remainingLength -= 2;
 
         ASSERT_LEN(strLen, "CONNECT")
-        inputStream.readRawData(str.data(), qMin(maxStrLen, static_cast<int>(strLen)));
+        d_ptr->clientId = readBytes(data, pos, strLen);
         remainingLength -= strLen;
-        d_ptr->clientId = QByteArray(str.constData(), strLen);
 
         if (connectFlags().testFlag(Mqtt::ConnectFlagWill)) {
             ASSERT_LEN(2, "CONNECT")
-            inputStream >> strLen;
+            strLen = readUInt16(data, pos);
             remainingLength -= 2;
             ASSERT_LEN(strLen, "CONNECT")
-            inputStream.readRawData(str.data(), qMin(maxStrLen, static_cast<int>(strLen)));
+            d_ptr->willTopic = readBytes(data, pos, strLen);
             remainingLength -= strLen;
-            d_ptr->willTopic = QByteArray(str.constData(), strLen);
 
             ASSERT_LEN(2, "CONNECT")
-            inputStream >> strLen;
+            strLen = readUInt16(data, pos);
             remainingLength -= 2;
             ASSERT_LEN(strLen, "CONNECT")
-            inputStream.readRawData(str.data(), qMin(maxStrLen, static_cast<int>(strLen)));
+            d_ptr->willMessage = readBytes(data, pos, strLen);
             remainingLength -= strLen;
-            d_ptr->willMessage = QByteArray(str.constData(), strLen);
         } else {
             if (willRetain() || willQoS() != Mqtt::QoS0) {
                 qCWarning(dbgProto) << "Bad CONNECT packet. Will flag not set but WillQoS or WillRetain set.";
@@ -461,12 +468,11 @@ int MqttPacket::parse(const QByteArray &buffer)
 
         if (connectFlags().testFlag(Mqtt::ConnectFlagUsername)) {
             ASSERT_LEN(2, "CONNECT")
-            inputStream >> strLen;
+            strLen = readUInt16(data, pos);
             remainingLength -= 2;
             ASSERT_LEN(strLen, "CONNECT")
-            inputStream.readRawData(str.data(), qMin(maxStrLen, static_cast<int>(strLen)));
+            d_ptr->username = readBytes(data, pos, strLen);
             remainingLength -= strLen;
-            d_ptr->username = QByteArray(str.constData(), strLen);
         } else {
             if (connectFlags().testFlag(Mqtt::ConnectFlagPassword)) {
                 qCWarning(dbgProto) << "Bad CONNECT packet. Username flag not set but password is set.";
@@ -476,68 +482,61 @@ int MqttPacket::parse(const QByteArray &buffer)
 
         if (connectFlags().testFlag(Mqtt::ConnectFlagPassword)) {
             ASSERT_LEN(2, "CONNECT")
-            inputStream >> strLen;
+            strLen = readUInt16(data, pos);
             remainingLength -= 2;
             ASSERT_LEN(strLen, "CONNECT")
-            inputStream.readRawData(str.data(), qMin(maxStrLen, static_cast<int>(strLen)));
+            d_ptr->password = readBytes(data, pos, strLen);
             remainingLength -= strLen;
-            d_ptr->password = QByteArray(str.constData(), strLen);
         }
         VERIFY_LEN(0, "CONNECT")
         break;
     }
     case TypeConnack: {
         VERIFY_LEN(2, "CONNACK")
-        quint8 connackFlags;
-        inputStream >> connackFlags;
+        d_ptr->connackFlags = static_cast<Mqtt::ConnackFlags>(readUInt8(data, pos));
         remainingLength -= 1;
-        d_ptr->connackFlags = static_cast<Mqtt::ConnackFlags>(connackFlags);
-        quint8 connectReturnCode;
-        inputStream >> connectReturnCode;
-        d_ptr->connectReturnCode = static_cast<Mqtt::ConnectReturnCode>(connectReturnCode);
+        d_ptr->connectReturnCode = static_cast<Mqtt::ConnectReturnCode>(readUInt8(data, pos));
         remainingLength -= 1;
         VERIFY_LEN(0, "CONNACK")
         break;
     }
     case TypePublish: {
         ASSERT_LEN(2, "PUBLISH")
-        inputStream >> strLen;
+        strLen = readUInt16(data, pos);
         remainingLength -= 2;
         ASSERT_LEN(strLen, "PUBLISH")
-        inputStream.readRawData(str.data(), qMin(maxStrLen, static_cast<int>(strLen)));
+        d_ptr->topic = readBytes(data, pos, strLen);
         remainingLength -= strLen;
-        d_ptr->topic = QByteArray(str.constData(), strLen);
 
         if (qos() == Mqtt::QoS1 || qos() == Mqtt::QoS2) {
             ASSERT_LEN(2, "PUBLISH")
-            inputStream >> d_ptr->packetId;
+            d_ptr->packetId = readUInt16(data, pos);
             remainingLength -= 2;
         }
 
-        const int payloadLen = qMin(maxStrLen, static_cast<int>(remainingLength));
-        inputStream.readRawData(str.data(), payloadLen);
-        d_ptr->payload = QByteArray(str.constData(), payloadLen);
+        // The payload is whatever is left in the packet
+        d_ptr->payload = readBytes(data, pos, static_cast<int>(remainingLength));
         break;
     }
     case TypePuback:
         VERIFY_LEN(2, "PUBACK")
-        inputStream >> d_ptr->packetId;
+        d_ptr->packetId = readUInt16(data, pos);
         break;
     case TypePubrec:
         VERIFY_LEN(2, "PUBREC")
-        inputStream >> d_ptr->packetId;
+        d_ptr->packetId = readUInt16(data, pos);
         break;
     case TypePubrel:
         VERIFY_LEN(2, "PUBREL")
-        inputStream >> d_ptr->packetId;
+        d_ptr->packetId = readUInt16(data, pos);
         break;
     case TypePubcomp:
         VERIFY_LEN(2, "PUBCOMP")
-        inputStream >> d_ptr->packetId;
+        d_ptr->packetId = readUInt16(data, pos);
         break;
     case TypeSubscribe: {
         ASSERT_LEN(2, "SUBSCRIBE")
-        inputStream >> d_ptr->packetId;
+        d_ptr->packetId = readUInt16(data, pos);
         remainingLength -= 2;
 
         if (remainingLength == 0) {
@@ -546,17 +545,15 @@ int MqttPacket::parse(const QByteArray &buffer)
         }
         while (remainingLength > 0) {
             ASSERT_LEN(2, "SUBSCRIBE")
-            inputStream >> strLen;
+            strLen = readUInt16(data, pos);
             remainingLength -= 2;
             ASSERT_LEN(strLen, "SUBSCRIBE")
-            inputStream.readRawData(str.data(), qMin(maxStrLen, static_cast<int>(strLen)));
-            remainingLength -= strLen;
             MqttSubscription subscription;
-            subscription.setTopicFilter(QByteArray(str.constData(), strLen));
+            subscription.setTopicFilter(readBytes(data, pos, strLen));
+            remainingLength -= strLen;
 
             ASSERT_LEN(1, "SUBSCRIBE")
-            quint8 requestedQoS;
-            inputStream >> requestedQoS;
+            quint8 requestedQoS = readUInt8(data, pos);
             remainingLength -= 1;
             if ((requestedQoS & 0xFC) != 0x00) {
                 qCWarning(dbgProto) << "Bad SUBSCRIBE packet. Reserved bits set in requested QoS field.";
@@ -573,35 +570,32 @@ int MqttPacket::parse(const QByteArray &buffer)
     }
     case TypeSuback:
         ASSERT_LEN(3, "SUBACK")
-        inputStream >> d_ptr->packetId;
+        d_ptr->packetId = readUInt16(data, pos);
         remainingLength -= 2;
         while (remainingLength > 0) {
-            quint8 subscribeReturnCode;
-            inputStream >> subscribeReturnCode;
+            d_ptr->subscribeReturnCodes.append(static_cast<Mqtt::SubscribeReturnCode>(readUInt8(data, pos)));
             remainingLength -= 1;
-            d_ptr->subscribeReturnCodes.append(static_cast<Mqtt::SubscribeReturnCode>(subscribeReturnCode));
         }
         break;
     case TypeUnsubscribe: {
         ASSERT_LEN(5, "UNSUBSCRIBE")
-        inputStream >> d_ptr->packetId;
+        d_ptr->packetId = readUInt16(data, pos);
         remainingLength -= 2;
         while (remainingLength > 0) {
             ASSERT_LEN(2, "UNSUBSCRIBE")
-            inputStream >> strLen;
+            strLen = readUInt16(data, pos);
             remainingLength -= 2;
             ASSERT_LEN(strLen, "UNSUBSCRIBE")
-            inputStream.readRawData(str.data(), qMin(maxStrLen, static_cast<int>(strLen)));
-            remainingLength -= strLen;
             MqttSubscription subscription;
-            subscription.setTopicFilter(QByteArray(str.constData(), strLen));
+            subscription.setTopicFilter(readBytes(data, pos, strLen));
+            remainingLength -= strLen;
             d_ptr->subscriptions.append(subscription);
         }
         }
         break;
     case TypeUnsuback:
         VERIFY_LEN(2, "UNSUBACK")
-        inputStream >> d_ptr->packetId;
+        d_ptr->packetId = readUInt16(data, pos);
         break;
     case TypePingreq:
         VERIFY_LEN(0, "PINGREC")
@@ -613,7 +607,22 @@ int MqttPacket::parse(const QByteArray &buffer)
         VERIFY_LEN(0, "DISCONNECT")
         break;
     }
-    return fullRemainingLength + 1 + lenFields;
+    return fixedHeaderLength + static_cast<int>(fullRemainingLength);
+}
+
+qint64 MqttPacket::packetLength(const QByteArray &buffer)
+{
+    return packetLength(buffer.constData(), buffer.length());
+}
+
+qint64 MqttPacket::packetLength(const char *data, int size)
+{
+    quint32 remainingLength = 0;
+    const int fixedHeaderLength = MqttPacketPrivate::decodeFixedHeader(data, size, &remainingLength);
+    if (fixedHeaderLength <= 0) {
+        return fixedHeaderLength;
+    }
+    return fixedHeaderLength + remainingLength;
 }
 
 QByteArray MqttPacket::serialize() const
@@ -626,10 +635,10 @@ QByteArray MqttPacket::serialize() const
 #endif
     stream << d_ptr->header;
 
-    quint16 remainingLength = 0;
+    quint32 remainingLength = 0;
     switch (type()) {
     case TypeConnect:
-        remainingLength = static_cast<quint16>(
+        remainingLength = static_cast<quint32>(
                     2 // protocol name length
                     + d_ptr->protocolName.length()
                     + 1 // protocol level
@@ -689,6 +698,11 @@ QByteArray MqttPacket::serialize() const
         break;
     }
 
+    if (remainingLength > MqttPacketPrivate::maximumRemainingLength) {
+        qCWarning(dbgProto) << "Cannot serialize MQTT packet. Remaining Length" << remainingLength << "exceeds the protocol limit of" << MqttPacketPrivate::maximumRemainingLength << "bytes.";
+        return QByteArray();
+    }
+
     quint8 encodedByte;
     do {
         encodedByte = remainingLength % 128;
@@ -810,6 +824,25 @@ MqttPacketPrivate::MqttPacketPrivate(const MqttPacketPrivate &other):
 
 }
 
+int MqttPacketPrivate::decodeFixedHeader(const char *data, qint64 size, quint32 *remainingLength)
+{
+    // The Remaining Length is encoded in up to 4 bytes following the first header byte,
+    // with 7 bits of the value in each byte and the MSB flagging a continuation byte.
+    quint32 value = 0;
+    for (int i = 1; i <= 4; i++) {
+        if (size <= i) {
+            return 0;
+        }
+        const quint8 encodedByte = static_cast<quint8>(data[i]);
+        value += static_cast<quint32>(encodedByte & 0x7F) << (7 * (i - 1));
+        if ((encodedByte & 0x80) == 0) {
+            *remainingLength = value;
+            return i + 1;
+        }
+    }
+    return -1;
+}
+
 bool MqttPacketPrivate::verifyHeaderFlags()
 {
     bool fail = false;
@@ -128,8 +128,17 @@ public:
     // Returns -1 on bad data input, bad() will return true
     // Returns 0 if input data is ok, but not long enough, bad() will return true
     int parse(const QByteArray &buffer);
+    // Same as above, reading straight from the given memory, e.g. a connection buffer holding multiple packets
+    int parse(const char *data, int size);
     QByteArray serialize() const;
 
+    // Decodes only the fixed header at the start of the buffer, without requiring the rest of the packet.
+    // Returns the total length of the packet (fixed header + Remaining Length)
+    // Returns 0 if the fixed header is not complete yet
+    // Returns -1 if the Remaining Length field is invalid
+    static qint64 packetLength(const QByteArray &buffer);
+    static qint64 packetLength(const char *data, int size);
+
     bool operator==(const MqttPacket &other) const;
     MqttPacket &operator=(const MqttPacket &other);
 
@@ -138,5 +147,6 @@ private:
 };
 
 typedef QList<MqttPacket> MqttPackets;
+Q_DECLARE_METATYPE(MqttPackets)
 
 #endif // MQTTPACKET_H
@@ -47,6 +47,11 @@ public:
     MqttPacketPrivate(){ }
     MqttPacketPrivate(const MqttPacketPrivate &other);
 
+    static const quint32 maximumRemainingLength = 268435455;
+
+    // Returns the length of the fixed header and fills remainingLength, 0 if the fixed header is incomplete or -1 if it is invalid
+    static int decodeFixedHeader(const char *data, qint64 size, quint32 *remainingLength);
+
     bool verifyHeaderFlags();
     MqttPacket::Type type() const;
     bool dup() const;
@@ -0,0 +1,136 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* nymea-mqtt
+* MQTT library for nymea
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public License
+* as published by the Free Software Foundation, either version 3
+* of the License, or (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "mqttpacketidallocator.h"
+
+#include <QtAlgorithms>
+
+static const int bitmapWords = 1024;
+static const int summaryWords = 16;
+static const int maximumCount = 65535;
+
+quint16 MqttPacketIdAllocator::allocate()
+{
+    if (m_count == maximumCount) {
+        return 0;
+    }
+
+    int packetId = m_lastId == maximumCount ? -1 : findFree(m_lastId + 1);
+    if (packetId < 0) {
+        packetId = findFree(1);
+    }
+    m_lastId = static_cast<quint16>(packetId);
+    reserve(m_lastId);
+    return m_lastId;
+}
+
+void MqttPacketIdAllocator::reserve(quint16 packetId)
+{
+    if (packetId == 0 || contains(packetId)) {
+        return;
+    }
+
+    if (m_words.isEmpty()) {
+        m_words.fill(0, bitmapWords + summaryWords);
+        // 0 is not a valid packet ID
+        m_words[0] = 1;
+    }
+
+    const int word = packetId >> 6;
+    m_words[word] |= Q_UINT64_C(1) << (packetId & 63);
+    if (m_words.at(word) == ~Q_UINT64_C(0)) {
+        m_words[bitmapWords + (word >> 6)] |= Q_UINT64_C(1) << (word & 63);
+    }
+    m_count++;
+}
+
+void MqttPacketIdAllocator::release(quint16 packetId)
+{
+    if (packetId == 0 || !contains(packetId)) {
+        return;
+    }
+
+    if (--m_count == 0) {
+        m_words = QVector<quint64>();
+        return;
+    }
+
+    const int word = packetId >> 6;
+    m_words[word] &= ~(Q_UINT64_C(1) << (packetId & 63));
+    m_words[bitmapWords + (word >> 6)] &= ~(Q_UINT64_C(1) << (word & 63));
+}
+
+bool MqttPacketIdAllocator::contains(quint16 packetId) const
+{
+    if (m_words.isEmpty() || packetId == 0) {
+        return false;
+    }
+    return m_words.at(packetId >> 6) & (Q_UINT64_C(1) << (packetId & 63));
+}
+
+int MqttPacketIdAllocator::count() const
+{
+    return m_count;
+}
+
+bool MqttPacketIdAllocator::isFull() const
+{
+    return m_count == maximumCount;
+}
+
+void MqttPacketIdAllocator::clear()
+{
+    m_words = QVector<quint64>();
+    m_count = 0;
+}
+
+int MqttPacketIdAllocator::findFree(int from) const
+{
+    if (m_words.isEmpty()) {
+        return from;
+    }
+
+    int word = from >> 6;
+    quint64 free = ~m_words.at(word) & (~Q_UINT64_C(0) << (from & 63));
+    if (free) {
+        return (word << 6) + qCountTrailingZeroBits(free);
+    }
+
+    // Look for the next word with a free ID in the summary
+    const int nextWord = word + 1;
+    for (int summaryWord = nextWord >> 6; summaryWord < summaryWords; summaryWord++) {
+        quint64 notFull = ~m_words.at(bitmapWords + summaryWord);
+        if (summaryWord == nextWord >> 6) {
+            notFull &= ~Q_UINT64_C(0) << (nextWord & 63);
+        }
+        if (notFull) {
+            word = (summaryWord << 6) + qCountTrailingZeroBits(notFull);
+            return (word << 6) + qCountTrailingZeroBits(~m_words.at(word));
+        }
+    }
+    return -1;
+}
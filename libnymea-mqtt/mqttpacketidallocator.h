@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* nymea-mqtt
+* MQTT library for nymea
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public License
+* as published by the Free Software Foundation, either version 3
+* of the License, or (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef MQTTPACKETIDALLOCATOR_H
+#define MQTTPACKETIDALLOCATOR_H
+
+#include <QVector>
+
+// Hands out the packet IDs of a session, round robin so that a just released ID isn't reused right away.
+// Backed by a bitmap of all 65535 IDs and a summary of its full words, allocating and releasing take
+// constant time. The bitmap only takes memory while IDs are in use.
+class MqttPacketIdAllocator
+{
+public:
+    MqttPacketIdAllocator() = default;
+
+    // Returns 0 if all IDs are in use
+    quint16 allocate();
+    // Marks an ID as in use which has not been allocated here, e.g. one restored from a persistence
+    void reserve(quint16 packetId);
+    void release(quint16 packetId);
+    bool contains(quint16 packetId) const;
+
+    int count() const;
+    bool isFull() const;
+    void clear();
+
+private:
+    // The first free ID from the given one on, -1 if there is none
+    int findFree(int from) const;
+
+    // 1024 words for the IDs, followed by 16 words with a bit for each full word
+    QVector<quint64> m_words;
+    int m_count = 0;
+    quint16 m_lastId = 0;
+};
+
+#endif // MQTTPACKETIDALLOCATOR_H
@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* nymea-mqtt
+* MQTT library for nymea
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public License
+* as published by the Free Software Foundation, either version 3
+* of the License, or (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef MQTTPERSISTENCE_H
+#define MQTTPERSISTENCE_H
+
+#include <QString>
+#include <QList>
+
+#include "mqttpacket.h"
+#include "mqttsubscription.h"
+
+// A session of a client which connected with the clean session flag unset
+class MqttPersistentSession
+{
+public:
+    QString clientId;
+    MqttSubscriptions subscriptions;
+    // Packets which have not been acknowledged yet, in the order they have been sent
+    MqttPackets unackedPackets;
+};
+
+// Stores the state of a server which needs to survive a restart: retained messages and persistent sessions.
+// The server reports every change of that state, backends are expected to store them in the order they arrive.
+class MqttPersistence
+{
+public:
+    virtual ~MqttPersistence() = default;
+
+    // Called once when the persistence is set on the server. Returns false if the stored state could not be loaded.
+    virtual bool restore(MqttPackets *retainedMessages, QList<MqttPersistentSession> *sessions) = 0;
+
+    // Adds a message to the retained messages of the packet's topic
+    virtual void storeRetainedMessage(const MqttPacket &packet) = 0;
+    virtual void removeRetainedMessages(const QByteArray &topic) = 0;
+
+    // Adds a subscription, or replaces the QoS of an existing one with the same topic filter
+    virtual void storeSubscription(const QString &clientId, const MqttSubscription &subscription) = 0;
+    virtual void removeSubscription(const QString &clientId, const QByteArray &topicFilter) = 0;
+    // Adds an unacknowledged packet, or replaces an existing one with the same packet ID
+    virtual void storeUnackedPacket(const QString &clientId, const MqttPacket &packet) = 0;
+    virtual void removeUnackedPacket(const QString &clientId, quint16 packetId) = 0;
+    virtual void removeSession(const QString &clientId) = 0;
+};
+
+#endif // MQTTPERSISTENCE_H
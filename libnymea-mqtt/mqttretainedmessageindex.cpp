@@ -0,0 +1,160 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* nymea-mqtt
+* MQTT library for nymea
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public License
+* as published by the Free Software Foundation, either version 3
+* of the License, or (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "mqttretainedmessageindex.h"
+
+class MqttRetainedMessageIndex::Node
+{
+public:
+    ~Node() {
+        qDeleteAll(children);
+    }
+
+    QHash<QByteArray, Node*> children;
+    MqttPackets packets;
+};
+
+// The end of the level starting at from, which is the position of the next '/' or the length of the topic
+static int levelEnd(const QByteArray &topic, int from)
+{
+    const int end = topic.indexOf('/', from);
+    return end == -1 ? topic.size() : end;
+}
+
+// Doesn't copy the level, it's only valid as long as the topic is
+static QByteArray levelAt(const QByteArray &topic, int from)
+{
+    return QByteArray::fromRawData(topic.constData() + from, levelEnd(topic, from) - from);
+}
+
+MqttRetainedMessageIndex::MqttRetainedMessageIndex():
+    m_root(new Node())
+{
+
+}
+
+MqttRetainedMessageIndex::~MqttRetainedMessageIndex()
+{
+    delete m_root;
+}
+
+void MqttRetainedMessageIndex::append(const QByteArray &topic, const MqttPacket &packet)
+{
+    Node *node = m_root;
+    for (int from = 0; from <= topic.size(); from = levelEnd(topic, from) + 1) {
+        const QByteArray level = levelAt(topic, from);
+        QHash<QByteArray, Node*>::iterator it = node->children.find(level);
+        if (it == node->children.end()) {
+            // The lookup key doesn't own its data, the stored one has to
+            it = node->children.insert(QByteArray(level.constData(), level.size()), new Node());
+        }
+        node = it.value();
+    }
+    if (node->packets.isEmpty()) {
+        m_count++;
+    }
+    node->packets.append(packet);
+}
+
+void MqttRetainedMessageIndex::remove(const QByteArray &topic)
+{
+    remove(m_root, topic, 0);
+}
+
+MqttPackets MqttRetainedMessageIndex::match(const QByteArray &topicFilter) const
+{
+    MqttPackets packets;
+    // Topics starting with $ are skipped by wildcards on the first level, see collect()
+    collect(m_root, topicFilter, 0, packets);
+    return packets;
+}
+
+int MqttRetainedMessageIndex::count() const
+{
+    return m_count;
+}
+
+// Returns true if the node doesn't hold anything any more and can be deleted by the caller
+bool MqttRetainedMessageIndex::remove(Node *node, const QByteArray &topic, int from)
+{
+    if (from > topic.size()) {
+        if (!node->packets.isEmpty()) {
+            node->packets.clear();
+            m_count--;
+        }
+    } else {
+        QHash<QByteArray, Node*>::iterator it = node->children.find(levelAt(topic, from));
+        if (it != node->children.end() && remove(it.value(), topic, levelEnd(topic, from) + 1)) {
+            delete it.value();
+            node->children.erase(it);
+        }
+    }
+    return node->packets.isEmpty() && node->children.isEmpty();
+}
+
+void MqttRetainedMessageIndex::collect(const Node *node, const QByteArray &topicFilter, int from, MqttPackets &packets) const
+{
+    if (from > topicFilter.size()) {
+        packets.append(node->packets);
+        return;
+    }
+
+    const QByteArray level = levelAt(topicFilter, from);
+    const int next = from + level.size() + 1;
+    if (level == "#") {
+        // '#' matches the parent level too (i.e. "a/#" matches "a")
+        if (from == 0) {
+            for (QHash<QByteArray, Node*>::const_iterator it = node->children.constBegin(); it != node->children.constEnd(); ++it) {
+                if (!it.key().startsWith('$')) {
+                    collectAll(it.value(), packets);
+                }
+            }
+        } else {
+            collectAll(node, packets);
+        }
+    } else if (level == "+") {
+        for (QHash<QByteArray, Node*>::const_iterator it = node->children.constBegin(); it != node->children.constEnd(); ++it) {
+            if (from == 0 && it.key().startsWith('$')) {
+                continue;
+            }
+            collect(it.value(), topicFilter, next, packets);
+        }
+    } else {
+        Node *child = node->children.value(level);
+        if (child) {
+            collect(child, topicFilter, next, packets);
+        }
+    }
+}
+
+void MqttRetainedMessageIndex::collectAll(const Node *node, MqttPackets &packets) const
+{
+    packets.append(node->packets);
+    foreach (const Node *child, node->children) {
+        collectAll(child, packets);
+    }
+}
@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* nymea-mqtt
+* MQTT library for nymea
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public License
+* as published by the Free Software Foundation, either version 3
+* of the License, or (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef MQTTRETAINEDMESSAGEINDEX_H
+#define MQTTRETAINEDMESSAGEINDEX_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+
+#include "mqttpacket.h"
+
+// Holds the retained messages of a server in a tree with one node per topic level, so that
+// subscribing to a filter only visits the branches the filter can match instead of comparing
+// the filter against every retained topic.
+class MqttRetainedMessageIndex
+{
+public:
+    MqttRetainedMessageIndex();
+    ~MqttRetainedMessageIndex();
+
+    void append(const QByteArray &topic, const MqttPacket &packet);
+    void remove(const QByteArray &topic);
+
+    // Returns the retained messages of all topics matching the filter
+    MqttPackets match(const QByteArray &topicFilter) const;
+
+    // The number of topics holding retained messages
+    int count() const;
+
+private:
+    class Node;
+
+    // Topics and topic filters are walked level by level in place, from is the start of the current level
+    bool remove(Node *node, const QByteArray &topic, int from);
+    void collect(const Node *node, const QByteArray &topicFilter, int from, MqttPackets &packets) const;
+    void collectAll(const Node *node, MqttPackets &packets) const;
+
+    Node *m_root = nullptr;
+    int m_count = 0;
+
+    Q_DISABLE_COPY(MqttRetainedMessageIndex)
+};
+
+#endif // MQTTRETAINEDMESSAGEINDEX_H
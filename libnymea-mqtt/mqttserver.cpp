@@ -63,6 +63,7 @@
 #include "mqttserver_p.h"
 #include "transports/mqtttcpservertransport.h"
 #include "transports/mqttwebsocketservertransport.h"
+#include "transports/mqttthreadedserverclient.h"
 #include "mqttpacket.h"
 
 #include <QDebug>
@@ -70,255 +71,1354 @@
 #include <QUuid>
 #include <QtGlobal>
 #include <QRegularExpression>
+#include <QThread>
+#include <QPointer>
+#include <QFile>
+
+#include <limits>
+
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#endif
 
 
 Q_LOGGING_CATEGORY(dbgServer, "nymea.mqtt.server")
 
+// Data beyond this stays in the connection's outbound queue, where the queue limits apply to it
+static const qint64 socketWriteBufferSize = 64 * 1024;
+
+// The size of the process' data segment, which holds the heap, or -1 where it isn't known
+static qint64 heapUsage()
+{
+#ifdef Q_OS_LINUX
+    QFile statm("/proc/self/statm");
+    if (!statm.open(QIODevice::ReadOnly)) {
+        return -1;
+    }
+    const QList<QByteArray> fields = statm.readAll().split(' ');
+    if (fields.count() < 6) {
+        return -1;
+    }
+    return fields.at(5).toLongLong() * sysconf(_SC_PAGESIZE);
+#else
+    return -1;
+#endif
+}
+
 MqttServerPrivate::MqttServerPrivate(MqttServer *q):
     QObject(q),
     q_ptr(q)
 {
     qRegisterMetaType<Mqtt::QoS>();
+    qRegisterMetaType<MqttPackets>();
+    connect(&admissionControl, &MqttAdmissionControl::acceptingPausedChanged, this, &MqttServerPrivate::onAcceptingPausedChanged);
+
+    clock.start();
+    timerWheelTimer.setInterval(timerWheel.tickLength());
+    connect(&timerWheelTimer, &QTimer::timeout, this, &MqttServerPrivate::onTimerWheelTick);
+    connect(&sysTopicsTimer, &QTimer::timeout, this, &MqttServerPrivate::publishSysTopics);
+}
+
+MqttServerPrivate::~MqttServerPrivate()
+{
+    qDeleteAll(pendingAuthorizations);
+
+    if (workerThreads.isEmpty()) {
+        return;
+    }
+
+    // Connections in worker threads are deleted by their proxies, which are owned by the transports.
+    // Delete the transports while the threads are still running to process those deletions.
+    qDeleteAll(servers);
+    servers.clear();
+    foreach (QThread *thread, workerThreads) {
+        thread->quit();
+        thread->wait();
+    }
+}
+
+int MqttServerPrivate::listen(MqttServerTransport *transport, const QHostAddress &address, quint16 port)
+{
+    connect(transport, &MqttServerTransport::clientConnected, this, &MqttServerPrivate::onClientConnected);
+    transport->setAdmissionControl(&admissionControl);
+
+    if (!transport->listen(address, port)) {
+        qCWarning(dbgServer) << "Error listening on port" << port;
+        transport->deleteLater();
+        return -1;
+    }
+    if (admissionControl.isAcceptingPaused()) {
+        transport->pauseAccepting();
+    }
+    static int addressId = -1;
+    servers.insert(++addressId, transport);
+    qCDebug(dbgServer) << "nymea MQTT server running on" << address.toString() << ":" << port << "( Address ID" << addressId << ")";
+    return addressId;
+}
+
+QHash<QString, quint16> MqttServerPrivate::publish(const QByteArray &topic, const QByteArray &payload)
+{
+    QHash<ClientContext*, Mqtt::QoS> receivers = subscriptionIndex.match(topic);
+
+    // Relayed packets only differ in QoS and packet ID between receivers. Encode the packet once per QoS
+    // and only patch the packet ID for each receiver. QoS 0 packets don't carry a packet ID on the wire,
+    // so all QoS 0 receivers are written the very same buffer.
+    QByteArray encodedPackets[3];
+    bool encoded[3] = { false, false, false };
+    QList<QPair<QString, quint16> > qos0Deliveries;
+
+    QHash<QString, quint16> packets;
+    for (QHash<ClientContext*, Mqtt::QoS>::const_iterator it = receivers.constBegin(); it != receivers.constEnd(); ++it) {
+        ClientContext *ctx = it.key();
+        Mqtt::QoS qos = it.value();
+        if (!ctx->client) {
+            // Offline session. QoS 1 and 2 packets are sent along with the other unacked packets when the client comes back.
+            if (qos == Mqtt::QoS0) {
+                continue;
+            }
+            qCDebug(dbgServer) << "Queueing packet for offline client:" << ctx->clientId;
+        } else {
+            qCDebug(dbgServer) << "Relaying packet to subscribed client:" << ctx->clientId;
+        }
+        quint16 packetId = 0;
+        if (qos >= Mqtt::QoS1) {
+            packetId = newPacketId(ctx);
+            if (packetId == 0) {
+                qCWarning(dbgServer) << "All packet IDs of client" << ctx->clientId << "are in use. Dropping publish on topic" << topic;
+                continue;
+            }
+        }
+        MqttPacket packet(MqttPacket::TypePublish, packetId, qos);
+        packet.setTopic(topic);
+        packet.setPayload(payload);
+
+        // QoS 1 and 2 publishes exceeding the client's in-flight window wait in the session
+        const bool sendNow = qos == Mqtt::QoS0 || addUnackedPacket(ctx, packet);
+        if (ctx->client && sendNow) {
+            QByteArray &encodedPacket = encodedPackets[qos];
+            if (!encoded[qos]) {
+                // A packet exceeding the protocol limit can't be encoded for any receiver, don't try again for each of them
+                encoded[qos] = true;
+                encodedPacket = packet.serialize();
+                if (!encodedPacket.isNull()) {
+                    writePublish(ctx->client, encodedPacket, qos);
+                }
+            } else if (!encodedPacket.isNull()) {
+                if (qos == Mqtt::QoS0) {
+                    writePublish(ctx->client, encodedPacket, qos);
+                } else {
+                    // The packet ID is the last field before the payload
+                    QByteArray data = encodedPacket;
+                    const int packetIdOffset = data.length() - payload.length() - 2;
+                    data[packetIdOffset] = static_cast<char>(packet.packetId() >> 8);
+                    data[packetIdOffset + 1] = static_cast<char>(packet.packetId() & 0xFF);
+                    writePublish(ctx->client, data, qos);
+                }
+            }
+        }
+
+        packets.insert(ctx->clientId, packet.packetId());
+        if (packet.qos() == Mqtt::QoS0) {
+            qos0Deliveries.append(qMakePair(ctx->clientId, packet.packetId()));
+        }
+    }
+
+    if (!qos0Deliveries.isEmpty()) {
+        QTimer::singleShot(0, this, [this, qos0Deliveries, topic, payload](){
+            const QString topicString = QString::fromUtf8(topic);
+            for (int i = 0; i < qos0Deliveries.count(); i++) {
+                emit q_ptr->published(qos0Deliveries.at(i).first, qos0Deliveries.at(i).second, topicString, payload);
+            }
+        });
+    }
+    return packets;
+}
+
+void MqttServerPrivate::publishSysTopics()
+{
+    const qint64 now = clock.elapsed();
+    quint64 receivedMessages = 0;
+    quint64 sentMessages = 0;
+    for (int qos = Mqtt::QoS0; qos <= Mqtt::QoS2; qos++) {
+        receivedMessages += statistics.receivedMessages[qos];
+        sentMessages += statistics.sentMessages[qos];
+    }
+    const quint64 receivedBytes = statistics.receivedBytes;
+    const quint64 sentBytes = statistics.sentBytes;
+    receivedMessagesLoad.update(receivedMessages, now);
+    sentMessagesLoad.update(sentMessages, now);
+    receivedBytesLoad.update(receivedBytes, now);
+    sentBytesLoad.update(sentBytes, now);
+
+    QList<QPair<QByteArray, QByteArray> > values;
+    values.append(qMakePair(QByteArray("$SYS/broker/uptime"), QByteArray(QByteArray::number(now / 1000) + " seconds")));
+    values.append(qMakePair(QByteArray("$SYS/broker/clients/connected"), QByteArray::number(clientList.count())));
+    values.append(qMakePair(QByteArray("$SYS/broker/publish/messages/received"), QByteArray::number(receivedMessages)));
+    values.append(qMakePair(QByteArray("$SYS/broker/publish/messages/sent"), QByteArray::number(sentMessages)));
+    values.append(qMakePair(QByteArray("$SYS/broker/bytes/received"), QByteArray::number(receivedBytes)));
+    values.append(qMakePair(QByteArray("$SYS/broker/bytes/sent"), QByteArray::number(sentBytes)));
+    values.append(qMakePair(QByteArray("$SYS/broker/retained messages/count"), QByteArray::number(retainedMessages.count())));
+    const qint64 heap = heapUsage();
+    if (heap >= 0) {
+        values.append(qMakePair(QByteArray("$SYS/broker/heap/current"), QByteArray::number(heap)));
+    }
+    const QPair<QByteArray, const MqttLoadAverage*> loads[] = {
+        qMakePair(QByteArray("publish/received"), &receivedMessagesLoad),
+        qMakePair(QByteArray("publish/sent"), &sentMessagesLoad),
+        qMakePair(QByteArray("bytes/received"), &receivedBytesLoad),
+        qMakePair(QByteArray("bytes/sent"), &sentBytesLoad)
+    };
+    for (const QPair<QByteArray, const MqttLoadAverage*> &load : loads) {
+        values.append(qMakePair(QByteArray("$SYS/broker/load/" + load.first + "/1min"), QByteArray::number(load.second->oneMinute(), 'f', 2)));
+        values.append(qMakePair(QByteArray("$SYS/broker/load/" + load.first + "/5min"), QByteArray::number(load.second->fiveMinutes(), 'f', 2)));
+        values.append(qMakePair(QByteArray("$SYS/broker/load/" + load.first + "/15min"), QByteArray::number(load.second->fifteenMinutes(), 'f', 2)));
+    }
+
+    for (int i = 0; i < values.count(); i++) {
+        const QByteArray &topic = values.at(i).first;
+        const QByteArray &payload = values.at(i).second;
+        // Retained, so that subscribers get the current values right away, but never persisted
+        MqttPacket packet(MqttPacket::TypePublish, 0, Mqtt::QoS0, true);
+        packet.setTopic(topic);
+        packet.setPayload(payload);
+        if (!sysTopics.contains(topic)) {
+            sysTopics.append(topic);
+        }
+        retainedMessages.remove(topic);
+        retainedMessages.append(topic, packet);
+        publish(topic, payload);
+    }
+}
+
+void MqttServerPrivate::clearSysTopics()
+{
+    foreach (const QByteArray &topic, sysTopics) {
+        retainedMessages.remove(topic);
+    }
+    sysTopics.clear();
+    receivedMessagesLoad.reset();
+    sentMessagesLoad.reset();
+    receivedBytesLoad.reset();
+    sentBytesLoad.reset();
+}
+
+void MqttServerPrivate::write(MqttServerClient *client, const QByteArray &data)
+{
+    MqttOutputQueue &queue = client->outputQueue();
+    if (queue.isEmpty() && client->bytesToWrite() < socketWriteBufferSize) {
+        statistics.sentBytes.fetchAndAddRelaxed(static_cast<quint64>(data.size()));
+        client->write(data);
+        return;
+    }
+    queue.enqueue(data, false);
+}
+
+void MqttServerPrivate::writePublish(MqttServerClient *client, const QByteArray &data, Mqtt::QoS qos)
+{
+    MqttOutputQueue &queue = client->outputQueue();
+    if (queue.isDiscarding()) {
+        return;
+    }
+    if (queue.isEmpty() && client->bytesToWrite() < socketWriteBufferSize) {
+        statistics.sentMessages[qos].fetchAndAddRelaxed(1);
+        statistics.sentBytes.fetchAndAddRelaxed(static_cast<quint64>(data.size()));
+        client->write(data);
+        return;
+    }
+
+    if (outputQueueFull(queue, data.size())) {
+        switch (outboundQueueOverflowPolicy) {
+        case MqttServer::OutboundQueueOverflowDropOldestQoS0:
+            while (outputQueueFull(queue, data.size()) && queue.dropOldest()) {
+                // Counted as sent when it was enqueued
+                statistics.sentMessages[Mqtt::QoS0].fetchAndSubRelaxed(1);
+                droppedMessages++;
+            }
+            if (!outputQueueFull(queue, data.size())) {
+                break;
+            }
+            if (qos == Mqtt::QoS0) {
+                droppedMessages++;
+                return;
+            }
+            // Only packets which must not be dropped are left
+            qCWarning(dbgServer) << "Outbound queue for" << client->peerAddress() << "is full of QoS 1 and 2 packets.";
+            Q_FALLTHROUGH();
+        case MqttServer::OutboundQueueOverflowDisconnect:
+            dropSlowClient(client);
+            return;
+        case MqttServer::OutboundQueueOverflowPausePublishers:
+            if (!congestedClients.contains(client)) {
+                qCDebug(dbgServer) << "Outbound queue for" << client->peerAddress() << "is full. Pausing reading from other clients.";
+                congestedClients.insert(client, clock.elapsed());
+                updateReadingPaused();
+                QTimer::singleShot(maximumPublishersPause, client, [this, client](){ checkCongestion(client); });
+            } else if (outputQueueFull(queue, data.size(), 2)) {
+                // Publishes from the server or the congested client itself still arrive, don't let the queue grow without bound
+                dropSlowClient(client);
+                return;
+            }
+            break;
+        }
+    }
+    statistics.sentMessages[qos].fetchAndAddRelaxed(1);
+    queue.enqueue(data, qos == Mqtt::QoS0);
+}
+
+void MqttServerPrivate::flushOutputQueue(MqttServerClient *client)
+{
+    MqttOutputQueue &queue = client->outputQueue();
+    while (!queue.isEmpty() && client->bytesToWrite() < socketWriteBufferSize) {
+        const QByteArray data = queue.dequeue();
+        statistics.sentBytes.fetchAndAddRelaxed(static_cast<quint64>(data.size()));
+        client->write(data);
+    }
+
+    // Resume when the queue drained to half the limits, so that reading isn't paused again right away
+    if (congestedClients.contains(client)
+            && (maximumOutboundQueueMessages == 0 || queue.count() <= maximumOutboundQueueMessages / 2)
+            && (maximumOutboundQueueBytes == 0 || queue.bytes() <= maximumOutboundQueueBytes / 2)) {
+        qCDebug(dbgServer) << "Outbound queue for" << client->peerAddress() << "drained. Resuming reading from other clients.";
+        congestedClients.remove(client);
+        updateReadingPaused();
+    }
+}
+
+bool MqttServerPrivate::outputQueueFull(const MqttOutputQueue &queue, qint64 additionalBytes, int factor) const
+{
+    if (maximumOutboundQueueMessages > 0 && queue.count() >= maximumOutboundQueueMessages * factor) {
+        return true;
+    }
+    return maximumOutboundQueueBytes > 0 && queue.bytes() + additionalBytes > maximumOutboundQueueBytes * factor;
+}
+
+void MqttServerPrivate::dropSlowClient(MqttServerClient *client)
+{
+    qCWarning(dbgServer) << "Client" << client->peerAddress() << "does not keep up with the outbound traffic. Dropping connection.";
+    // Unacked packets stay in the session. Abort later, the caller might still be working with the client's context.
+    client->outputQueue().discard();
+    QTimer::singleShot(0, client, [client](){ client->abort(); });
+    if (congestedClients.remove(client)) {
+        updateReadingPaused();
+    }
+}
+
+void MqttServerPrivate::checkCongestion(MqttServerClient *client)
+{
+    QHash<MqttServerClient*, qint64>::const_iterator it = congestedClients.constFind(client);
+    if (it == congestedClients.constEnd()) {
+        return;
+    }
+    // The client may have drained its queue and become congested again meanwhile, and timers may fire a bit early
+    const qint64 remaining = it.value() + maximumPublishersPause - clock.elapsed();
+    if (remaining > 0) {
+        QTimer::singleShot(static_cast<int>(remaining), client, [this, client](){ checkCongestion(client); });
+        return;
+    }
+    qCWarning(dbgServer) << "Outbound queue for" << client->peerAddress() << "did not drain within" << maximumPublishersPause << "ms.";
+    dropSlowClient(client);
+}
+
+void MqttServerPrivate::updateReadingPaused()
+{
+    foreach (MqttServerClient *client, clientServerMap.keys()) {
+        client->setReadingPaused(isReadingPaused(client));
+    }
+}
+
+bool MqttServerPrivate::isReadingPaused(MqttServerClient *client) const
+{
+    if (pendingAuthorizations.contains(client)) {
+        return true;
+    }
+    // Congested clients are still read from, they need to send their acks. So are clients which only subscribe,
+    // they don't add to the congestion.
+    return !congestedClients.isEmpty() && !congestedClients.contains(client) && publishingClients.contains(client);
+}
+
+MqttServer::MqttServer(QObject *parent):
+    QObject(parent),
+    d_ptr(new MqttServerPrivate(this))
+{
+
+}
+
+Mqtt::QoS MqttServer::maximumSubscriptionsQoS() const
+{
+    return d_ptr->maximumSubscriptionQoS;
+}
+
+void MqttServer::setMaximumSubscriptionsQoS(Mqtt::QoS maximumSubscriptionQoS)
+{
+    d_ptr->maximumSubscriptionQoS = maximumSubscriptionQoS;
+}
+
+int MqttServer::maximumInFlightMessages() const
+{
+    return d_ptr->maximumInFlightMessages;
+}
+
+void MqttServer::setMaximumInFlightMessages(int maximumInFlightMessages)
+{
+    d_ptr->maximumInFlightMessages = qMax(0, maximumInFlightMessages);
+    foreach (ClientContext *ctx, d_ptr->clientList) {
+        ctx->unackedPackets.setMaximum(d_ptr->maximumInFlightMessages);
+        d_ptr->sendWaitingPackets(ctx);
+    }
+    foreach (ClientContext *ctx, d_ptr->offlineSessions) {
+        ctx->unackedPackets.setMaximum(d_ptr->maximumInFlightMessages);
+    }
+}
+
+int MqttServer::retransmissionInterval() const
+{
+    return static_cast<int>(d_ptr->retransmissionInterval);
+}
+
+void MqttServer::setRetransmissionInterval(int retransmissionInterval)
+{
+    d_ptr->retransmissionInterval = qMax(0, retransmissionInterval);
+    foreach (ClientContext *ctx, d_ptr->clientList) {
+        d_ptr->retransmissionWheel.cancel(ctx->client);
+        d_ptr->scheduleRetransmission(ctx);
+    }
+}
+
+int MqttServer::maximumRetransmissionInterval() const
+{
+    return static_cast<int>(d_ptr->maximumRetransmissionInterval);
+}
+
+void MqttServer::setMaximumRetransmissionInterval(int maximumRetransmissionInterval)
+{
+    d_ptr->maximumRetransmissionInterval = qMax(0, maximumRetransmissionInterval);
+}
+
+quint64 MqttServer::retransmittedMessagesCount() const
+{
+    return d_ptr->retransmittedMessages;
+}
+
+int MqttServer::sysTopicsInterval() const
+{
+    return d_ptr->sysTopicsInterval;
+}
+
+void MqttServer::setSysTopicsInterval(int sysTopicsInterval)
+{
+    // The timer takes the interval in milliseconds as int
+    d_ptr->sysTopicsInterval = qBound(0, sysTopicsInterval, std::numeric_limits<int>::max() / 1000);
+    if (d_ptr->sysTopicsInterval == 0) {
+        d_ptr->sysTopicsTimer.stop();
+        d_ptr->clearSysTopics();
+        return;
+    }
+    d_ptr->sysTopicsTimer.start(d_ptr->sysTopicsInterval * 1000);
+    d_ptr->publishSysTopics();
+}
+
+quint32 MqttServer::maximumPacketSize() const
+{
+    return d_ptr->maximumPacketSize;
+}
+
+void MqttServer::setMaximumPacketSize(quint32 maximumPacketSize)
+{
+    d_ptr->maximumPacketSize = maximumPacketSize;
+    foreach (MqttServerClient *client, d_ptr->clientServerMap.keys()) {
+        MqttThreadedServerClient *threadedClient = qobject_cast<MqttThreadedServerClient*>(client);
+        if (threadedClient) {
+            threadedClient->setMaximumPacketSize(maximumPacketSize);
+        }
+    }
+}
+
+int MqttServer::workerThreadCount() const
+{
+    return d_ptr->workerThreadCount;
+}
+
+void MqttServer::setWorkerThreadCount(int workerThreadCount)
+{
+    d_ptr->workerThreadCount = qMax(0, workerThreadCount);
+}
+
+int MqttServer::maximumOutboundQueueMessages() const
+{
+    return d_ptr->maximumOutboundQueueMessages;
+}
+
+void MqttServer::setMaximumOutboundQueueMessages(int maximumOutboundQueueMessages)
+{
+    d_ptr->maximumOutboundQueueMessages = qMax(0, maximumOutboundQueueMessages);
+}
+
+qint64 MqttServer::maximumOutboundQueueBytes() const
+{
+    return d_ptr->maximumOutboundQueueBytes;
+}
+
+void MqttServer::setMaximumOutboundQueueBytes(qint64 maximumOutboundQueueBytes)
+{
+    d_ptr->maximumOutboundQueueBytes = qMax(Q_INT64_C(0), maximumOutboundQueueBytes);
+}
+
+MqttServer::OutboundQueueOverflowPolicy MqttServer::outboundQueueOverflowPolicy() const
+{
+    return d_ptr->outboundQueueOverflowPolicy;
+}
+
+void MqttServer::setOutboundQueueOverflowPolicy(OutboundQueueOverflowPolicy policy)
+{
+    d_ptr->outboundQueueOverflowPolicy = policy;
+}
+
+int MqttServer::maximumPublishersPause() const
+{
+    return d_ptr->maximumPublishersPause;
+}
+
+void MqttServer::setMaximumPublishersPause(int maximumPublishersPause)
+{
+    d_ptr->maximumPublishersPause = qMax(1, maximumPublishersPause);
+}
+
+int MqttServer::outboundQueueMessages(const QString &clientId) const
+{
+    for (QHash<MqttServerClient*, ClientContext*>::const_iterator it = d_ptr->clientList.constBegin(); it != d_ptr->clientList.constEnd(); ++it) {
+        if (it.value()->clientId == clientId) {
+            return it.key()->outputQueue().count();
+        }
+    }
+    return 0;
+}
+
+qint64 MqttServer::outboundQueueBytes(const QString &clientId) const
+{
+    for (QHash<MqttServerClient*, ClientContext*>::const_iterator it = d_ptr->clientList.constBegin(); it != d_ptr->clientList.constEnd(); ++it) {
+        if (it.value()->clientId == clientId) {
+            return it.key()->outputQueue().bytes() + it.key()->bytesToWrite();
+        }
+    }
+    return 0;
+}
+
+quint64 MqttServer::droppedMessagesCount() const
+{
+    return d_ptr->droppedMessages;
+}
+
+qint64 MqttServer::totalOutboundQueueBytes() const
+{
+    qint64 bytes = 0;
+    foreach (MqttServerClient *client, d_ptr->clientList.keys()) {
+        bytes += client->outputQueue().bytes() + client->bytesToWrite();
+    }
+    return bytes;
+}
+
+quint64 MqttServer::receivedMessagesCount(Mqtt::QoS qos) const
+{
+    return d_ptr->statistics.receivedMessages[qBound(0, static_cast<int>(qos), 2)];
+}
+
+quint64 MqttServer::sentMessagesCount(Mqtt::QoS qos) const
+{
+    return d_ptr->statistics.sentMessages[qBound(0, static_cast<int>(qos), 2)];
+}
+
+quint64 MqttServer::receivedBytesCount() const
+{
+    return d_ptr->statistics.receivedBytes;
+}
+
+quint64 MqttServer::sentBytesCount() const
+{
+    return d_ptr->statistics.sentBytes;
+}
+
+quint64 MqttServer::parseErrorsCount() const
+{
+    return d_ptr->statistics.parseErrors;
+}
+
+int MqttServer::retainedMessagesCount() const
+{
+    return d_ptr->retainedMessages.count();
+}
+
+int MqttServer::inFlightMessagesCount() const
+{
+    int count = 0;
+    foreach (ClientContext *ctx, d_ptr->clientList) {
+        count += ctx->unackedPackets.inFlightCount();
+    }
+    return count;
+}
+
+QVector<qint64> MqttServer::authorizationLatencyBounds()
+{
+    QVector<qint64> bounds;
+    for (int i = 0; i < MqttServerStatistics::authorizationLatencyBucketCount; i++) {
+        bounds.append(MqttServerStatistics::authorizationLatencyBounds[i]);
+    }
+    return bounds;
+}
+
+QVector<quint64> MqttServer::authorizationLatencyCounts() const
+{
+    QVector<quint64> counts;
+    for (int i = 0; i <= MqttServerStatistics::authorizationLatencyBucketCount; i++) {
+        counts.append(d_ptr->statistics.authorizationLatencyCounts[i]);
+    }
+    return counts;
+}
+
+quint64 MqttServer::authorizationLatencySum() const
+{
+    return d_ptr->statistics.authorizationLatencySum;
+}
+
+int MqttServer::maximumConcurrentHandshakes() const
+{
+    return d_ptr->admissionControl.maximumConcurrentHandshakes();
+}
+
+void MqttServer::setMaximumConcurrentHandshakes(int maximumConcurrentHandshakes)
+{
+    d_ptr->admissionControl.setMaximumConcurrentHandshakes(maximumConcurrentHandshakes);
+}
+
+int MqttServer::maximumAcceptQueueLength() const
+{
+    return d_ptr->admissionControl.maximumQueueLength();
+}
+
+void MqttServer::setMaximumAcceptQueueLength(int maximumAcceptQueueLength)
+{
+    d_ptr->admissionControl.setMaximumQueueLength(maximumAcceptQueueLength);
+}
+
+int MqttServer::maximumConnectionRatePerAddress() const
+{
+    return d_ptr->admissionControl.maximumConnectionRatePerAddress();
+}
+
+void MqttServer::setMaximumConnectionRatePerAddress(int maximumConnectionRatePerAddress)
+{
+    d_ptr->admissionControl.setMaximumConnectionRatePerAddress(maximumConnectionRatePerAddress);
+}
+
+int MqttServer::acceptQueueLength() const
+{
+    return d_ptr->admissionControl.queueLength();
+}
+
+int MqttServer::handshakesInProgress() const
+{
+    return d_ptr->admissionControl.handshakesInProgress();
+}
+
+quint64 MqttServer::handshakeCount() const
+{
+    return d_ptr->admissionControl.handshakeCount();
+}
+
+qint64 MqttServer::handshakeLatencySum() const
+{
+    return d_ptr->admissionControl.handshakeLatencySum();
+}
+
+quint64 MqttServer::rejectedConnectionsCount() const
+{
+    return d_ptr->admissionControl.rejectedConnectionsCount();
+}
+
+void MqttServer::setAuthorizer(MqttAuthorizer *authorizer)
+{
+    d_ptr->setAuthorizers(authorizer, nullptr);
+}
+
+void MqttServer::setAsyncAuthorizer(MqttAsyncAuthorizer *authorizer)
+{
+    d_ptr->setAuthorizers(nullptr, authorizer);
+}
+
+void MqttServer::setPersistence(MqttPersistence *persistence)
+{
+    d_ptr->setPersistence(persistence);
+}
+
+int MqttServer::listen(const QHostAddress &address, quint16 port, const QSslConfiguration &sslConfiguration)
+{
+    qCDebug(dbgServer) << "Starting nymea MQTT server on TCP";
+    MqttServerTransport *transport = new MqttTcpServerTransport(sslConfiguration, this);
+    return d_ptr->listen(transport, address, port);
+}
+
+int MqttServer::listenWebSocket(const QHostAddress &address, quint16 port, const QSslConfiguration &sslConfiguration)
+{
+    qCDebug(dbgServer) << "Starting nymea MQTT server on WebSocket";
+    MqttServerTransport *transport = new MqttWebSocketServerTransport(sslConfiguration, this);
+    return d_ptr->listen(transport, address, port);
+}
+
+bool MqttServer::isListening(const QHostAddress &address, quint16 port) const
+{
+    foreach (MqttServerTransport *transport, d_ptr->servers) {
+        if (transport->serverAddress() == address && transport->serverPort() == port && transport->isListening()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+QList<int> MqttServer::listeningAddressIds() const
+{
+    return d_ptr->servers.keys();
+}
+
+void MqttServer::close(int interfaceId)
+{
+    if (!d_ptr->servers.contains(interfaceId)) {
+        qCWarning(dbgServer) << "No such server address ID" << interfaceId;
+        return;
+    }
+    MqttServerTransport *transport = d_ptr->servers.take(interfaceId);
+    while (!d_ptr->clientServerMap.keys(transport).isEmpty()) {
+        d_ptr->cleanupClient(d_ptr->clientServerMap.keys(transport).first());
+    }
+    transport->close();
+    transport->deleteLater();
+}
+
+QStringList MqttServer::clients() const
+{
+    QStringList clientIds;
+    foreach (ClientContext *ctx, d_ptr->clientList) {
+        clientIds << ctx->clientId;
+    }
+    return clientIds;
+}
+
+void MqttServer::disconnectClient(const QString &clientId)
+{
+    foreach (ClientContext *ctx, d_ptr->clientList) {
+        if (ctx->clientId == clientId) {
+            d_ptr->cleanupClient(d_ptr->clientList.key(ctx));
+            return;
+        }
+    }
+}
+
+QHash<QString, quint16> MqttServer::publish(const QString &topic, const QByteArray &payload)
+{
+    return d_ptr->publish(topic.toUtf8(), payload);
+}
+
+void MqttServerPrivate::onClientConnected(MqttServerClient *client)
+{
+    MqttServerTransport *transport = static_cast<MqttServerTransport*>(sender());
+
+    if (workerThreadCount > 0) {
+        client = new MqttThreadedServerClient(client, nextWorkerThread(), maximumPacketSize, transport);
+    }
+
+    client->setServerAddressId(servers.key(transport));
+    connect(client, &MqttServerClient::dataAvailable, this, &MqttServerPrivate::onDataAvailable);
+    connect(client, &MqttServerClient::packetsAvailable, this, &MqttServerPrivate::onPacketsAvailable);
+    connect(client, &MqttServerClient::parseError, this, &MqttServerPrivate::onParseError);
+    connect(client, &MqttServerClient::bytesWritten, this, &MqttServerPrivate::onBytesWritten);
+    connect(client, &MqttServerClient::disconnected, this, &MqttServerPrivate::onClientDisconnected);
+    // Clean up the connection if the MQTT handshake isn't done within 10 seconds, including waiting for the authorizer
+    clientServerMap.insert(client, transport);
+    pendingConnections.insert(client);
+    scheduleTimeout(client, clock.elapsed() + 10000);
+}
+
+void MqttServerPrivate::onDataAvailable(const QByteArray &data)
+{
+    MqttServerClient *client = qobject_cast<MqttServerClient*>(sender());
+    statistics.receivedBytes.fetchAndAddRelaxed(static_cast<quint64>(data.size()));
+    client->inputBuffer().append(data);
+    processInput(client);
+}
+
+void MqttServerPrivate::onPacketsAvailable(qint64 bytes)
+{
+    MqttServerClient *client = qobject_cast<MqttServerClient*>(sender());
+    statistics.receivedBytes.fetchAndAddRelaxed(static_cast<quint64>(bytes));
+    processInput(client);
+}
+
+void MqttServerPrivate::onParseError()
+{
+    MqttServerClient *client = qobject_cast<MqttServerClient*>(sender());
+    statistics.parseErrors.fetchAndAddRelaxed(1);
+    cleanupClient(client);
+}
+
+void MqttServerPrivate::processInput(MqttServerClient *client)
+{
+    if (pendingAuthorizations.contains(client)) {
+        // Held back until the decision for an earlier packet arrives
+        return;
+    }
+
+    // Connections on worker threads hand over parsed packets instead of data
+    MqttPackets &receivedPackets = client->receivedPackets();
+    while (!receivedPackets.isEmpty() && !pendingAuthorizations.contains(client)) {
+        const MqttPacket packet = receivedPackets.takeFirst();
+        if (packet.type() == MqttPacket::TypePublish) {
+            statistics.receivedMessages[packet.qos()].fetchAndAddRelaxed(1);
+        }
+        // Note: Processing the packet may drop the connection, which clears the received packets
+        processPacket(packet, client);
+    }
+
+    MqttInputBuffer &inputBuffer = client->inputBuffer();
+    while (!inputBuffer.isEmpty() && !pendingAuthorizations.contains(client)) {
+        const qint64 packetLength = MqttPacket::packetLength(inputBuffer.data(), inputBuffer.size());
+        if (packetLength > maximumPacketSize) {
+            qCWarning(dbgServer) << "Client announced a packet of" << packetLength << "bytes, exceeding the maximum packet size of" << maximumPacketSize << "bytes. Dropping connection from" << client->peerAddress();
+            statistics.parseErrors.fetchAndAddRelaxed(1);
+            cleanupClient(client);
+            return;
+        }
+
+        MqttPacket packet;
+        int ret = packet.parse(inputBuffer.data(), inputBuffer.size());
+        if (ret == 0) {
+            qCDebug(dbgServer) << "Packet too short... Waiting for more...";
+            return;
+        }
+
+        if (ret == -1) {
+            qCWarning(dbgServer) << "Bad MQTT packet data, Dropping connection" << packet.serialize().toHex();
+            statistics.parseErrors.fetchAndAddRelaxed(1);
+            cleanupClient(client);
+            return;
+        }
+
+        inputBuffer.consume(ret);
+        if (packet.type() == MqttPacket::TypePublish) {
+            statistics.receivedMessages[packet.qos()].fetchAndAddRelaxed(1);
+        }
+
+        // Note: Processing the packet may drop the connection, which clears the input buffer
+        processPacket(packet, client);
+    }
+}
+
+void MqttServerPrivate::onBytesWritten()
+{
+    MqttServerClient *client = qobject_cast<MqttServerClient*>(sender());
+    flushOutputQueue(client);
+}
+
+void MqttServerPrivate::onClientDisconnected()
+{
+    MqttServerClient *client = qobject_cast<MqttServerClient*>(sender());
+    cleanupClient(client);
+}
+
+void MqttServerPrivate::onAcceptingPausedChanged(bool paused)
+{
+    foreach (MqttServerTransport *transport, servers) {
+        if (paused) {
+            transport->pauseAccepting();
+        } else {
+            transport->resumeAccepting();
+        }
+    }
+}
+
+void MqttServerPrivate::onTimerWheelTick()
+{
+    const qint64 now = clock.elapsed();
+    foreach (MqttServerClient *client, timerWheel.advance(now)) {
+        if (!clientServerMap.contains(client)) {
+            // Cleaned up while handling an earlier timeout
+            continue;
+        }
+
+        if (pendingConnections.remove(client)) {
+            qCWarning(dbgServer) << "A client connected but did not complete the MQTT handshake within 10 seconds. Dropping connection from" << client->peerAddress();
+            client->abort();
+            continue;
+        }
+
+        ClientContext *ctx = clientList.value(client);
+        if (!ctx || ctx->keepAlive == 0) {
+            continue;
+        }
+        const qint64 timeout = ctx->keepAlive * 1500;
+        if (ctx->lastSeen + timeout > now) {
+            timerWheel.schedule(client, ctx->lastSeen + timeout);
+            continue;
+        }
+        if (isReadingPaused(client)) {
+            // Not reading from this client at the moment, it may well have sent a PINGREQ
+            timerWheel.schedule(client, now + timeout);
+            continue;
+        }
+        qCWarning(dbgServer) << "Keep alive timeout reached for client:" << ctx->clientId;
+        cleanupClient(client);
+    }
+
+    foreach (MqttServerClient *client, retransmissionWheel.advance(now)) {
+        retransmit(client, now);
+    }
+
+    if (timerWheel.isEmpty() && retransmissionWheel.isEmpty()) {
+        timerWheelTimer.stop();
+    }
+}
+
+void MqttServerPrivate::scheduleTimeout(MqttServerClient *client, qint64 deadline)
+{
+    startTimerWheelTimer();
+    timerWheel.schedule(client, deadline);
+}
+
+void MqttServerPrivate::scheduleRetransmission(ClientContext *ctx)
+{
+    if (retransmissionInterval == 0 || !ctx->client || retransmissionWheel.contains(ctx->client)) {
+        return;
+    }
+    const qint64 deadline = ctx->unackedPackets.nextRetransmission(retransmissionInterval, maximumRetransmissionInterval);
+    if (deadline < 0) {
+        return;
+    }
+    startTimerWheelTimer();
+    retransmissionWheel.schedule(ctx->client, deadline);
+}
+
+void MqttServerPrivate::retransmit(MqttServerClient *client, qint64 now)
+{
+    ClientContext *ctx = clientList.value(client);
+    if (!ctx || retransmissionInterval == 0) {
+        // Disconnected meanwhile or retransmission has been turned off
+        return;
+    }
+    if (!client->outputQueue().isEmpty()) {
+        // The packets may not even have left the server yet, sending them again only adds to the congestion
+        startTimerWheelTimer();
+        retransmissionWheel.schedule(client, now + retransmissionInterval);
+        return;
+    }
+
+    foreach (MqttPacket packet, ctx->unackedPackets.takeOverdue(now, retransmissionInterval, maximumRetransmissionInterval)) {
+        qCDebug(dbgServer) << "Retransmitting unacked packet" << packet.packetId() << "to" << ctx->clientId;
+        if (packet.type() == MqttPacket::TypePublish) {
+            packet.setDup(true);
+            writePublish(client, packet.serialize(), packet.qos());
+        } else {
+            write(client, packet.serialize());
+        }
+        retransmittedMessages++;
+    }
+    scheduleRetransmission(ctx);
+}
+
+void MqttServerPrivate::startTimerWheelTimer()
+{
+    if (!timerWheelTimer.isActive()) {
+        // The wheels haven't been moving while there was nothing to watch
+        const qint64 now = clock.elapsed();
+        timerWheel.advance(now);
+        retransmissionWheel.advance(now);
+        timerWheelTimer.start();
+    }
+}
+
+void MqttServerPrivate::publishWill(ClientContext *ctx)
+{
+    bool allowed = true;
+    if (asyncAuthorizer) {
+        // There's no waiting for a decision anymore, it has been made along with the CONNECT
+        allowed = ctx->willAuthorized;
+    } else if (authorizer) {
+        const qint64 started = clock.nsecsElapsed();
+        allowed = authorizer->authorizePublish(ctx->client->serverAddressId(), ctx->clientId, ctx->willTopic);
+        statistics.addAuthorizationLatency(clock.nsecsElapsed() - started);
+    }
+    if (!allowed) {
+        qCDebug(dbgServer) << "Client" << ctx->clientId << "not authorized to publish its will on topic" << ctx->willTopic << ". Discarding will.";
+        return;
+    }
+
+    qCDebug(dbgServer) << "Publishing will message for client" << ctx->clientId << "on topic" << ctx->willTopic << "( Retain:" << ctx->willRetain << ")";
+    // Published by the server on behalf of the client. The client's session, its packet IDs and acks included, isn't involved.
+    MqttPacket willPacket(MqttPacket::TypePublish, 0, ctx->willQoS, ctx->willRetain);
+    willPacket.setTopic(ctx->willTopic);
+    willPacket.setPayload(ctx->willMessage);
+    // Topics starting with $ are reserved for the server, like for publishes from clients
+    const bool systemTopic = ctx->willTopic.startsWith('$');
+    if (willPacket.retain() && !systemTopic) {
+        retainMessage(willPacket);
+    }
+    emit q_ptr->publishReceived(ctx->clientId, 0, ctx->willTopic, ctx->willMessage);
+    if (!systemTopic) {
+        publish(ctx->willTopic, ctx->willMessage);
+    }
 }
 
-int MqttServerPrivate::listen(MqttServerTransport *transport, const QHostAddress &address, quint16 port)
+void MqttServerPrivate::retainMessage(const MqttPacket &packet)
 {
-    connect(transport, &MqttServerTransport::clientConnected, this, &MqttServerPrivate::onClientConnected);
-
-    if (!transport->listen(address, port)) {
-        qCWarning(dbgServer) << "Error listening on port" << port;
-        transport->deleteLater();
-        return -1;
+    if (packet.payload().isEmpty() || packet.qos() == Mqtt::QoS0) {
+        qCDebug(dbgServer) << "Clearing retained messages for topic" << packet.topic();
+        retainedMessages.remove(packet.topic());
+        if (persistence) {
+            persistence->removeRetainedMessages(packet.topic());
+        }
+    }
+    if (!packet.payload().isEmpty()) {
+        qCDebug(dbgServer) << "Adding retained message for topic" << packet.topic();
+        retainedMessages.append(packet.topic(), packet);
+        if (persistence) {
+            persistence->storeRetainedMessage(packet);
+        }
     }
-    static int addressId = -1;
-    servers.insert(++addressId, transport);
-    qCDebug(dbgServer) << "nymea MQTT server running on" << address.toString() << ":" << port << "( Address ID" << addressId << ")";
-    return addressId;
 }
 
-QHash<QString, quint16> MqttServerPrivate::publish(const QString &topic, const QByteArray &payload)
+void MqttServerPrivate::cleanupClient(MqttServerClient *client)
 {
-    QHash<MqttServerClient*, Mqtt::QoS> receivers;
-    foreach (MqttServerClient *c, clientList.keys()) {
-        foreach (const MqttSubscription &subscription, clientList.value(c)->subscriptions) {
-            if (matchTopic(subscription.topicFilter(), topic)) {
-                if (!receivers.contains(c) || receivers.value(c) < subscription.qoS()) {
-                    receivers[c] = subscription.qoS();
-                }
+    client->inputBuffer().clear();
+    client->receivedPackets().clear();
+    admissionControl.finish(client->admissionTicket(), false);
+    client->setAdmissionTicket(0);
+    if (clientServerMap.contains(client)) {
+        clientServerMap.remove(client);
+    }
+    pendingConnections.remove(client);
+    timerWheel.cancel(client);
+    retransmissionWheel.cancel(client);
+    delete pendingAuthorizations.take(client);
+    if (clientList.contains(client)) {
+        ClientContext *ctx = clientList.value(client);
+        qCDebug(dbgServer) << "Client" << ctx->clientId << "disconnected.";
+
+        if (!ctx->willTopic.isEmpty()) {
+            publishWill(ctx);
+        }
+
+        if (persistence && !ctx->cleanSession) {
+            // Keep the session, including its subscriptions, until the client comes back
+            qCDebug(dbgServer) << "Keeping session for client" << ctx->clientId;
+            ctx->willTopic.clear();
+            ctx->willMessage.clear();
+
+            emit q_ptr->clientDisconnected(ctx->clientId);
+
+            clientList.remove(client);
+            ctx->client = nullptr;
+            offlineSessions.insert(ctx->clientId, ctx);
+        } else {
+            while (!ctx->subscriptions.isEmpty()) {
+                MqttSubscription subscription = ctx->subscriptions.takeFirst();
+                subscriptionIndex.remove(subscription.topicFilter(), ctx);
+                emit q_ptr->clientUnsubscribed(ctx->clientId, subscription.topicFilter());
             }
+
+            emit q_ptr->clientDisconnected(ctx->clientId);
+
+            clientList.remove(client);
+            delete ctx;
         }
     }
 
-    QHash<QString, quint16> packets;
-    foreach (MqttServerClient *receiver, receivers.keys()) {
-        ClientContext *ctx = clientList.value(receiver);
-        qCDebug(dbgServer) << "Relaying packet to subscribed client:" << ctx->clientId;
-        Mqtt::QoS qos = receivers.value(receiver);
-        MqttPacket packet(MqttPacket::TypePublish, qos >= Mqtt::QoS0 ? newPacketId(ctx) : 0, qos);
-        packet.setTopic(topic.toUtf8());
-        packet.setPayload(payload);
-        receiver->write(packet.serialize());
-        packets.insert(ctx->clientId, packet.packetId());
-        if (packet.qos() == Mqtt::QoS0) {
-            QString clientId = ctx->clientId;
-            QTimer::singleShot(0, this, [this, clientId, packet](){
-                emit q_ptr->published(clientId, packet.packetId(), packet.topic(), packet.payload());
-            });
-        } else {
-            ClientContext *ctx = clientList.value(receiver);
-            ctx->unackedPackets.insert(packet.packetId(), packet);
-            ctx->unackedPacketList.append(packet.packetId());
+    publishingClients.remove(client);
+    if (congestedClients.remove(client)) {
+        updateReadingPaused();
+    }
+
+    if (client->isOpen()) {
+        // Hand everything still queued to the connection, closing waits for it to be sent
+        MqttOutputQueue &queue = client->outputQueue();
+        while (!queue.isEmpty()) {
+            const QByteArray data = queue.dequeue();
+            statistics.sentBytes.fetchAndAddRelaxed(static_cast<quint64>(data.size()));
+            client->write(data);
         }
+        client->flush();
+        client->close();
     }
-    return packets;
+    client->outputQueue().discard();
+    client->deleteLater();
 }
 
-MqttServer::MqttServer(QObject *parent):
-    QObject(parent),
-    d_ptr(new MqttServerPrivate(this))
+void MqttServerPrivate::setPersistence(MqttPersistence *persistence)
 {
+    if (!persistence) {
+        // Without persistence, sessions end with their connection. Keep the stored ones though.
+        this->persistence = nullptr;
+        foreach (ClientContext *ctx, offlineSessions) {
+            deleteOfflineSession(ctx);
+        }
+        offlineSessions.clear();
+        return;
+    }
 
-}
+    MqttPackets restoredRetainedMessages;
+    QList<MqttPersistentSession> restoredSessions;
+    if (!persistence->restore(&restoredRetainedMessages, &restoredSessions)) {
+        qCWarning(dbgServer) << "Failed to restore the persisted server state.";
+    }
 
-Mqtt::QoS MqttServer::maximumSubscriptionsQoS() const
-{
-    return d_ptr->maximumSubscriptionQoS;
-}
+    foreach (const MqttPacket &packet, restoredRetainedMessages) {
+        retainedMessages.append(packet.topic(), packet);
+    }
+    foreach (const MqttPersistentSession &session, restoredSessions) {
+        if (offlineSessions.contains(session.clientId)) {
+            continue;
+        }
+        ClientContext *ctx = createContext(session.clientId);
+        ctx->cleanSession = false;
+        foreach (const MqttSubscription &subscription, session.subscriptions) {
+            ctx->subscriptions.append(subscription);
+            subscriptionIndex.insert(subscription.topicFilter(), ctx, subscription.qoS());
+        }
+        foreach (const MqttPacket &packet, session.unackedPackets) {
+            if (packet.type() == MqttPacket::TypePubrec) {
+                // Stored by earlier versions along with the outbound packets
+                ctx->receivedQoS2PacketIds.insert(packet.packetId());
+                continue;
+            }
+            ctx->unackedPackets.append(packet);
+            ctx->packetIds.reserve(packet.packetId());
+        }
+        offlineSessions.insert(ctx->clientId, ctx);
+    }
+    qCDebug(dbgServer) << "Restored" << restoredRetainedMessages.count() << "retained messages and" << restoredSessions.count() << "sessions.";
 
-void MqttServer::setMaximumSubscriptionsQoS(Mqtt::QoS maximumSubscriptionQoS)
-{
-    d_ptr->maximumSubscriptionQoS = maximumSubscriptionQoS;
+    this->persistence = persistence;
 }
 
-void MqttServer::setAuthorizer(MqttAuthorizer *authorizer)
+ClientContext *MqttServerPrivate::createContext(const QString &clientId)
 {
-    d_ptr->authorizer = authorizer;
+    ClientContext *ctx = new ClientContext();
+    ctx->clientId = clientId;
+    ctx->unackedPackets.setMaximum(maximumInFlightMessages);
+    return ctx;
 }
 
-int MqttServer::listen(const QHostAddress &address, quint16 port, const QSslConfiguration &sslConfiguration)
+void MqttServerPrivate::deleteOfflineSession(ClientContext *ctx)
 {
-    qCDebug(dbgServer) << "Starting nymea MQTT server on TCP";
-    MqttServerTransport *transport = new MqttTcpServerTransport(sslConfiguration, this);
-    return d_ptr->listen(transport, address, port);
+    while (!ctx->subscriptions.isEmpty()) {
+        MqttSubscription subscription = ctx->subscriptions.takeFirst();
+        subscriptionIndex.remove(subscription.topicFilter(), ctx);
+        emit q_ptr->clientUnsubscribed(ctx->clientId, subscription.topicFilter());
+    }
+    if (persistence) {
+        persistence->removeSession(ctx->clientId);
+    }
+    delete ctx;
 }
 
-int MqttServer::listenWebSocket(const QHostAddress &address, quint16 port, const QSslConfiguration &sslConfiguration)
+bool MqttServerPrivate::addUnackedPacket(ClientContext *ctx, const MqttPacket &packet)
 {
-    qCDebug(dbgServer) << "Starting nymea MQTT server on WebSocket";
-    MqttServerTransport *transport = new MqttWebSocketServerTransport(sslConfiguration, this);
-    return d_ptr->listen(transport, address, port);
+    ctx->packetIds.reserve(packet.packetId());
+    // A packet replacing one with the same ID, like a PUBREL, continues its flow and is sent right away
+    const bool sendNow = ctx->unackedPackets.append(packet, clock.elapsed());
+    if (persistence && !ctx->cleanSession) {
+        persistence->storeUnackedPacket(ctx->clientId, packet);
+    }
+    if (sendNow) {
+        scheduleRetransmission(ctx);
+    }
+    return sendNow;
 }
 
-bool MqttServer::isListening(const QHostAddress &address, quint16 port) const
+void MqttServerPrivate::removeUnackedPacket(ClientContext *ctx, quint16 packetId)
 {
-    foreach (MqttServerTransport *transport, d_ptr->servers) {
-        if (transport->serverAddress() == address && transport->serverPort() == port && transport->isListening()) {
-            return true;
+    ctx->packetIds.release(packetId);
+    if (ctx->unackedPackets.remove(packetId)) {
+        if (persistence && !ctx->cleanSession) {
+            persistence->removeUnackedPacket(ctx->clientId, packetId);
         }
+        sendWaitingPackets(ctx);
     }
-    return false;
-}
-
-QList<int> MqttServer::listeningAddressIds() const
-{
-    return d_ptr->servers.keys();
 }
 
-void MqttServer::close(int interfaceId)
+void MqttServerPrivate::sendWaitingPackets(ClientContext *ctx)
 {
-    if (!d_ptr->servers.contains(interfaceId)) {
-        qCWarning(dbgServer) << "No such server address ID" << interfaceId;
+    if (!ctx->client) {
         return;
     }
-    MqttServerTransport *transport = d_ptr->servers.take(interfaceId);
-    while (!d_ptr->clientServerMap.keys(transport).isEmpty()) {
-        d_ptr->cleanupClient(d_ptr->clientServerMap.keys(transport).first());
+    foreach (const MqttPacket &packet, ctx->unackedPackets.takeSendable(clock.elapsed())) {
+        if (packet.type() == MqttPacket::TypePublish) {
+            writePublish(ctx->client, packet.serialize(), packet.qos());
+        } else {
+            write(ctx->client, packet.serialize());
+        }
     }
-    transport->close();
-    transport->deleteLater();
+    scheduleRetransmission(ctx);
 }
 
-QStringList MqttServer::clients() const
+void MqttServerPrivate::setAuthorizers(MqttAuthorizer *authorizer, MqttAsyncAuthorizer *asyncAuthorizer)
 {
-    QStringList clientIds;
-    foreach (ClientContext *ctx, d_ptr->clientList) {
-        clientIds << ctx->clientId;
+    this->authorizer = authorizer;
+    this->asyncAuthorizer = asyncAuthorizer;
+    foreach (ClientContext *ctx, clientList) {
+        ctx->publishAuthorizations.clear();
     }
-    return clientIds;
-}
-
-void MqttServer::disconnectClient(const QString &clientId)
-{
-    foreach (ClientContext *ctx, d_ptr->clientList) {
-        if (ctx->clientId == clientId) {
-            d_ptr->cleanupClient(d_ptr->clientList.key(ctx));
-            return;
-        }
+    foreach (ClientContext *ctx, offlineSessions) {
+        ctx->publishAuthorizations.clear();
     }
 }
 
-QHash<QString, quint16> MqttServer::publish(const QString &topic, const QByteArray &payload)
+quint32 MqttServerPrivate::authorizationGeneration() const
 {
-    return d_ptr->publish(topic, payload);
+    if (authorizer) {
+        return authorizer->authorizationGeneration();
+    }
+    if (asyncAuthorizer) {
+        return asyncAuthorizer->authorizationGeneration();
+    }
+    return 0;
 }
 
-void MqttServerPrivate::onClientConnected(MqttServerClient *client)
+bool MqttServerPrivate::authorizePublish(ClientContext *ctx, const MqttPacket &packet, bool *allowed)
 {
-    connect(client, &MqttServerClient::dataAvailable, this, &MqttServerPrivate::onDataAvailable);
-    connect(client, &MqttServerClient::disconnected, this, &MqttServerPrivate::onClientDisconnected);
+    if (completedAuthorization) {
+        *allowed = completedAuthorization->decisions.at(0);
+        return true;
+    }
+    if (!authorizer && !asyncAuthorizer) {
+        *allowed = true;
+        return true;
+    }
 
-    MqttServerTransport *transport = static_cast<MqttServerTransport*>(sender());
+    if (ctx->publishAuthorizationGeneration != authorizationGeneration()) {
+        ctx->publishAuthorizations.clear();
+        ctx->publishAuthorizationGeneration = authorizationGeneration();
+    }
+    QHash<QByteArray, bool>::const_iterator it = ctx->publishAuthorizations.constFind(packet.topic());
+    if (it != ctx->publishAuthorizations.constEnd()) {
+        *allowed = it.value();
+        return true;
+    }
 
-    // Start a 10 second timer to clean up the connection if we don't get data until then.
-    QTimer *timeoutTimer = new QTimer(this);
-    connect(timeoutTimer, &QTimer::timeout, client, [this, client]() {
-        qCWarning(dbgServer) << "A client connected but did not send data in 10 seconds. Dropping connection from" << client->peerAddress();
-        pendingConnections.take(client)->deleteLater();
-        client->abort();
-    });
-    timeoutTimer->start(10000);
-    clientServerMap.insert(client, transport);
-    pendingConnections.insert(client, timeoutTimer);
+    if (asyncAuthorizer) {
+        requestAuthorization(ctx->client, packet, ctx->clientId);
+        return false;
+    }
+    const qint64 started = clock.nsecsElapsed();
+    *allowed = authorizer->authorizePublish(ctx->client->serverAddressId(), ctx->clientId, packet.topic());
+    statistics.addAuthorizationLatency(clock.nsecsElapsed() - started);
+    cachePublishAuthorization(ctx, packet.topic(), *allowed);
+    return true;
 }
 
-void MqttServerPrivate::onDataAvailable(const QByteArray &data)
+void MqttServerPrivate::cachePublishAuthorization(ClientContext *ctx, const QByteArray &topic, bool allowed)
 {
-    MqttServerClient *client = qobject_cast<MqttServerClient*>(sender());
-
-    clientBuffers[client].append(data);
+    // Devices publish to a handful of topics, start over if a client keeps coming up with new ones
+    if (ctx->publishAuthorizations.count() >= 1000) {
+        ctx->publishAuthorizations.clear();
+    }
+    ctx->publishAuthorizations.insert(topic, allowed);
+}
 
-    do {
-        MqttPacket packet;
-        int ret = packet.parse(clientBuffers[client]);
-        if (ret == 0) {
-            qCDebug(dbgServer) << "Packet too short... Waiting for more...";
+void MqttServerPrivate::requestAuthorization(MqttServerClient *client, const MqttPacket &packet, const QString &clientId)
+{
+    PendingAuthorization *pending = new PendingAuthorization();
+    pending->id = ++lastAuthorizationId;
+    pending->packet = packet;
+    pending->clientId = clientId;
+    pending->generation = authorizationGeneration();
+    pending->requestedAt = clock.nsecsElapsed();
+    pendingAuthorizations.insert(client, pending);
+    // Everything received meanwhile would pile up in the input buffer, let it wait in the network instead
+    client->setReadingPaused(true);
+
+    // Results are handled in this thread, whichever thread the authorizer reports them from
+    QPointer<MqttServerPrivate> server(this);
+    quint64 authorizationId = pending->id;
+    auto report = [server, client, authorizationId](int index, bool allowed, Mqtt::ConnectReturnCode returnCode) {
+        if (server.isNull()) {
             return;
         }
+        QMetaObject::invokeMethod(server.data(), [server, client, authorizationId, index, allowed, returnCode](){
+            server->onAuthorizationResult(client, authorizationId, index, allowed, returnCode);
+        }, Qt::QueuedConnection);
+    };
 
-        // Ok, we've got a full packet (or garbage data). If this client is still pending
-        // we can stop the timer, the protocol will take it from here.
-        if (pendingConnections.contains(client)) {
-            pendingConnections.take(client)->deleteLater();
+    // All decisions are counted before asking, the authorizer may report right away
+    int serverAddressId = client->serverAddressId();
+    if (packet.type() == MqttPacket::TypeConnect) {
+        bool hasWill = packet.connectFlags().testFlag(Mqtt::ConnectFlagWill);
+        pending->outstanding = hasWill ? 2 : 1;
+        pending->decisions.resize(hasWill ? 1 : 0);
+        QString username;
+        if (packet.connectFlags().testFlag(Mqtt::ConnectFlagUsername)) {
+            username = packet.username();
         }
-
-        if (ret == -1) {
-            qCWarning(dbgServer) << "Bad MQTT packet data, Dropping connection" << packet.serialize().toHex();
-            cleanupClient(client);
-            return;
+        QString password;
+        if (packet.connectFlags().testFlag(Mqtt::ConnectFlagPassword)) {
+            password = packet.password();
         }
-
-        clientBuffers[client].remove(0, ret);
-
-        processPacket(packet, client);
-
-    } while (!clientBuffers.value(client).isEmpty());
-}
-
-void MqttServerPrivate::onClientDisconnected()
-{
-    MqttServerClient *client = qobject_cast<MqttServerClient*>(sender());
-    cleanupClient(client);
+        asyncAuthorizer->authorizeConnect(serverAddressId, clientId, username, password, client->peerAddress(), [report](Mqtt::ConnectReturnCode returnCode){
+            report(-1, false, returnCode);
+        });
+        if (hasWill) {
+            asyncAuthorizer->authorizePublish(serverAddressId, clientId, packet.willTopic(), [report](bool allowed){
+                report(0, allowed, Mqtt::ConnectReturnCodeAccepted);
+            });
+        }
+    } else if (packet.type() == MqttPacket::TypeSubscribe) {
+        MqttSubscriptions subscriptions = packet.subscriptions();
+        pending->outstanding = subscriptions.count();
+        pending->decisions.resize(subscriptions.count());
+        for (int i = 0; i < subscriptions.count(); i++) {
+            asyncAuthorizer->authorizeSubscribe(serverAddressId, clientId, subscriptions.at(i).topicFilter(), [report, i](bool allowed){
+                report(i, allowed, Mqtt::ConnectReturnCodeAccepted);
+            });
+        }
+    } else {
+        pending->outstanding = 1;
+        pending->decisions.resize(1);
+        asyncAuthorizer->authorizePublish(serverAddressId, clientId, packet.topic(), [report](bool allowed){
+            report(0, allowed, Mqtt::ConnectReturnCodeAccepted);
+        });
+    }
 }
 
-void MqttServerPrivate::cleanupClient(MqttServerClient *client)
+void MqttServerPrivate::onAuthorizationResult(MqttServerClient *client, quint64 authorizationId, int index, bool allowed, Mqtt::ConnectReturnCode returnCode)
 {
-    if (clientBuffers.contains(client)) {
-        clientBuffers.remove(client);
+    PendingAuthorization *pending = pendingAuthorizations.value(client);
+    if (!pending || pending->id != authorizationId) {
+        // The connection has gone away in the meantime
+        return;
     }
-    if (clientServerMap.contains(client)) {
-        clientServerMap.remove(client);
+    if (index < 0) {
+        pending->connectReturnCode = returnCode;
+    } else {
+        pending->decisions[index] = allowed;
     }
-    if (pendingConnections.contains(client)) {
-        delete pendingConnections.take(client);
+    if (--pending->outstanding > 0) {
+        return;
     }
-    if (clientList.contains(client)) {
-        ClientContext *ctx = clientList.value(client);
-        qCDebug(dbgServer) << "Client" << ctx->clientId << "disconnected.";
-        ctx->keepAliveTimer.stop();
-
-        if (!ctx->willTopic.isEmpty()) {
-            qCDebug(dbgServer) << "Publishing will message for client" << ctx->clientId << "on topic" << ctx->willTopic << "( Retain:" << ctx->willRetain << ")";
-            MqttPacket willPacket(MqttPacket::TypePublish, ctx->willQoS >= Mqtt::QoS1 ? newPacketId(ctx) : 0, ctx->willQoS, ctx->willRetain);
-            willPacket.setTopic(ctx->willTopic);
-            willPacket.setPayload(ctx->willMessage);
-            processPacket(willPacket, client);
-        }
 
-        while (!ctx->subscriptions.isEmpty()) {
-            emit q_ptr->clientUnsubscribed(ctx->clientId, ctx->subscriptions.takeFirst().topicFilter());
-        }
-
-        emit q_ptr->clientDisconnected(ctx->clientId);
-
-        clientList.remove(client);
-        delete ctx;
+    pendingAuthorizations.remove(client);
+    statistics.addAuthorizationLatency(clock.nsecsElapsed() - pending->requestedAt);
+    ClientContext *ctx = clientList.value(client);
+    if (ctx && pending->packet.type() == MqttPacket::TypePublish && pending->generation == authorizationGeneration()
+            && ctx->publishAuthorizationGeneration == pending->generation) {
+        cachePublishAuthorization(ctx, pending->packet.topic(), pending->decisions.at(0));
     }
 
-    if (client->isOpen()) {
-        client->flush();
-        client->close();
+    PendingAuthorization *previousAuthorization = completedAuthorization;
+    completedAuthorization = pending;
+    processPacket(pending->packet, client);
+    completedAuthorization = previousAuthorization;
+    delete pending;
+
+    // Continue with what has been received in the meantime, unless processing dropped the connection
+    if (clientServerMap.contains(client)) {
+        processInput(client);
+        client->setReadingPaused(isReadingPaused(client));
     }
-    client->deleteLater();
 }
 
 void MqttServerPrivate::processPacket(const MqttPacket &packet, MqttServerClient *client)
@@ -336,7 +1436,7 @@ void MqttServerPrivate::processPacket(const MqttPacket &packet, MqttServerClient
         if (packet.protocolLevel() != Mqtt::Protocol310 && packet.protocolLevel() != Mqtt::Protocol311) {
             qCWarning(dbgServer) << "This MQTT broker only supports Protocol version 3.1.0 and 3.1.1 but client is" << packet.protocolLevel();
             response.setConnectReturnCode(Mqtt::ConnectReturnCodeUnacceptableProtocolVersion);
-            client->write(response.serialize());
+            write(client, response.serialize());
             cleanupClient(client);
             return;
         }
@@ -346,7 +1446,7 @@ void MqttServerPrivate::processPacket(const MqttPacket &packet, MqttServerClient
             if (!packet.cleanSession()) {
                 qCWarning(dbgServer) << "Empty client id provided but clean session flag not set. Rejecting connection.";
                 response.setConnectReturnCode(Mqtt::ConnectReturnCodeIdentifierRejected);
-                client->write(response.serialize());
+                write(client, response.serialize());
                 cleanupClient(client);
                 return;
             }
@@ -358,7 +1458,15 @@ void MqttServerPrivate::processPacket(const MqttPacket &packet, MqttServerClient
 
         }
 
-        if (authorizer) {
+        if (completedAuthorization) {
+            // Stick with the client ID the decision has been made for, it may have been generated
+            clientId = completedAuthorization->clientId;
+        } else if (asyncAuthorizer) {
+            requestAuthorization(client, packet, clientId);
+            return;
+        }
+
+        if (authorizer || completedAuthorization) {
             QString username;
             if (packet.connectFlags().testFlag(Mqtt::ConnectFlagUsername)) {
                 username = packet.username();
@@ -367,13 +1475,18 @@ void MqttServerPrivate::processPacket(const MqttPacket &packet, MqttServerClient
             if (packet.connectFlags().testFlag(Mqtt::ConnectFlagPassword)) {
                 password = packet.password();
             }
-            MqttServerTransport *transport = clientServerMap.value(client);
-            int serverAddressId = servers.key(transport);
-            Mqtt::ConnectReturnCode userValidationReturnCode = authorizer->authorizeConnect(serverAddressId, clientId, username, password, client->peerAddress());
+            Mqtt::ConnectReturnCode userValidationReturnCode;
+            if (completedAuthorization) {
+                userValidationReturnCode = completedAuthorization->connectReturnCode;
+            } else {
+                const qint64 started = clock.nsecsElapsed();
+                userValidationReturnCode = authorizer->authorizeConnect(client->serverAddressId(), clientId, username, password, client->peerAddress());
+                statistics.addAuthorizationLatency(clock.nsecsElapsed() - started);
+            }
             if (userValidationReturnCode != Mqtt::ConnectReturnCodeAccepted) {
                 qCWarning(dbgServer).nospace() << "Rejecting connection from " << client->peerAddress().toString() << " due to user validation. (clientId: " << clientId << ", username: " << username << ")";
                 response.setConnectReturnCode(userValidationReturnCode);
-                client->write(response.serialize());
+                write(client, response.serialize());
                 cleanupClient(client);
                 return;
             }
@@ -393,7 +1506,8 @@ void MqttServerPrivate::processPacket(const MqttPacket &packet, MqttServerClient
 
                     // remove old client manually, we don't want to clean up the context, nor send any will message or emit disconnected signals
                     clientList.remove(existingClient);
-                    clientBuffers.remove(existingClient);
+                    existingClient->inputBuffer().clear();
+                    existingClient->receivedPackets().clear();
                     existingClient->flush();
                     existingClient->abort();
                     existingClient->deleteLater();
@@ -405,19 +1519,39 @@ void MqttServerPrivate::processPacket(const MqttPacket &packet, MqttServerClient
             }
         }
 
+        if (!ctx && offlineSessions.contains(clientId)) {
+            if (!packet.connectFlags().testFlag(Mqtt::ConnectFlagCleanSession)) {
+                qCDebug(dbgServer).nospace() << clientId << ": Resuming offline session.";
+                response.setConnackFlags(Mqtt::ConnackFlagSessionPresent);
+                ctx = offlineSessions.take(clientId);
+            } else {
+                qCDebug(dbgServer).nospace() << clientId << ": Dropping offline session.";
+                deleteOfflineSession(offlineSessions.take(clientId));
+            }
+        }
+
         if (!ctx) {
             if (!packet.connectFlags().testFlag(Mqtt::ConnectFlagCleanSession)) {
                 qCWarning(dbgServer).nospace() << clientId << ": Request to take over existing session but we don't have an existing session.";
             }
 
-            ctx = new ClientContext();
-            ctx->clientId = clientId;
+            ctx = createContext(clientId);
+        }
 
-            connect(&ctx->keepAliveTimer, &QTimer::timeout, this, [this, client](){
-                qCWarning(dbgServer) << "Keep alive timeout reached for client:" << clientList.value(client)->clientId;
-                cleanupClient(client);
-            });
+        if (persistence) {
+            if (packet.connectFlags().testFlag(Mqtt::ConnectFlagCleanSession)) {
+                persistence->removeSession(clientId);
+            } else if (ctx->cleanSession) {
+                // Session is persistent from now on, store what it has already
+                foreach (const MqttSubscription &subscription, ctx->subscriptions) {
+                    persistence->storeSubscription(clientId, subscription);
+                }
+                foreach (const MqttPacket &unackedPacket, ctx->unackedPackets.packets()) {
+                    persistence->storeUnackedPacket(clientId, unackedPacket);
+                }
+            }
         }
+        ctx->cleanSession = packet.connectFlags().testFlag(Mqtt::ConnectFlagCleanSession);
 
         ctx->keepAlive = packet.keepAlive();
         ctx->version = packet.protocolLevel();
@@ -432,6 +1566,7 @@ void MqttServerPrivate::processPacket(const MqttPacket &packet, MqttServerClient
             } else if (packet.connectFlags().testFlag(Mqtt::ConnectFlagWillQoS1)) {
                 ctx->willQoS = Mqtt::QoS1;
             }
+            ctx->willAuthorized = !completedAuthorization || completedAuthorization->decisions.at(0);
         }
         if (packet.connectFlags().testFlag(Mqtt::ConnectFlagUsername)) {
             ctx->username = packet.username();
@@ -455,21 +1590,37 @@ void MqttServerPrivate::processPacket(const MqttPacket &packet, MqttServerClient
 #endif
 
 
+        // The handshake is done, the keep alive timeout replaces the connect timeout
+        pendingConnections.remove(client);
+        timerWheel.cancel(client);
+        ctx->lastSeen = clock.elapsed();
         if (ctx->keepAlive > 0) {
-            ctx->keepAliveTimer.start(ctx->keepAlive * 1500);
+            scheduleTimeout(client, ctx->lastSeen + ctx->keepAlive * 1500);
         }
 
+        // Authorizations depend on the server address, which may differ from the session's previous connection
+        ctx->publishAuthorizations.clear();
+        ctx->client = client;
         clientList.insert(client, ctx);
         response.setConnectReturnCode(Mqtt::ConnectReturnCodeAccepted);
-        client->write(response.serialize());
-        emit q_ptr->clientConnected(servers.key(clientServerMap.value(client)), ctx->clientId, ctx->username, client->peerAddress());
-
-        foreach (quint16 retryPacketId, ctx->unackedPacketList) {
-            qCDebug(dbgServer) << "Resending unacked packet" << retryPacketId << "to" << ctx->clientId;;
-            MqttPacket retryPacket = ctx->unackedPackets.value(retryPacketId);
-            retryPacket.setDup(true);
-            client->write(retryPacket.serialize());
+        write(client, response.serialize());
+        admissionControl.finish(client->admissionTicket(), true);
+        client->setAdmissionTicket(0);
+        emit q_ptr->clientConnected(client->serverAddressId(), ctx->clientId, ctx->username, client->peerAddress());
+
+        // Everything is sent again in its original order, as far as the in-flight window allows
+        ctx->unackedPackets.resetSent();
+        foreach (MqttPacket retryPacket, ctx->unackedPackets.takeSendable(clock.elapsed())) {
+            qCDebug(dbgServer) << "Resending unacked packet" << retryPacket.packetId() << "to" << ctx->clientId;
+            // Publishes are subject to the outbound queue limits, PUBRELs are control packets
+            if (retryPacket.type() == MqttPacket::TypePublish) {
+                retryPacket.setDup(true);
+                writePublish(client, retryPacket.serialize(), retryPacket.qos());
+            } else {
+                write(client, retryPacket.serialize());
+            }
         }
+        scheduleRetransmission(ctx);
         return;
     }
 
@@ -480,88 +1631,93 @@ void MqttServerPrivate::processPacket(const MqttPacket &packet, MqttServerClient
     }
 
     ClientContext *ctx = clientList.value(client);
-    if (ctx->keepAlive > 0) {
-        ctx->keepAliveTimer.start();
-    }
+    // Checked by the timer wheel once the keep alive timeout scheduled earlier expires
+    ctx->lastSeen = clock.elapsed();
     emit q_ptr->clientAlive(ctx->clientId);
 
     if (packet.type() == MqttPacket::TypePublish) {
+        if (!publishingClients.contains(client)) {
+            // Paused from now on while other clients are congested
+            publishingClients.insert(client);
+            if (isReadingPaused(client)) {
+                client->setReadingPaused(true);
+            }
+        }
+
+        bool allowed = true;
+        if (!authorizePublish(ctx, packet, &allowed)) {
+            // Processed again once the decision arrives, acks included
+            return;
+        }
+
         qCDebug(dbgServer).nospace() << "Publish received from client " << ctx->clientId << ": Topic: " << packet.topic() << ", Payload: " << packet.payload() << " (Packet ID: " << packet.packetId() << ", DUP: " << packet.dup() << ", QoS: " << packet.qos() << ", Retain: " << packet.retain() << ')';
         switch (packet.qos()) {
         case Mqtt::QoS0:
             break;
         case Mqtt::QoS1: {
             MqttPacket response(MqttPacket::TypePuback, packet.packetId());
-            client->write(response.serialize());
+            write(client, response.serialize());
             break;
         }
         case Mqtt::QoS2: {
-            if (packet.dup() && ctx->unackedPacketList.contains(packet.packetId())) {
+            MqttPacket response(MqttPacket::TypePubrec, packet.packetId());
+            if (packet.dup() && ctx->receivedQoS2PacketIds.contains(packet.packetId())) {
                 // We received this message before but the client keeps on trying... Just send a PUBREC and stop processing
-                client->write(ctx->unackedPackets.value(packet.packetId()).serialize());
+                write(client, response.serialize());
                 return;
-            } else if (ctx->unackedPacketList.contains(packet.packetId())) {
+            } else if (ctx->receivedQoS2PacketIds.contains(packet.packetId())) {
                 // Hmm... Client says this is a new packet, but the ID is not released yet! Drop client connection.
                 qCWarning(dbgServer()).nospace() << "Received a bad packet from \"" << ctx->clientId << "\". DUP is not set but packet ID is already used and not released. Dropping client connection.";
                 cleanupClient(client);
                 return;
             }
             // Ok, a new packet, ack it with a PUBREC and store the number
-            MqttPacket response(MqttPacket::TypePubrec, packet.packetId());
-            ctx->unackedPackets.insert(response.packetId(), response);
-            ctx->unackedPacketList.append(packet.packetId());
-            client->write(response.serialize());
+            ctx->receivedQoS2PacketIds.insert(packet.packetId());
+            write(client, response.serialize());
             break;
         }
         }
-        if (packet.retain()) {
-            if (packet.payload().isEmpty()) {
-                qCDebug(dbgServer) << "Clearing retained messages for topic" << packet.topic();
-                retainedMessages.remove(packet.topic());
-            } else {
-                if (packet.qos() == Mqtt::QoS0) {
-                    qCDebug(dbgServer) << "Clearing retained messages for topic" << packet.topic();
-                    retainedMessages.remove(packet.topic());
-                }
-                qCDebug(dbgServer) << "Adding retained message for topic" << packet.topic();
-                retainedMessages[packet.topic()].append(packet);
-            }
-        }
 
-        if (authorizer && !authorizer->authorizePublish(servers.key(clientServerMap.value(client)), ctx->clientId, packet.topic())) {
+        if (!allowed) {
             qCDebug(dbgServer) << "Client not authorized to publish to this topic. Discarding packet";
             return;
         }
 
+        // Topics starting with $ are reserved for the server. Publishes from clients to them are neither retained nor relayed.
+        const bool systemTopic = packet.topic().startsWith('$');
+        if (packet.retain() && !systemTopic) {
+            retainMessage(packet);
+        }
+
         emit q_ptr->publishReceived(ctx->clientId, packet.packetId(), packet.topic(), packet.payload());
-        publish(packet.topic(), packet.payload());
+        if (!systemTopic) {
+            publish(packet.topic(), packet.payload());
+        }
 
         return;
     }
     if (packet.type() == MqttPacket::TypePuback) {
-        ctx->unackedPacketList.removeAll(packet.packetId());
-        MqttPacket publishedPacket = ctx->unackedPackets.take(packet.packetId());
+        MqttPacket publishedPacket = ctx->unackedPackets.value(packet.packetId());
+        removeUnackedPacket(ctx, packet.packetId());
         emit q_ptr->published(ctx->clientId, packet.packetId(), publishedPacket.topic(), publishedPacket.payload());
         return;
     }
     if (packet.type() == MqttPacket::TypePubrec) {
-        MqttPacket publishedPacket = ctx->unackedPackets.take(packet.packetId());
+        MqttPacket publishedPacket = ctx->unackedPackets.value(packet.packetId());
         emit q_ptr->published(ctx->clientId, packet.packetId(), publishedPacket.topic(), publishedPacket.payload());
         MqttPacket pubrel(MqttPacket::TypePubrel, packet.packetId());
-        ctx->unackedPackets.insert(packet.packetId(), pubrel);
-        client->write(pubrel.serialize());
+        addUnackedPacket(ctx, pubrel);
+        write(client, pubrel.serialize());
         return;
     }
     if (packet.type() == MqttPacket::TypePubrel) {
-        ctx->unackedPackets.remove(packet.packetId());
-        ctx->unackedPacketList.removeAll(packet.packetId());
+        ctx->receivedQoS2PacketIds.remove(packet.packetId());
         MqttPacket response(MqttPacket::TypePubcomp, packet.packetId());
-        client->write(response.serialize());
+        write(client, response.serialize());
         return;
     }
     if (packet.type() == MqttPacket::TypePubcomp) {
-        ctx->unackedPackets.remove(packet.packetId());
-        ctx->unackedPacketList.removeAll(packet.packetId());
+        removeUnackedPacket(ctx, packet.packetId());
         return;
     }
     if (packet.type() == MqttPacket::TypeSubscribe) {
@@ -569,13 +1725,27 @@ void MqttServerPrivate::processPacket(const MqttPacket &packet, MqttServerClient
         MqttPacket response(MqttPacket::TypeSuback, packet.packetId());
         QByteArray payload;
         MqttSubscriptions effectiveSubscriptions;
-        foreach (MqttSubscription subscription, packet.subscriptions()) {
-            if (authorizer && !authorizer->authorizeSubscribe(servers.key(clientServerMap.value(client)), ctx->clientId, subscription.topicFilter())) {
+        if (asyncAuthorizer && !completedAuthorization) {
+            requestAuthorization(client, packet, ctx->clientId);
+            return;
+        }
+        MqttSubscriptions subscriptions = packet.subscriptions();
+        for (int filterIndex = 0; filterIndex < subscriptions.count(); filterIndex++) {
+            MqttSubscription subscription = subscriptions.at(filterIndex);
+            bool allowed = true;
+            if (completedAuthorization) {
+                allowed = completedAuthorization->decisions.at(filterIndex);
+            } else if (authorizer) {
+                const qint64 started = clock.nsecsElapsed();
+                allowed = authorizer->authorizeSubscribe(client->serverAddressId(), ctx->clientId, subscription.topicFilter());
+                statistics.addAuthorizationLatency(clock.nsecsElapsed() - started);
+            }
+            if (!allowed) {
                 qCWarning(dbgServer).nospace().noquote() << "Subscription topic filter not allowed for client \"" << ctx->clientId << "\": \"" << subscription.topicFilter() << '\"';
                 response.addSubscribeReturnCode(Mqtt::SubscribeReturnCodeFailure);
                 continue;
             }
-            if (!validateTopicFilter(subscription.topicFilter())) {
+            if (!subscription.isValid()) {
                 qCWarning(dbgServer).nospace() << "Subscription topic filter not valid for client \"" << ctx->clientId << "\": " << subscription.topicFilter();
                 response.addSubscribeReturnCode(Mqtt::SubscribeReturnCodeFailure);
                 continue;
@@ -592,6 +1762,10 @@ void MqttServerPrivate::processPacket(const MqttPacket &packet, MqttServerClient
             if (!updated) {
                 ctx->subscriptions.append(subscription);
             }
+            subscriptionIndex.insert(subscription.topicFilter(), ctx, subscription.qoS());
+            if (persistence && !ctx->cleanSession) {
+                persistence->storeSubscription(ctx->clientId, subscription);
+            }
             qCDebug(dbgServer).noquote().nospace() << "Subscribed client \"" << ctx->clientId << "\" to topic filter: \"" << subscription.topicFilter() << "\" with QoS " << subscription.qoS();
             effectiveSubscriptions << subscription;
             emit q_ptr->clientSubscribed(ctx->clientId, subscription.topicFilter(), subscription.qoS());
@@ -607,17 +1781,13 @@ void MqttServerPrivate::processPacket(const MqttPacket &packet, MqttServerClient
                 break;
             }
         }
-        client->write(response.serialize());
+        write(client, response.serialize());
 
         // Deliver any retained messages for this topic
         foreach (MqttSubscription subscription, effectiveSubscriptions) {
-            foreach (const QString &topic, retainedMessages.keys()) {
-                if (matchTopic(subscription.topicFilter(), topic)) {
-                    foreach (MqttPacket packet, retainedMessages.value(topic)) {
-                        packet.setRetain(true);
-                        client->write(packet.serialize());
-                    }
-                }
+            foreach (MqttPacket packet, retainedMessages.match(subscription.topicFilter())) {
+                packet.setRetain(true);
+                writePublish(client, packet.serialize(), packet.qos());
             }
         }
         return;
@@ -629,6 +1799,10 @@ void MqttServerPrivate::processPacket(const MqttPacket &packet, MqttServerClient
             foreach (const MqttSubscription &unsub, packet.subscriptions()) {
                 if (existingSubscription.topicFilter() == unsub.topicFilter()) {
                     qCDebug(dbgServer) << "Unsubscribing client" << ctx->clientId << "from" << unsub.topicFilter();
+                    subscriptionIndex.remove(unsub.topicFilter(), ctx);
+                    if (persistence && !ctx->cleanSession) {
+                        persistence->removeSubscription(ctx->clientId, unsub.topicFilter());
+                    }
                     emit q_ptr->clientUnsubscribed(ctx->clientId, unsub.topicFilter());
                     matching = true;
                     break;
@@ -640,13 +1814,13 @@ void MqttServerPrivate::processPacket(const MqttPacket &packet, MqttServerClient
         }
         ctx->subscriptions = newSubscriptions;
         MqttPacket response(MqttPacket::TypeUnsuback, packet.packetId());
-        client->write(response.serialize());
+        write(client, response.serialize());
         return;
     }
     if (packet.type() == MqttPacket::TypePingreq) {
 //        qCDebug(dbgServer).nospace() << ctx->clientId << ": Pingreq received";
         MqttPacket response(MqttPacket::TypePingresp, packet.packetId());
-        client->write(response.serialize());
+        write(client, response.serialize());
         return;
     }
     if (packet.type() == MqttPacket::TypeDisconnect) {
@@ -660,63 +1834,21 @@ void MqttServerPrivate::processPacket(const MqttPacket &packet, MqttServerClient
 
 }
 
-bool MqttServerPrivate::validateTopicFilter(const QString &topicFilter)
+quint16 MqttServerPrivate::newPacketId(ClientContext *ctx)
 {
-    if (topicFilter.length() < 1) {
-        return false;
-    }
-    QStringList parts = topicFilter.split('/');
-    for (int i = 0; i < parts.count(); i++) {
-        const QString &part = parts.at(i);
-        if (part.contains(QStringLiteral("#")) && (part != QStringLiteral("#") || i != parts.count() - 1)) {
-            return false;
-        }
-        if (part.contains(QStringLiteral("+")) && part != QStringLiteral("+")) {
-            return false;
-        }
-    }
-
-    return true;
+    return ctx->packetIds.allocate();
 }
 
-bool MqttServerPrivate::matchTopic(const QString &topicFilter, const QString &topic)
+QThread *MqttServerPrivate::nextWorkerThread()
 {
-    if (topic.startsWith('$')) {
-        return false;
-    }
-
-    QStringList filterParts = topicFilter.split('/');
-    QStringList topicParts = topic.split('/');
-
-    if (topicParts.count() < filterParts.count() - 1) {
-        return false;
-    }
-
-    for (int i = 0; i < filterParts.count(); i++) {
-        if (filterParts.at(i) == QStringLiteral("+")) {
-            continue;
-        }
-        if (filterParts.at(i) == QStringLiteral("#")) {
-            continue;
-        }
-        if (topicParts.length() <= i) {
-            return false;
-        }
-        if (topicParts.at(i) == filterParts.at(i)) {
-            continue;
-        }
-        return false;
+    while (workerThreads.count() < workerThreadCount) {
+        QThread *thread = new QThread(this);
+        thread->setObjectName(QString("mqtt-worker-%1").arg(workerThreads.count()));
+        thread->start();
+        workerThreads.append(thread);
     }
-
-    return filterParts.count() == topicParts.count() || topicFilter.endsWith('#');
-}
-
-quint16 MqttServerPrivate::newPacketId(ClientContext *ctx)
-{
-    static quint16 packetId = 0;
-    do {
-        packetId++;
-    } while(ctx->unackedPacketList.contains(packetId));
-    return packetId;
+    QThread *thread = workerThreads.at(nextWorkerThreadIndex % workerThreadCount);
+    nextWorkerThreadIndex = (nextWorkerThreadIndex + 1) % workerThreadCount;
+    return thread;
 }
 
@@ -33,10 +33,14 @@
 #include <QHostAddress>
 #include <QLoggingCategory>
 #include <QSslConfiguration>
+#include <QVector>
+
+#include <functional>
 
 #include "mqttpacket.h"
 
 class MqttServerPrivate;
+class MqttPersistence;
 class Subscription;
 
 class MqttAuthorizer {
@@ -45,18 +49,150 @@ public:
     virtual Mqtt::ConnectReturnCode authorizeConnect(int serverAddressId, const QString &clientId, const QString &username, const QString &password, const QHostAddress &peerAddress) = 0;
     virtual bool authorizeSubscribe(int serverAddressId, const QString &clientId, const QString &topicFilter) = 0;
     virtual bool authorizePublish(int serverAddressId, const QString &clientId, const QString &topic) = 0;
+
+    // Servers remember publish authorizations of connected clients per topic. Call this from the server's thread
+    // whenever decisions may have changed, e.g. after changing policies.
+    void invalidateAuthorizations() { m_authorizationGeneration++; }
+    quint32 authorizationGeneration() const { return m_authorizationGeneration; }
+
+private:
+    quint32 m_authorizationGeneration = 0;
+};
+
+// For authorizers which can't decide right away, e.g. because they hash passwords or ask another process. Report
+// each decision by calling the given function, from any thread. The server keeps serving other connections meanwhile
+// and holds back the following packets of the connection in question until the decision has arrived.
+// Along with a CONNECT carrying a will, the will topic is authorized for publishing.
+class MqttAsyncAuthorizer {
+public:
+    virtual ~MqttAsyncAuthorizer() = default;
+    virtual void authorizeConnect(int serverAddressId, const QString &clientId, const QString &username, const QString &password, const QHostAddress &peerAddress, std::function<void(Mqtt::ConnectReturnCode)> result) = 0;
+    virtual void authorizeSubscribe(int serverAddressId, const QString &clientId, const QString &topicFilter, std::function<void(bool)> result) = 0;
+    virtual void authorizePublish(int serverAddressId, const QString &clientId, const QString &topic, std::function<void(bool)> result) = 0;
+
+    // See MqttAuthorizer
+    void invalidateAuthorizations() { m_authorizationGeneration++; }
+    quint32 authorizationGeneration() const { return m_authorizationGeneration; }
+
+private:
+    quint32 m_authorizationGeneration = 0;
 };
 
 class MqttServer : public QObject
 {
     Q_OBJECT
 public:
+    enum OutboundQueueOverflowPolicy {
+        // Drop the oldest queued QoS 0 publishes, disconnect if only QoS 1 and 2 publishes are queued
+        OutboundQueueOverflowDropOldestQoS0,
+        // Disconnect the client, unacknowledged QoS 1 and 2 publishes stay in the session
+        OutboundQueueOverflowDisconnect,
+        // Keep queueing but stop reading from all other clients which have sent publishes until the queue drained to half its
+        // limits. As a single client not reading pauses the whole broker, it is disconnected if its queue doesn't drain within
+        // the maximum publishers pause or grows to twice the limits meanwhile.
+        OutboundQueueOverflowPausePublishers
+    };
+    Q_ENUM(OutboundQueueOverflowPolicy)
+
     explicit MqttServer(QObject *parent = nullptr);
 
     Mqtt::QoS maximumSubscriptionsQoS() const;
     void setMaximumSubscriptionsQoS(Mqtt::QoS maximumSubscriptionQoS);
 
+    // QoS 1 and 2 publishes sent to a client without being acknowledged yet, like MQTT 5's receive maximum. Further ones are
+    // queued in the session and sent in order as acknowledgements arrive. 0 (default) means unlimited.
+    int maximumInFlightMessages() const;
+    void setMaximumInFlightMessages(int maximumInFlightMessages);
+
+    // Retransmits QoS 1 and 2 publishes and PUBRELs not acknowledged within the interval in milliseconds, on the same connection,
+    // doubling the interval with every retransmission up to the maximum interval. 0 (default) only resends them when a session resumes.
+    int retransmissionInterval() const;
+    void setRetransmissionInterval(int retransmissionInterval);
+    // Defaults to 60 seconds
+    int maximumRetransmissionInterval() const;
+    void setMaximumRetransmissionInterval(int maximumRetransmissionInterval);
+    // The number of publishes and PUBRELs sent again due to the retransmission interval
+    quint64 retransmittedMessagesCount() const;
+
+    // Publishes statistics in the $SYS/broker/ tree every interval in seconds, like the number of connected clients,
+    // publishes and bytes received and sent, their load averages per minute over 1, 5 and 15 minutes, retained messages,
+    // heap usage and uptime. They are retained but not persisted. 0 (default) disables them. Capped at 2147483 seconds.
+    int sysTopicsInterval() const;
+    void setSysTopicsInterval(int sysTopicsInterval);
+
+    // Clients announcing a larger packet in the fixed header are disconnected before the packet is buffered. Defaults to the protocol limit.
+    quint32 maximumPacketSize() const;
+    void setMaximumPacketSize(quint32 maximumPacketSize);
+
+    // Distributes the socket I/O of new connections, including encryption, framing and parsing of packets, across the given number
+    // of threads. Processing the parsed packets stays in the server's thread. 0 (default) keeps everything in the server's thread.
+    // Existing connections are not moved.
+    int workerThreadCount() const;
+    void setWorkerThreadCount(int workerThreadCount);
+
+    // Limits for publishes waiting to be sent to a single client whose connection can't keep up. 0 (default) means unlimited.
+    int maximumOutboundQueueMessages() const;
+    void setMaximumOutboundQueueMessages(int maximumOutboundQueueMessages);
+    qint64 maximumOutboundQueueBytes() const;
+    void setMaximumOutboundQueueBytes(qint64 maximumOutboundQueueBytes);
+    OutboundQueueOverflowPolicy outboundQueueOverflowPolicy() const;
+    void setOutboundQueueOverflowPolicy(OutboundQueueOverflowPolicy policy);
+    // How long a congested client may pause the others with OutboundQueueOverflowPausePublishers, in milliseconds. Defaults to 10 seconds.
+    int maximumPublishersPause() const;
+    void setMaximumPublishersPause(int maximumPublishersPause);
+
+    // The packets and bytes waiting to be sent to a connected client. The bytes include data buffered in the connection.
+    int outboundQueueMessages(const QString &clientId) const;
+    qint64 outboundQueueBytes(const QString &clientId) const;
+    // The number of QoS 0 publishes dropped due to full outbound queues
+    quint64 droppedMessagesCount() const;
+    // The bytes of all outbound queues, including data buffered in the connections
+    qint64 totalOutboundQueueBytes() const;
+
+    // Statistics since the server has been created. The counters may be read from any thread, the others only from the server's thread.
+    // Publishes received from clients and handed to connections to be sent, by QoS
+    quint64 receivedMessagesCount(Mqtt::QoS qos) const;
+    quint64 sentMessagesCount(Mqtt::QoS qos) const;
+    quint64 receivedBytesCount() const;
+    quint64 sentBytesCount() const;
+    // Connections dropped for sending malformed or oversized packets
+    quint64 parseErrorsCount() const;
+    int retainedMessagesCount() const;
+    // QoS 1 and 2 publishes and PUBRELs sent to connected clients and not acknowledged yet
+    int inFlightMessagesCount() const;
+    // A histogram of the time the authorizer takes for a decision, for asynchronous authorizers until all decisions on a packet
+    // have arrived. The bounds are the upper bounds of the buckets in microseconds, the counts have one more entry for everything above.
+    static QVector<qint64> authorizationLatencyBounds();
+    QVector<quint64> authorizationLatencyCounts() const;
+    // In microseconds
+    quint64 authorizationLatencySum() const;
+
+    // Admission control against connection storms. New connections wait in the accept queue while this many handshakes,
+    // from accepting the connection including TLS until the CONNACK, are in progress. 0 (default) means unlimited.
+    int maximumConcurrentHandshakes() const;
+    void setMaximumConcurrentHandshakes(int maximumConcurrentHandshakes);
+    // Accepting is paused while the accept queue is full, leaving new connections to the network stack's backlog. Defaults to 1000, 0 means unlimited.
+    int maximumAcceptQueueLength() const;
+    void setMaximumAcceptQueueLength(int maximumAcceptQueueLength);
+    // New connections per second from a single address, more are closed right away. 0 (default) means unlimited.
+    int maximumConnectionRatePerAddress() const;
+    void setMaximumConnectionRatePerAddress(int maximumConnectionRatePerAddress);
+
+    int acceptQueueLength() const;
+    int handshakesInProgress() const;
+    // The number of successful handshakes and their total duration in milliseconds, including the time spent in the accept queue
+    quint64 handshakeCount() const;
+    qint64 handshakeLatencySum() const;
+    // The number of connections closed for exceeding the connection rate of their address
+    quint64 rejectedConnectionsCount() const;
+
+    // Only one authorizer is used, setting one replaces the other kind
     void setAuthorizer(MqttAuthorizer *authorizer);
+    void setAsyncAuthorizer(MqttAsyncAuthorizer *authorizer);
+
+    // Stores retained messages and persistent sessions, restoring the stored state right away. Set it before listening.
+    // Sessions of clients connecting without the clean session flag are only kept after they disconnect if a persistence is set.
+    void setPersistence(MqttPersistence *persistence);
 
     int listen(const QHostAddress &address = QHostAddress::Any, quint16 port = 1883, const QSslConfiguration &sslConfiguration = QSslConfiguration());
     int listenWebSocket(const QHostAddress &address = QHostAddress::Any, quint16 port = 80, const QSslConfiguration &sslConfiguration = QSslConfiguration());
@@ -68,7 +204,7 @@ public:
     QStringList clients() const;
     void disconnectClient(const QString &clientId);
 
-    // allows publishing from the server, including topics starting with $
+    // allows publishing from the server, including topics starting with $, which only match topic filters starting with the same level
     QHash<QString, quint16> publish(const QString &topic, const QByteArray &payload = QByteArray());
 
 signals:
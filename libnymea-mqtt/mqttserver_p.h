@@ -33,69 +33,204 @@
 #include <QTcpSocket>
 #include <QTimer>
 #include <QLoggingCategory>
+#include <QSet>
+#include <QElapsedTimer>
 
 #include "mqttpacket.h"
 #include "mqttserver.h"
+#include "mqttsubscriptionindex.h"
+#include "mqttretainedmessageindex.h"
+#include "mqttpersistence.h"
+#include "mqttadmissioncontrol.h"
+#include "mqtttimerwheel.h"
+#include "mqttpacketidallocator.h"
+#include "mqttinflightwindow.h"
+#include "mqttserverstatistics.h"
 
 Q_DECLARE_LOGGING_CATEGORY(dbgServer)
 
 class ClientContext;
+class PendingAuthorization;
 class Subscription;
 class MqttServerTransport;
 class MqttServerClient;
+class MqttOutputQueue;
+class QThread;
 
 class MqttServerPrivate: public QObject
 {
     Q_OBJECT
 public:
     explicit MqttServerPrivate(MqttServer *q);
+    ~MqttServerPrivate() override;
 
     int listen(MqttServerTransport *transport, const QHostAddress &address, quint16 port);
-    QHash<QString, quint16> publish(const QString &topic, const QByteArray &payload = QByteArray());
+    // The topic is UTF-8 encoded, as received from the client
+    QHash<QString, quint16> publish(const QByteArray &topic, const QByteArray &payload = QByteArray());
     void cleanupClient(MqttServerClient *client);
+    // Publishes the will of a client whose connection is going away
+    void publishWill(ClientContext *ctx);
+    void retainMessage(const MqttPacket &packet);
+    void processInput(MqttServerClient *client);
+    void setPersistence(MqttPersistence *persistence);
+
+    ClientContext *createContext(const QString &clientId);
+    void deleteOfflineSession(ClientContext *ctx);
+    // Returns true if the packet is to be sent right away, false if it waits for the in-flight window
+    bool addUnackedPacket(ClientContext *ctx, const MqttPacket &packet);
+    void removeUnackedPacket(ClientContext *ctx, quint16 packetId);
+    // Sends the packets which fit into the in-flight window of a connected client
+    void sendWaitingPackets(ClientContext *ctx);
+    void setAuthorizers(MqttAuthorizer *authorizer, MqttAsyncAuthorizer *asyncAuthorizer);
+    quint32 authorizationGeneration() const;
+    // Returns false if the decision has been requested from the asynchronous authorizer
+    bool authorizePublish(ClientContext *ctx, const MqttPacket &packet, bool *allowed);
+    void cachePublishAuthorization(ClientContext *ctx, const QByteArray &topic, bool allowed);
+    void requestAuthorization(MqttServerClient *client, const MqttPacket &packet, const QString &clientId);
+    void onAuthorizationResult(MqttServerClient *client, quint64 authorizationId, int index, bool allowed, Mqtt::ConnectReturnCode returnCode);
 
     void processPacket(const MqttPacket &packet, MqttServerClient *client);
-    bool validateTopicFilter(const QString &topicFilter);
-    bool matchTopic(const QString &topicFilter, const QString &topic);
+    // Returns 0 if all packet IDs of the session are in use
     quint16 newPacketId(ClientContext *ctx);
+    QThread *nextWorkerThread();
+
+    // Control packets are never dropped and don't count against the outbound queue limits
+    void write(MqttServerClient *client, const QByteArray &data);
+    void writePublish(MqttServerClient *client, const QByteArray &data, Mqtt::QoS qos);
+    void flushOutputQueue(MqttServerClient *client);
+    // The factor scales the limits
+    bool outputQueueFull(const MqttOutputQueue &queue, qint64 additionalBytes, int factor = 1) const;
+    // Disconnects a client which doesn't keep up with its outbound traffic, unacked packets stay in the session
+    void dropSlowClient(MqttServerClient *client);
+    void checkCongestion(MqttServerClient *client);
+    void updateReadingPaused();
+    bool isReadingPaused(MqttServerClient *client) const;
+    // Times are milliseconds on the server's clock
+    void scheduleTimeout(MqttServerClient *client, qint64 deadline);
+    // Schedules the next retransmission of a connected client's packets in flight unless there is one already
+    void scheduleRetransmission(ClientContext *ctx);
+    void retransmit(MqttServerClient *client, qint64 now);
+    void startTimerWheelTimer();
+    void publishSysTopics();
+    // Removes the retained $SYS messages
+    void clearSysTopics();
 
 public slots:
     void onClientConnected(MqttServerClient *client);
     void onDataAvailable(const QByteArray &data);
+    void onPacketsAvailable(qint64 bytes);
+    void onParseError();
+    void onBytesWritten();
     void onClientDisconnected();
+    void onAcceptingPausedChanged(bool paused);
+    void onTimerWheelTick();
 
 public:
     MqttServer *q_ptr;
 
     QHash<int, MqttServerTransport*> servers;
     MqttAuthorizer *authorizer = nullptr;
+    MqttAsyncAuthorizer *asyncAuthorizer = nullptr;
+    // Connections waiting for decisions of the asynchronous authorizer
+    QHash<MqttServerClient*, PendingAuthorization*> pendingAuthorizations;
+    quint64 lastAuthorizationId = 0;
+    // Set while processing a packet again once all its decisions have arrived
+    PendingAuthorization *completedAuthorization = nullptr;
+    MqttPersistence *persistence = nullptr;
 
     Mqtt::QoS maximumSubscriptionQoS = Mqtt::QoS2;
-
-    QHash<MqttServerClient*, QTimer*> pendingConnections;
+    int maximumInFlightMessages = 0;
+    qint64 retransmissionInterval = 0;
+    qint64 maximumRetransmissionInterval = 60000;
+    quint64 retransmittedMessages = 0;
+    // The protocol limit: 268435455 bytes Remaining Length plus a 5 bytes fixed header
+    quint32 maximumPacketSize = 268435460;
+
+    int workerThreadCount = 0;
+    QList<QThread*> workerThreads;
+    int nextWorkerThreadIndex = 0;
+
+    int maximumOutboundQueueMessages = 0;
+    qint64 maximumOutboundQueueBytes = 0;
+    MqttServer::OutboundQueueOverflowPolicy outboundQueueOverflowPolicy = MqttServer::OutboundQueueOverflowDropOldestQoS0;
+    // Connections which exceeded their outbound queue limits with the pause policy and since when on the server's clock.
+    // As long as there are any, reading from all other connections which have sent publishes is paused.
+    QHash<MqttServerClient*, qint64> congestedClients;
+    QSet<MqttServerClient*> publishingClients;
+    int maximumPublishersPause = 10000;
+    quint64 droppedMessages = 0;
+    MqttServerStatistics statistics;
+    // $SYS topics, published every interval in seconds
+    int sysTopicsInterval = 0;
+    QTimer sysTopicsTimer;
+    QList<QByteArray> sysTopics;
+    MqttLoadAverage receivedMessagesLoad;
+    MqttLoadAverage sentMessagesLoad;
+    MqttLoadAverage receivedBytesLoad;
+    MqttLoadAverage sentBytesLoad;
+
+    MqttAdmissionControl admissionControl;
+    // Connections which haven't completed the MQTT handshake yet
+    QSet<MqttServerClient*> pendingConnections;
+    // Connect timeouts of pending connections and keep alive timeouts of connected clients
+    QElapsedTimer clock;
+    MqttTimerWheel timerWheel;
+    // Retransmissions of packets in flight, moved by the same timer
+    MqttTimerWheel retransmissionWheel;
+    QTimer timerWheelTimer;
     QHash<MqttServerClient*, ClientContext*> clientList;
-    QHash<MqttServerClient*, QByteArray> clientBuffers;
-    QHash<QString, MqttPackets> retainedMessages;
+    // Sessions of disconnected clients which connected without the clean session flag. Only kept with a persistence.
+    QHash<QString, ClientContext*> offlineSessions;
+    MqttRetainedMessageIndex retainedMessages;
     QHash<MqttServerClient*, MqttServerTransport*> clientServerMap;
+    MqttSubscriptionIndex subscriptionIndex;
 };
 
 class ClientContext {
 public:
+    // nullptr while the session is offline
+    MqttServerClient *client = nullptr;
     Mqtt::Protocol version = Mqtt::ProtocolUnknown;
     quint16 keepAlive = 0;
-    QTimer keepAliveTimer;
+    // The time of the last packet received from the client on the server's clock
+    qint64 lastSeen = 0;
     QString clientId;
+    bool cleanSession = true;
     QString username;
     QByteArray willTopic;
     QByteArray willMessage;
     Mqtt::QoS willQoS = Mqtt::QoS0;
     bool willRetain = false;
+    // Decided along with the CONNECT when using an asynchronous authorizer
+    bool willAuthorized = true;
 
-    QByteArray inputBuffer;
     MqttSubscriptions subscriptions;
 
-    QVector<quint16> unackedPacketList;
-    QHash<quint16, MqttPacket> unackedPackets;
+    MqttInFlightWindow unackedPackets;
+    // The IDs of all unacked packets sent to the client
+    MqttPacketIdAllocator packetIds;
+    // The IDs of QoS 2 publishes received from the client which are waiting for the PUBREL.
+    // The client picks them from its own ID space, so they may be in use in packetIds at the same time.
+    QSet<quint16> receivedQoS2PacketIds;
+
+    // Publish authorizations by topic, valid as long as the authorizer's generation doesn't change
+    QHash<QByteArray, bool> publishAuthorizations;
+    quint32 publishAuthorizationGeneration = 0;
+};
+
+class PendingAuthorization {
+public:
+    quint64 id = 0;
+    MqttPacket packet;
+    // The client ID the decisions are made for, which may have been generated by the server
+    QString clientId;
+    quint32 generation = 0;
+    // On the server's clock in nanoseconds
+    qint64 requestedAt = 0;
+    int outstanding = 0;
+    Mqtt::ConnectReturnCode connectReturnCode = Mqtt::ConnectReturnCodeAccepted;
+    // One per topic filter of a SUBSCRIBE, the topic of a PUBLISH or the will topic of a CONNECT
+    QVector<bool> decisions;
 };
 
 #endif // MQTTSERVER_P_H
@@ -0,0 +1,73 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* nymea-mqtt
+* MQTT library for nymea
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public License
+* as published by the Free Software Foundation, either version 3
+* of the License, or (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "mqttserverstatistics.h"
+
+#include <cmath>
+
+const qint64 MqttServerStatistics::authorizationLatencyBounds[] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000
+};
+
+void MqttServerStatistics::addAuthorizationLatency(qint64 nanoseconds)
+{
+    const qint64 microseconds = qMax<qint64>(0, nanoseconds / 1000);
+    int bucket = 0;
+    while (bucket < authorizationLatencyBucketCount && microseconds > authorizationLatencyBounds[bucket]) {
+        bucket++;
+    }
+    authorizationLatencyCounts[bucket].fetchAndAddRelaxed(1);
+    authorizationLatencySum.fetchAndAddRelaxed(static_cast<quint64>(microseconds));
+}
+
+void MqttLoadAverage::update(quint64 counter, qint64 now)
+{
+    if (m_lastUpdate < 0) {
+        m_lastCounter = counter;
+        m_lastUpdate = now;
+        return;
+    }
+    const qint64 elapsed = now - m_lastUpdate;
+    if (elapsed <= 0) {
+        return;
+    }
+    const double rate = static_cast<double>(counter - m_lastCounter) * 60000 / elapsed;
+    static const double periods[3] = {60000, 300000, 900000};
+    for (int i = 0; i < 3; i++) {
+        const double decay = std::exp(-elapsed / periods[i]);
+        m_averages[i] = m_averages[i] * decay + rate * (1 - decay);
+    }
+    m_lastCounter = counter;
+    m_lastUpdate = now;
+}
+
+void MqttLoadAverage::reset()
+{
+    m_lastCounter = 0;
+    m_lastUpdate = -1;
+    m_averages[0] = m_averages[1] = m_averages[2] = 0;
+}
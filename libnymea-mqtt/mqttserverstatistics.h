@@ -0,0 +1,75 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* nymea-mqtt
+* MQTT library for nymea
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public License
+* as published by the Free Software Foundation, either version 3
+* of the License, or (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef MQTTSERVERSTATISTICS_H
+#define MQTTSERVERSTATISTICS_H
+
+#include <QAtomicInteger>
+
+// Counters updated on the server's hot path. Relaxed atomic increments cost next to nothing and allow
+// reading the counters from any thread.
+class MqttServerStatistics
+{
+public:
+    static const int authorizationLatencyBucketCount = 14;
+    // Upper bounds of the authorization latency buckets in microseconds, one more bucket takes everything above
+    static const qint64 authorizationLatencyBounds[authorizationLatencyBucketCount];
+
+    void addAuthorizationLatency(qint64 nanoseconds);
+
+    // Publishes by QoS
+    QAtomicInteger<quint64> receivedMessages[3];
+    QAtomicInteger<quint64> sentMessages[3];
+    QAtomicInteger<quint64> receivedBytes;
+    QAtomicInteger<quint64> sentBytes;
+    QAtomicInteger<quint64> parseErrors;
+
+    QAtomicInteger<quint64> authorizationLatencyCounts[authorizationLatencyBucketCount + 1];
+    // In microseconds
+    QAtomicInteger<quint64> authorizationLatencySum;
+};
+
+// The rate of a counter per minute, averaged over 1, 5 and 15 minutes with exponentially decaying weights like
+// the load averages of Unix systems. Only needs a sample of the counter now and then.
+class MqttLoadAverage
+{
+public:
+    // The time is in milliseconds on any monotonic clock. The first sample only sets the starting point.
+    void update(quint64 counter, qint64 now);
+    void reset();
+
+    double oneMinute() const { return m_averages[0]; }
+    double fiveMinutes() const { return m_averages[1]; }
+    double fifteenMinutes() const { return m_averages[2]; }
+
+private:
+    quint64 m_lastCounter = 0;
+    qint64 m_lastUpdate = -1;
+    double m_averages[3] = {0, 0, 0};
+};
+
+#endif // MQTTSERVERSTATISTICS_H
@@ -68,6 +68,79 @@ void MqttSubscription::setQoS(Mqtt::QoS qoS)
     m_qoS = qoS;
 }
 
+bool MqttSubscription::isValid() const
+{
+    return isValidTopicFilter(m_topicFilter);
+}
+
+bool MqttSubscription::isValidTopicFilter(const QByteArray &topicFilter)
+{
+    const char *data = topicFilter.constData();
+    const int size = topicFilter.size();
+    if (size < 1) {
+        return false;
+    }
+    int levelStart = 0;
+    for (int i = 0; i < size; i++) {
+        if (data[i] == '/') {
+            levelStart = i + 1;
+        } else if (data[i] == '+' || data[i] == '#') {
+            if (i != levelStart || (i + 1 < size && data[i + 1] != '/')) {
+                return false;
+            }
+            if (data[i] == '#' && i + 1 != size) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool MqttSubscription::matchTopic(const QByteArray &topicFilter, const QByteArray &topic)
+{
+    const char *filter = topicFilter.constData();
+    const int filterSize = topicFilter.size();
+    const char *data = topic.constData();
+    const int size = topic.size();
+    if (size > 0 && data[0] == '$' && filterSize > 0 && (filter[0] == '+' || filter[0] == '#')) {
+        return false;
+    }
+
+    // Both positions are at the start of a level at the beginning of each iteration
+    int f = 0;
+    int t = 0;
+    forever {
+        if (f < filterSize && filter[f] == '#') {
+            return true;
+        }
+        if (f < filterSize && filter[f] == '+' && (f + 1 == filterSize || filter[f + 1] == '/')) {
+            f++;
+            while (t < size && data[t] != '/') {
+                t++;
+            }
+        } else {
+            while (f < filterSize && filter[f] != '/') {
+                if (t >= size || data[t] != filter[f]) {
+                    return false;
+                }
+                f++;
+                t++;
+            }
+            if (t < size && data[t] != '/') {
+                return false;
+            }
+        }
+
+        if (f == filterSize || t == size) {
+            // A trailing /# also matches the parent level
+            return (f == filterSize && t == size) || (t == size && filterSize - f == 2 && filter[f + 1] == '#');
+        }
+        // Skip the '/' in both
+        f++;
+        t++;
+    }
+}
+
 bool MqttSubscription::operator==(const MqttSubscription &other) const
 {
     return m_qoS == other.qoS() && m_topicFilter == other.topicFilter();
@@ -44,6 +44,14 @@ public:
     Mqtt::QoS qoS() const;
     void setQoS(Mqtt::QoS qoS);
 
+    // Wildcards have to take a whole level, # only the last one
+    bool isValid() const;
+
+    // Work on the UTF-8 encoded topic and topic filter in place, without allocating memory
+    static bool isValidTopicFilter(const QByteArray &topicFilter);
+    // Topics starting with $ don't match filters starting with a wildcard
+    static bool matchTopic(const QByteArray &topicFilter, const QByteArray &topic);
+
     bool operator==(const MqttSubscription &other) const;
 private:
     QByteArray m_topicFilter;
@@ -0,0 +1,185 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* nymea-mqtt
+* MQTT library for nymea
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public License
+* as published by the Free Software Foundation, either version 3
+* of the License, or (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "mqttsubscriptionindex.h"
+
+class MqttSubscriptionIndex::Node
+{
+public:
+    ~Node() {
+        qDeleteAll(children);
+        delete plus;
+        delete hash;
+    }
+
+    bool isEmpty() const {
+        return subscribers.isEmpty() && children.isEmpty() && !plus && !hash;
+    }
+
+    QHash<QByteArray, Node*> children;
+    Node *plus = nullptr;
+    Node *hash = nullptr;
+    QHash<ClientContext*, Mqtt::QoS> subscribers;
+};
+
+// The end of the level starting at from, which is the position of the next '/' or the length of the topic
+static int levelEnd(const QByteArray &topic, int from)
+{
+    const int end = topic.indexOf('/', from);
+    return end == -1 ? topic.size() : end;
+}
+
+// Doesn't copy the level, it's only valid as long as the topic is
+static QByteArray levelAt(const QByteArray &topic, int from)
+{
+    return QByteArray::fromRawData(topic.constData() + from, levelEnd(topic, from) - from);
+}
+
+MqttSubscriptionIndex::MqttSubscriptionIndex():
+    m_root(new Node())
+{
+
+}
+
+MqttSubscriptionIndex::~MqttSubscriptionIndex()
+{
+    delete m_root;
+}
+
+void MqttSubscriptionIndex::insert(const QByteArray &topicFilter, ClientContext *ctx, Mqtt::QoS qos)
+{
+    Node *node = m_root;
+    for (int from = 0; from <= topicFilter.size(); from = levelEnd(topicFilter, from) + 1) {
+        const QByteArray level = levelAt(topicFilter, from);
+        if (level == "+") {
+            if (!node->plus) {
+                node->plus = new Node();
+            }
+            node = node->plus;
+        } else if (level == "#") {
+            if (!node->hash) {
+                node->hash = new Node();
+            }
+            node = node->hash;
+        } else {
+            QHash<QByteArray, Node*>::iterator it = node->children.find(level);
+            if (it == node->children.end()) {
+                // The lookup key doesn't own its data, the stored one has to
+                it = node->children.insert(QByteArray(level.constData(), level.size()), new Node());
+            }
+            node = it.value();
+        }
+    }
+    node->subscribers.insert(ctx, qos);
+}
+
+void MqttSubscriptionIndex::remove(const QByteArray &topicFilter, ClientContext *ctx)
+{
+    remove(m_root, topicFilter, 0, ctx);
+}
+
+QHash<ClientContext*, Mqtt::QoS> MqttSubscriptionIndex::match(const QByteArray &topic) const
+{
+    QHash<ClientContext*, Mqtt::QoS> receivers;
+    // Topics starting with $ are reserved for the server and don't match wildcards on the first level
+    if (topic.startsWith('$')) {
+        const Node *child = m_root->children.value(levelAt(topic, 0));
+        if (child) {
+            collect(child, topic, levelEnd(topic, 0) + 1, receivers);
+        }
+        return receivers;
+    }
+    collect(m_root, topic, 0, receivers);
+    return receivers;
+}
+
+// Returns true if the node doesn't hold anything any more and can be deleted by the caller
+bool MqttSubscriptionIndex::remove(Node *node, const QByteArray &topicFilter, int from, ClientContext *ctx)
+{
+    if (from > topicFilter.size()) {
+        node->subscribers.remove(ctx);
+        return node->isEmpty();
+    }
+
+    const QByteArray level = levelAt(topicFilter, from);
+    const int next = from + level.size() + 1;
+    if (level == "+") {
+        if (node->plus && remove(node->plus, topicFilter, next, ctx)) {
+            delete node->plus;
+            node->plus = nullptr;
+        }
+    } else if (level == "#") {
+        if (node->hash && remove(node->hash, topicFilter, next, ctx)) {
+            delete node->hash;
+            node->hash = nullptr;
+        }
+    } else {
+        QHash<QByteArray, Node*>::iterator it = node->children.find(level);
+        if (it != node->children.end() && remove(it.value(), topicFilter, next, ctx)) {
+            delete it.value();
+            node->children.erase(it);
+        }
+    }
+    return node->isEmpty();
+}
+
+void MqttSubscriptionIndex::collect(const Node *node, const QByteArray &topic, int from, QHash<ClientContext*, Mqtt::QoS> &receivers) const
+{
+    // '#' matches any number of levels, including none (i.e. "a/#" matches "a")
+    if (node->hash) {
+        addReceivers(node->hash, receivers);
+    }
+
+    if (from > topic.length()) {
+        // All levels of the topic consumed
+        addReceivers(node, receivers);
+        return;
+    }
+
+    const int end = levelEnd(topic, from);
+    if (!node->children.isEmpty()) {
+        Node *child = node->children.value(levelAt(topic, from));
+        if (child) {
+            collect(child, topic, end + 1, receivers);
+        }
+    }
+    if (node->plus) {
+        collect(node->plus, topic, end + 1, receivers);
+    }
+}
+
+void MqttSubscriptionIndex::addReceivers(const Node *node, QHash<ClientContext*, Mqtt::QoS> &receivers) const
+{
+    for (QHash<ClientContext*, Mqtt::QoS>::const_iterator it = node->subscribers.constBegin(); it != node->subscribers.constEnd(); ++it) {
+        QHash<ClientContext*, Mqtt::QoS>::iterator existing = receivers.find(it.key());
+        if (existing == receivers.end()) {
+            receivers.insert(it.key(), it.value());
+        } else if (existing.value() < it.value()) {
+            existing.value() = it.value();
+        }
+    }
+}
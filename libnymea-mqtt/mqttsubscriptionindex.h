@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* nymea-mqtt
+* MQTT library for nymea
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public License
+* as published by the Free Software Foundation, either version 3
+* of the License, or (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef MQTTSUBSCRIPTIONINDEX_H
+#define MQTTSUBSCRIPTIONINDEX_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+
+#include "mqtt.h"
+
+class ClientContext;
+
+// Holds all subscriptions of a server in a tree with one node per topic level. '+' and '#'
+// have their own branches on each node so that looking up the subscribers for a topic only
+// walks the levels of that topic instead of comparing it against every subscription.
+class MqttSubscriptionIndex
+{
+public:
+    MqttSubscriptionIndex();
+    ~MqttSubscriptionIndex();
+
+    // Adds a subscription for the given context. Subscribing again to the same filter replaces the QoS.
+    void insert(const QByteArray &topicFilter, ClientContext *ctx, Mqtt::QoS qos);
+    void remove(const QByteArray &topicFilter, ClientContext *ctx);
+
+    // Returns all contexts with at least one filter matching the topic, along with the highest QoS of their matching filters.
+    QHash<ClientContext*, Mqtt::QoS> match(const QByteArray &topic) const;
+
+private:
+    class Node;
+
+    // Topics and topic filters are walked level by level in place, from is the start of the current level
+    bool remove(Node *node, const QByteArray &topicFilter, int from, ClientContext *ctx);
+    void collect(const Node *node, const QByteArray &topic, int from, QHash<ClientContext*, Mqtt::QoS> &receivers) const;
+    void addReceivers(const Node *node, QHash<ClientContext*, Mqtt::QoS> &receivers) const;
+
+    Node *m_root = nullptr;
+
+    Q_DISABLE_COPY(MqttSubscriptionIndex)
+};
+
+#endif // MQTTSUBSCRIPTIONINDEX_H
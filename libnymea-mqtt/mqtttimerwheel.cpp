@@ -0,0 +1,146 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* nymea-mqtt
+* MQTT library for nymea
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public License
+* as published by the Free Software Foundation, either version 3
+* of the License, or (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "mqtttimerwheel.h"
+
+// Slots per level and the bits of a tick each level covers
+static const int slotCounts[3] = { 256, 64, 64 };
+static const int levelShifts[3] = { 0, 8, 14 };
+static const qint64 wheelSpan = Q_INT64_C(1) << 20;
+
+MqttTimerWheel::MqttTimerWheel(qint64 tickLength):
+    m_tickLength(qMax(Q_INT64_C(1), tickLength))
+{
+    for (int level = 0; level < 3; level++) {
+        m_slots[level].resize(slotCounts[level]);
+    }
+}
+
+qint64 MqttTimerWheel::tickLength() const
+{
+    return m_tickLength;
+}
+
+void MqttTimerWheel::schedule(MqttServerClient *client, qint64 deadline)
+{
+    cancel(client);
+    // Rounded up, a deadline never expires early. The current tick has been processed already.
+    insert(client, qMax((deadline + m_tickLength - 1) / m_tickLength, m_currentTick + 1));
+}
+
+void MqttTimerWheel::cancel(MqttServerClient *client)
+{
+    QHash<MqttServerClient*, Entry>::iterator it = m_entries.find(client);
+    if (it == m_entries.end()) {
+        return;
+    }
+    m_slots[it->level][it->slot].remove(client);
+    m_entries.erase(it);
+}
+
+bool MqttTimerWheel::contains(MqttServerClient *client) const
+{
+    return m_entries.contains(client);
+}
+
+int MqttTimerWheel::count() const
+{
+    return m_entries.count();
+}
+
+bool MqttTimerWheel::isEmpty() const
+{
+    return m_entries.isEmpty();
+}
+
+QList<MqttServerClient*> MqttTimerWheel::advance(qint64 now)
+{
+    QList<MqttServerClient*> expired;
+    const qint64 targetTick = now / m_tickLength;
+
+    if (m_entries.isEmpty()) {
+        // Nothing to walk through
+        m_currentTick = qMax(m_currentTick, targetTick);
+        return expired;
+    }
+
+    while (m_currentTick < targetTick) {
+        m_currentTick++;
+
+        // Entries of the upper levels move down once the lower level wrapped around to their range
+        if ((m_currentTick & ((Q_INT64_C(1) << levelShifts[2]) - 1)) == 0) {
+            cascade(2, (m_currentTick >> levelShifts[2]) & (slotCounts[2] - 1));
+        }
+        if ((m_currentTick & ((Q_INT64_C(1) << levelShifts[1]) - 1)) == 0) {
+            cascade(1, (m_currentTick >> levelShifts[1]) & (slotCounts[1] - 1));
+        }
+
+        QSet<MqttServerClient*> &slot = m_slots[0][m_currentTick & (slotCounts[0] - 1)];
+        foreach (MqttServerClient *client, slot) {
+            m_entries.remove(client);
+            expired.append(client);
+        }
+        slot.clear();
+
+        if (m_entries.isEmpty()) {
+            m_currentTick = targetTick;
+        }
+    }
+    return expired;
+}
+
+void MqttTimerWheel::insert(MqttServerClient *client, qint64 tick)
+{
+    // Cascaded entries may be due in the current tick, whose slot is processed right after cascading
+    if (tick - m_currentTick >= wheelSpan) {
+        tick = m_currentTick + wheelSpan - 1;
+    }
+
+    const qint64 delta = tick - m_currentTick;
+    int level = 0;
+    if (delta >= (Q_INT64_C(1) << levelShifts[2])) {
+        level = 2;
+    } else if (delta >= (Q_INT64_C(1) << levelShifts[1])) {
+        level = 1;
+    }
+
+    Entry entry;
+    entry.tick = tick;
+    entry.level = level;
+    entry.slot = (tick >> levelShifts[level]) & (slotCounts[level] - 1);
+    m_slots[level][entry.slot].insert(client);
+    m_entries.insert(client, entry);
+}
+
+void MqttTimerWheel::cascade(int level, int slot)
+{
+    QSet<MqttServerClient*> entries;
+    entries.swap(m_slots[level][slot]);
+    foreach (MqttServerClient *client, entries) {
+        insert(client, m_entries.take(client).tick);
+    }
+}
@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* nymea-mqtt
+* MQTT library for nymea
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public License
+* as published by the Free Software Foundation, either version 3
+* of the License, or (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef MQTTTIMERWHEEL_H
+#define MQTTTIMERWHEEL_H
+
+#include <QHash>
+#include <QList>
+#include <QSet>
+#include <QVector>
+
+class MqttServerClient;
+
+// Tracks one deadline per connection with a single hierarchical timer wheel instead of a timer per connection.
+// Scheduling and cancelling take constant time. Deadlines are rounded up to whole ticks and expire in batches
+// when the wheel is advanced. Three levels of 256, 64 and 64 slots cover 2^20 ticks, later deadlines are
+// clamped to that and expire early, callers are expected to check and schedule them again.
+class MqttTimerWheel
+{
+public:
+    explicit MqttTimerWheel(qint64 tickLength = 100);
+
+    qint64 tickLength() const;
+
+    // Times are milliseconds on the caller's monotonic clock. Replaces a previously scheduled deadline.
+    void schedule(MqttServerClient *client, qint64 deadline);
+    void cancel(MqttServerClient *client);
+    bool contains(MqttServerClient *client) const;
+
+    int count() const;
+    bool isEmpty() const;
+
+    // Moves the wheel forward to the given time and returns the connections whose deadlines have passed,
+    // which are not scheduled anymore afterwards
+    QList<MqttServerClient*> advance(qint64 now);
+
+private:
+    void insert(MqttServerClient *client, qint64 tick);
+    void cascade(int level, int slot);
+
+    struct Entry {
+        qint64 tick = 0;
+        int level = 0;
+        int slot = 0;
+    };
+
+    qint64 m_tickLength = 100;
+    qint64 m_currentTick = 0;
+    QVector<QSet<MqttServerClient*> > m_slots[3];
+    QHash<MqttServerClient*, Entry> m_entries;
+};
+
+#endif // MQTTTIMERWHEEL_H
@@ -38,10 +38,53 @@ MqttServerClient::MqttServerClient(QObject *parent):
 
 }
 
+int MqttServerClient::serverAddressId() const
+{
+    return m_serverAddressId;
+}
+
+void MqttServerClient::setServerAddressId(int serverAddressId)
+{
+    m_serverAddressId = serverAddressId;
+}
+
+quint64 MqttServerClient::admissionTicket() const
+{
+    return m_admissionTicket;
+}
+
+void MqttServerClient::setAdmissionTicket(quint64 admissionTicket)
+{
+    m_admissionTicket = admissionTicket;
+}
+
+MqttInputBuffer &MqttServerClient::inputBuffer()
+{
+    return m_inputBuffer;
+}
+
+MqttPackets &MqttServerClient::receivedPackets()
+{
+    return m_receivedPackets;
+}
+
+MqttOutputQueue &MqttServerClient::outputQueue()
+{
+    return m_outputQueue;
+}
+
 MqttServerTransport::MqttServerTransport(QObject *parent):
     QObject(parent)
 {
 
 }
 
+MqttAdmissionControl *MqttServerTransport::admissionControl() const
+{
+    return m_admissionControl;
+}
 
+void MqttServerTransport::setAdmissionControl(MqttAdmissionControl *admissionControl)
+{
+    m_admissionControl = admissionControl;
+}
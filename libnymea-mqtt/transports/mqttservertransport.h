@@ -31,7 +31,12 @@
 #include <QObject>
 #include <QSslConfiguration>
 
+#include "../mqttinputbuffer.h"
+#include "../mqttoutputqueue.h"
+#include "../mqttpacket.h"
+
 class QTcpServer;
+class MqttAdmissionControl;
 
 class MqttServerClient: public QObject
 {
@@ -46,10 +51,43 @@ public:
     virtual void flush() = 0;
     virtual void close() = 0;
     virtual QHostAddress peerAddress() const = 0;
+    // Data written but not sent to the peer yet
+    virtual qint64 bytesToWrite() const = 0;
+    // While paused, no dataAvailable() is emitted and the connection stops reading from the network,
+    // throttling the peer by flow control. Data received in the meantime is delivered when resumed.
+    virtual void setReadingPaused(bool paused) = 0;
+
+    // The ID of the server address this connection has been accepted on
+    int serverAddressId() const;
+    void setServerAddressId(int serverAddressId);
+
+    // Identifies the connection to the admission control until its handshake has finished, 0 if there is none
+    quint64 admissionTicket() const;
+    void setAdmissionTicket(quint64 admissionTicket);
+
+    // Data received from this connection which has not been parsed yet
+    MqttInputBuffer &inputBuffer();
+    // Packets which have been parsed by the connection itself, off the server's thread, and wait to be processed
+    MqttPackets &receivedPackets();
+    // Packets waiting until the connection's write buffer has room for them
+    MqttOutputQueue &outputQueue();
 
 signals:
     void dataAvailable(const QByteArray &data);
+    // Emitted instead of dataAvailable() by connections parsing their data themselves. The packets parsed from the
+    // received bytes have been added to receivedPackets().
+    void packetsAvailable(qint64 bytes);
+    // Emitted instead of dataAvailable() by connections parsing their data themselves if the data is not valid MQTT
+    void parseError();
+    void bytesWritten(qint64 bytes);
     void disconnected();
+
+private:
+    int m_serverAddressId = -1;
+    quint64 m_admissionTicket = 0;
+    MqttInputBuffer m_inputBuffer;
+    MqttPackets m_receivedPackets;
+    MqttOutputQueue m_outputQueue;
 };
 
 class MqttServerTransport : public QObject
@@ -64,9 +102,19 @@ public:
     virtual QHostAddress serverAddress() const = 0;
     virtual int serverPort() const = 0;
     virtual void close() = 0;
+    // New connections wait in the network stack's backlog while accepting is paused
+    virtual void pauseAccepting() = 0;
+    virtual void resumeAccepting() = 0;
+
+    // New connections are only handshaked once admitted. Without admission control, handshakes start right away.
+    MqttAdmissionControl *admissionControl() const;
+    virtual void setAdmissionControl(MqttAdmissionControl *admissionControl);
 
 signals:
     void clientConnected(MqttServerClient *client);
+
+private:
+    MqttAdmissionControl *m_admissionControl = nullptr;
 };
 
 
@@ -26,8 +26,11 @@
 * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
 #include "mqtttcpservertransport.h"
+#include "../mqttadmissioncontrol.h"
 
 #include <QLoggingCategory>
+#include <QTimer>
+#include <QPointer>
 
 Q_DECLARE_LOGGING_CATEGORY(dbgServer)
 
@@ -39,13 +42,25 @@ SslServer::SslServer(const QSslConfiguration &config, QObject *parent):
 
 }
 
+void SslServer::setAdmissionControl(MqttAdmissionControl *admissionControl)
+{
+    m_admissionControl = admissionControl;
+}
+
+quint64 SslServer::releaseSocket(QSslSocket *socket)
+{
+    disconnect(socket, nullptr, this, nullptr);
+    delete m_handshakeTimers.take(socket);
+    return m_admissionTickets.take(socket);
+}
+
 void SslServer::incomingConnection(qintptr socketDescriptor)
 {
     QSslSocket *sslSocket = new QSslSocket(this);
 
     qCDebug(dbgServer) << "New client socket connection:" << sslSocket;
 
-    connect(sslSocket, &QSslSocket::encrypted, [this, sslSocket](){ emit clientConnected(sslSocket); });
+    connect(sslSocket, &QSslSocket::encrypted, this, [this, sslSocket](){ emit clientConnected(sslSocket); });
     connect(sslSocket, &QSslSocket::disconnected, this, &SslServer::onClientDisconnected);
 
     if (!sslSocket->setSocketDescriptor(socketDescriptor)) {
@@ -53,33 +68,80 @@ void SslServer::incomingConnection(qintptr socketDescriptor)
         delete sslSocket;
         return;
     }
-    if (!m_config.isNull()) {
-        sslSocket->setSslConfiguration(m_config);
-        sslSocket->startServerEncryption();
-    } else {
-        emit clientConnected(sslSocket);
+
+    if (!m_admissionControl) {
+        startHandshake(sslSocket);
+        return;
+    }
+
+    quint64 ticket = m_admissionControl->accept(sslSocket->peerAddress());
+    if (ticket == 0) {
+        disconnect(sslSocket, nullptr, this, nullptr);
+        sslSocket->abort();
+        sslSocket->deleteLater();
+        return;
     }
+    m_admissionTickets.insert(sslSocket, ticket);
+
+    // The socket may be gone by the time it is admitted
+    QPointer<SslServer> server(this);
+    QPointer<QSslSocket> socket(sslSocket);
+    m_admissionControl->requestHandshake(ticket, [server, socket](){
+        if (server && socket) {
+            server->startHandshake(socket);
+        }
+    });
 }
 
 void SslServer::onClientDisconnected()
 {
     QSslSocket *socket = static_cast<QSslSocket*>(sender());
     qCDebug(dbgServer) << "Client socket disconnected:" << socket;
+    delete m_handshakeTimers.take(socket);
+    quint64 ticket = m_admissionTickets.take(socket);
+    if (m_admissionControl) {
+        m_admissionControl->finish(ticket, false);
+    }
     emit clientDisconnected(socket);
     socket->deleteLater();
 }
 
+void SslServer::startHandshake(QSslSocket *socket)
+{
+    if (m_config.isNull()) {
+        emit clientConnected(socket);
+        return;
+    }
+
+    // Stalled handshakes must not hold on to their admission
+    QTimer *handshakeTimer = new QTimer(this);
+    handshakeTimer->setSingleShot(true);
+    connect(handshakeTimer, &QTimer::timeout, socket, [socket](){
+        qCWarning(dbgServer) << "TLS handshake not finished in 10 seconds. Dropping connection from" << socket->peerAddress();
+        socket->abort();
+    });
+    handshakeTimer->start(10000);
+    m_handshakeTimers.insert(socket, handshakeTimer);
+
+    socket->setSslConfiguration(m_config);
+    socket->startServerEncryption();
+}
+
 MqttTcpServerClient::MqttTcpServerClient(QTcpSocket *socket, QObject *parent):
     MqttServerClient(parent),
     m_socket(socket)
 {
     m_socket->setParent(this);
     connect(socket, &QTcpSocket::readyRead, this, &MqttTcpServerClient::onSocketReadyRead);
+    connect(socket, &QTcpSocket::bytesWritten, this, &MqttServerClient::bytesWritten);
     connect(socket, &QTcpSocket::disconnected, this, &MqttTcpServerClient::disconnected);
 }
 
 void MqttTcpServerClient::onSocketReadyRead()
 {
+    if (m_readingPaused) {
+        return;
+    }
     emit dataAvailable(m_socket->readAll());
 }
 
@@ -114,6 +176,25 @@ QHostAddress MqttTcpServerClient::peerAddress() const
     return m_socket->peerAddress();
 }
 
+qint64 MqttTcpServerClient::bytesToWrite() const
+{
+    return m_socket->bytesToWrite();
+}
+
+void MqttTcpServerClient::setReadingPaused(bool paused)
+{
+    if (m_readingPaused == paused) {
+        return;
+    }
+    m_readingPaused = paused;
+    // With a limited read buffer the socket stops reading from the network once it is full
+    m_socket->setReadBufferSize(paused ? 64 * 1024 : 0);
+    if (!paused && m_socket->bytesAvailable() > 0) {
+        // No readyRead() for data which has been buffered already
+        QTimer::singleShot(0, this, &MqttTcpServerClient::onSocketReadyRead);
+    }
+}
+
 MqttTcpServerTransport::MqttTcpServerTransport(const QSslConfiguration &config, QObject *parent):
     MqttServerTransport(parent),
     m_sslServer(new SslServer(config, this))
@@ -146,8 +227,28 @@ void MqttTcpServerTransport::close()
     return m_sslServer->close();
 }
 
-void MqttTcpServerTransport::onClientConnected(QTcpSocket *socket)
+void MqttTcpServerTransport::pauseAccepting()
+{
+    m_sslServer->pauseAccepting();
+}
+
+void MqttTcpServerTransport::resumeAccepting()
+{
+    m_sslServer->resumeAccepting();
+}
+
+void MqttTcpServerTransport::setAdmissionControl(MqttAdmissionControl *admissionControl)
+{
+    MqttServerTransport::setAdmissionControl(admissionControl);
+    m_sslServer->setAdmissionControl(admissionControl);
+}
+
+void MqttTcpServerTransport::onClientConnected(QSslSocket *socket)
 {
+    // The client takes over the socket, including its deletion. The client might be moved to another
+    // thread, so the SslServer must not touch the socket anymore.
+    quint64 admissionTicket = m_sslServer->releaseSocket(socket);
     MqttTcpServerClient *client = new MqttTcpServerClient(socket, this);
+    client->setAdmissionTicket(admissionTicket);
     emit clientConnected(client);
 }
@@ -32,6 +32,10 @@
 
 #include <QObject>
 #include <QTcpServer>
+#include <QSslSocket>
+#include <QHash>
+
+class QTimer;
 
 class SslServer: public QTcpServer
 {
@@ -39,6 +43,10 @@ class SslServer: public QTcpServer
 public:
     SslServer(const QSslConfiguration &config, QObject *parent = nullptr);
 
+    void setAdmissionControl(MqttAdmissionControl *admissionControl);
+    // Stops watching a socket handed over by clientConnected(), returns its admission ticket
+    quint64 releaseSocket(QSslSocket *socket);
+
 signals:
     void clientConnected(QSslSocket *socket);
     void clientDisconnected(QSslSocket *socket);
@@ -51,7 +59,12 @@ private slots:
     void onClientDisconnected();
 
 private:
+    void startHandshake(QSslSocket *socket);
+
     QSslConfiguration m_config;
+    MqttAdmissionControl *m_admissionControl = nullptr;
+    QHash<QSslSocket*, quint64> m_admissionTickets;
+    QHash<QSslSocket*, QTimer*> m_handshakeTimers;
 };
 
 class MqttTcpServerClient: public MqttServerClient
@@ -66,12 +79,15 @@ public:
     void flush() override;
     void close() override;
     QHostAddress peerAddress() const override;
+    qint64 bytesToWrite() const override;
+    void setReadingPaused(bool paused) override;
 
 private slots:
     void onSocketReadyRead();
 
 private:
     QTcpSocket *m_socket = nullptr;
+    bool m_readingPaused = false;
 };
 
 class MqttTcpServerTransport: public MqttServerTransport
@@ -85,9 +101,13 @@ public:
     QHostAddress serverAddress() const override;
     int serverPort() const override;
     void close() override;
+    void pauseAccepting() override;
+    void resumeAccepting() override;
+
+    void setAdmissionControl(MqttAdmissionControl *admissionControl) override;
 
 private slots:
-    void onClientConnected(QTcpSocket *socket);
+    void onClientConnected(QSslSocket *socket);
 
 private:
     SslServer *m_sslServer = nullptr;
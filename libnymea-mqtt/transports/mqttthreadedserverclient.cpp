@@ -0,0 +1,198 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* nymea-mqtt
+* MQTT library for nymea
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public License
+* as published by the Free Software Foundation, either version 3
+* of the License, or (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "mqttthreadedserverclient.h"
+
+#include <QThread>
+#include <QLoggingCategory>
+
+Q_DECLARE_LOGGING_CATEGORY(dbgServer)
+
+MqttThreadedPacketReader::MqttThreadedPacketReader(const QHostAddress &peerAddress, quint32 maximumPacketSize, QObject *parent):
+    QObject(parent),
+    m_peerAddress(peerAddress),
+    m_maximumPacketSize(maximumPacketSize)
+{
+
+}
+
+void MqttThreadedPacketReader::setMaximumPacketSize(quint32 maximumPacketSize)
+{
+    m_maximumPacketSize = maximumPacketSize;
+}
+
+void MqttThreadedPacketReader::onDataAvailable(const QByteArray &data)
+{
+    if (m_failed) {
+        // The server is dropping the connection already
+        return;
+    }
+
+    m_inputBuffer.append(data);
+    MqttPackets packets;
+    while (!m_inputBuffer.isEmpty()) {
+        const qint64 packetLength = MqttPacket::packetLength(m_inputBuffer.data(), m_inputBuffer.size());
+        if (packetLength > m_maximumPacketSize) {
+            qCWarning(dbgServer) << "Client announced a packet of" << packetLength << "bytes, exceeding the maximum packet size of" << m_maximumPacketSize << "bytes. Dropping connection from" << m_peerAddress;
+            m_failed = true;
+            break;
+        }
+
+        MqttPacket packet;
+        const int ret = packet.parse(m_inputBuffer.data(), m_inputBuffer.size());
+        if (ret == 0) {
+            break;
+        }
+        if (ret == -1) {
+            qCWarning(dbgServer) << "Bad MQTT packet data, Dropping connection from" << m_peerAddress;
+            m_failed = true;
+            break;
+        }
+        m_inputBuffer.consume(ret);
+        packets.append(packet);
+    }
+
+    // The packets before the invalid data are still processed, like on the server's thread
+    emit packetsAvailable(packets, data.size());
+    if (m_failed) {
+        m_inputBuffer.clear();
+        emit parseError();
+    }
+}
+
+MqttThreadedServerClient::MqttThreadedServerClient(MqttServerClient *client, QThread *thread, quint32 maximumPacketSize, QObject *parent):
+    MqttServerClient(parent),
+    m_client(client),
+    m_peerAddress(client->peerAddress()),
+    m_open(client->isOpen())
+{
+    setAdmissionTicket(client->admissionTicket());
+
+    // Owned by the connection so it moves to the worker thread along with it and is parsing right where the data arrives
+    m_client->setParent(nullptr);
+    m_reader = new MqttThreadedPacketReader(m_peerAddress, maximumPacketSize, m_client);
+    connect(m_client, &MqttServerClient::dataAvailable, m_reader, &MqttThreadedPacketReader::onDataAvailable);
+
+    // Signals from the worker thread are queued to this thread
+    connect(m_reader, &MqttThreadedPacketReader::packetsAvailable, this, &MqttThreadedServerClient::onPacketsAvailable);
+    connect(m_reader, &MqttThreadedPacketReader::parseError, this, &MqttThreadedServerClient::onParseError);
+    connect(m_client, &MqttServerClient::bytesWritten, this, &MqttThreadedServerClient::onBytesWritten);
+    connect(m_client, &MqttServerClient::disconnected, this, &MqttThreadedServerClient::onDisconnected);
+
+    m_client->moveToThread(thread);
+}
+
+MqttThreadedServerClient::~MqttThreadedServerClient()
+{
+    m_client->deleteLater();
+}
+
+bool MqttThreadedServerClient::write(const QByteArray &data)
+{
+    if (!m_open) {
+        return false;
+    }
+    m_bytesToWrite += data.size();
+    MqttServerClient *client = m_client;
+    QMetaObject::invokeMethod(m_client, [client, data](){ client->write(data); }, Qt::QueuedConnection);
+    return true;
+}
+
+void MqttThreadedServerClient::abort()
+{
+    m_open = false;
+    MqttServerClient *client = m_client;
+    QMetaObject::invokeMethod(m_client, [client](){ client->abort(); }, Qt::QueuedConnection);
+}
+
+bool MqttThreadedServerClient::isOpen() const
+{
+    return m_open;
+}
+
+void MqttThreadedServerClient::flush()
+{
+    MqttServerClient *client = m_client;
+    QMetaObject::invokeMethod(m_client, [client](){ client->flush(); }, Qt::QueuedConnection);
+}
+
+void MqttThreadedServerClient::close()
+{
+    m_open = false;
+    MqttServerClient *client = m_client;
+    QMetaObject::invokeMethod(m_client, [client](){ client->close(); }, Qt::QueuedConnection);
+}
+
+QHostAddress MqttThreadedServerClient::peerAddress() const
+{
+    return m_peerAddress;
+}
+
+qint64 MqttThreadedServerClient::bytesToWrite() const
+{
+    return m_bytesToWrite;
+}
+
+void MqttThreadedServerClient::setReadingPaused(bool paused)
+{
+    MqttServerClient *client = m_client;
+    QMetaObject::invokeMethod(m_client, [client, paused](){ client->setReadingPaused(paused); }, Qt::QueuedConnection);
+}
+
+void MqttThreadedServerClient::setMaximumPacketSize(quint32 maximumPacketSize)
+{
+    MqttThreadedPacketReader *reader = m_reader;
+    QMetaObject::invokeMethod(m_reader, [reader, maximumPacketSize](){ reader->setMaximumPacketSize(maximumPacketSize); }, Qt::QueuedConnection);
+}
+
+void MqttThreadedServerClient::onPacketsAvailable(const MqttPackets &packets, qint64 bytes)
+{
+    // Packets may still be queued up when the server has closed the connection already
+    if (m_open) {
+        receivedPackets().append(packets);
+        emit packetsAvailable(bytes);
+    }
+}
+
+void MqttThreadedServerClient::onParseError()
+{
+    if (m_open) {
+        emit parseError();
+    }
+}
+
+void MqttThreadedServerClient::onBytesWritten(qint64 bytes)
+{
+    m_bytesToWrite = qMax(Q_INT64_C(0), m_bytesToWrite - bytes);
+    emit bytesWritten(bytes);
+}
+
+void MqttThreadedServerClient::onDisconnected()
+{
+    m_open = false;
+    emit disconnected();
+}
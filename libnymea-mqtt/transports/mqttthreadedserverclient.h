@@ -0,0 +1,100 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* nymea-mqtt
+* MQTT library for nymea
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public License
+* as published by the Free Software Foundation, either version 3
+* of the License, or (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef MQTTTHREADEDSERVERCLIENT_H
+#define MQTTTHREADEDSERVERCLIENT_H
+
+#include "mqttservertransport.h"
+#include "../mqttpacket.h"
+
+#include <QHostAddress>
+
+class QThread;
+
+// Frames and parses the data of a connection in the connection's worker thread and hands the
+// complete packets over to the server's thread.
+class MqttThreadedPacketReader: public QObject
+{
+    Q_OBJECT
+public:
+    explicit MqttThreadedPacketReader(const QHostAddress &peerAddress, quint32 maximumPacketSize, QObject *parent = nullptr);
+
+    void setMaximumPacketSize(quint32 maximumPacketSize);
+
+public slots:
+    void onDataAvailable(const QByteArray &data);
+
+signals:
+    // bytes is the amount of data received, the packets may be empty if no packet has been completed by it
+    void packetsAvailable(const MqttPackets &packets, qint64 bytes);
+    void parseError();
+
+private:
+    QHostAddress m_peerAddress;
+    quint32 m_maximumPacketSize = 0;
+    MqttInputBuffer m_inputBuffer;
+    bool m_failed = false;
+};
+
+// Moves a client connection to a worker thread, so that reading, writing, encryption and parsing
+// don't block the server's thread. The server talks to this proxy only, which queues all calls to
+// the connection's thread and relays the parsed packets back.
+class MqttThreadedServerClient: public MqttServerClient
+{
+    Q_OBJECT
+public:
+    explicit MqttThreadedServerClient(MqttServerClient *client, QThread *thread, quint32 maximumPacketSize, QObject *parent = nullptr);
+    ~MqttThreadedServerClient() override;
+
+    bool write(const QByteArray &data) override;
+    void abort() override;
+    bool isOpen() const override;
+    void flush() override;
+    void close() override;
+    QHostAddress peerAddress() const override;
+    qint64 bytesToWrite() const override;
+    void setReadingPaused(bool paused) override;
+
+    // Applies to data arriving after the change has reached the connection's thread
+    void setMaximumPacketSize(quint32 maximumPacketSize);
+
+private slots:
+    void onPacketsAvailable(const MqttPackets &packets, qint64 bytes);
+    void onParseError();
+    void onBytesWritten(qint64 bytes);
+    void onDisconnected();
+
+private:
+    MqttServerClient *m_client = nullptr;
+    MqttThreadedPacketReader *m_reader = nullptr;
+    QHostAddress m_peerAddress;
+    bool m_open = false;
+    // Counted here, the connection's own counter can't be read from this thread
+    qint64 m_bytesToWrite = 0;
+};
+
+#endif // MQTTTHREADEDSERVERCLIENT_H
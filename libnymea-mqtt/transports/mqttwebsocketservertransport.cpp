@@ -26,9 +26,12 @@
 * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
 #include "mqttwebsocketservertransport.h"
+#include "../mqttadmissioncontrol.h"
 
 #include <QWebSocket>
 #include <QLoggingCategory>
+#include <QTimer>
+#include <QPointer>
 
 Q_DECLARE_LOGGING_CATEGORY(dbgServer)
 
@@ -39,6 +42,7 @@ MqttWebSocketServerClient::MqttWebSocketServerClient(QWebSocket *socket, QObject
     m_socket->setParent(this);
     connect(m_socket, &QWebSocket::textMessageReceived, this, &MqttWebSocketServerClient::onTextMessageReceived);
     connect(m_socket, &QWebSocket::binaryMessageReceived, this, &MqttWebSocketServerClient::onBinaryMessageReceived);
+    connect(m_socket, &QWebSocket::bytesWritten, this, &MqttServerClient::bytesWritten);
     connect(m_socket, &QWebSocket::disconnected, this, &MqttServerClient::disconnected);
 }
 
@@ -73,6 +77,25 @@ QHostAddress MqttWebSocketServerClient::peerAddress() const
     return m_socket->peerAddress();
 }
 
+qint64 MqttWebSocketServerClient::bytesToWrite() const
+{
+    return m_socket->bytesToWrite();
+}
+
+void MqttWebSocketServerClient::setReadingPaused(bool paused)
+{
+    if (m_readingPaused == paused) {
+        return;
+    }
+    m_readingPaused = paused;
+    // Frames which are on the way already are still decoded and held back in m_pausedMessages,
+    // the limited read buffer stops the socket from reading more from the network.
+    m_socket->setReadBufferSize(paused ? 64 * 1024 : 0);
+    if (!paused && !m_pausedMessages.isEmpty()) {
+        QTimer::singleShot(0, this, &MqttWebSocketServerClient::deliverPausedMessages);
+    }
+}
+
 void MqttWebSocketServerClient::onTextMessageReceived(const QString &message)
 {
     qCWarning(dbgServer).nospace() << "WebSocket received a text message from " << peerAddress() << ": " << message << ". This is not valid. Closing connection.";
@@ -81,9 +104,20 @@ void MqttWebSocketServerClient::onTextMessageReceived(const QString &message)
 
 void MqttWebSocketServerClient::onBinaryMessageReceived(const QByteArray &data)
 {
+    if (m_readingPaused) {
+        m_pausedMessages.append(data);
+        return;
+    }
     emit dataAvailable(data);
 }
 
+void MqttWebSocketServerClient::deliverPausedMessages()
+{
+    while (!m_readingPaused && !m_pausedMessages.isEmpty()) {
+        emit dataAvailable(m_pausedMessages.takeFirst());
+    }
+}
+
 MqttWebSocketServerTransport::MqttWebSocketServerTransport(const QSslConfiguration &sslConfiguration, QObject *parent):
     MqttServerTransport(parent)
 {
@@ -121,6 +155,16 @@ void MqttWebSocketServerTransport::close()
     m_server->close();
 }
 
+void MqttWebSocketServerTransport::pauseAccepting()
+{
+    m_server->pauseAccepting();
+}
+
+void MqttWebSocketServerTransport::resumeAccepting()
+{
+    m_server->resumeAccepting();
+}
+
 void MqttWebSocketServerTransport::onNewConnection()
 {
     QWebSocket *webSocket = m_server->nextPendingConnection();
@@ -129,6 +173,43 @@ void MqttWebSocketServerTransport::onNewConnection()
         return;
     }
     MqttWebSocketServerClient *client = new MqttWebSocketServerClient(webSocket, this);
-    emit clientConnected(client);
+
+    MqttAdmissionControl *admission = admissionControl();
+    if (!admission) {
+        emit clientConnected(client);
+        return;
+    }
+
+    // The WebSocket and TLS handshakes are done by QWebSocketServer already, admission covers the MQTT handshake
+    quint64 ticket = admission->accept(client->peerAddress());
+    if (ticket == 0) {
+        client->abort();
+        client->deleteLater();
+        return;
+    }
+    client->setAdmissionTicket(ticket);
+
+    // Messages received while waiting for admission are held back until then
+    client->setReadingPaused(true);
+    connect(client, &MqttServerClient::disconnected, this, &MqttWebSocketServerTransport::onQueuedClientDisconnected);
+
+    QPointer<MqttWebSocketServerTransport> transport(this);
+    QPointer<MqttWebSocketServerClient> queuedClient(client);
+    admission->requestHandshake(ticket, [transport, queuedClient](){
+        if (!transport || !queuedClient) {
+            return;
+        }
+        disconnect(queuedClient, &MqttServerClient::disconnected, transport, &MqttWebSocketServerTransport::onQueuedClientDisconnected);
+        queuedClient->setReadingPaused(false);
+        emit transport->clientConnected(queuedClient);
+    });
+}
+
+void MqttWebSocketServerTransport::onQueuedClientDisconnected()
+{
+    MqttServerClient *client = static_cast<MqttServerClient*>(sender());
+    qCDebug(dbgServer) << "Connection waiting for admission closed by" << client->peerAddress();
+    admissionControl()->finish(client->admissionTicket(), false);
+    client->deleteLater();
 }
 
@@ -44,13 +44,18 @@ public:
     void flush() override;
     void close() override;
     QHostAddress peerAddress() const override;
+    qint64 bytesToWrite() const override;
+    void setReadingPaused(bool paused) override;
 
 private slots:
     void onTextMessageReceived(const QString &message);
     void onBinaryMessageReceived(const QByteArray &data);
+    void deliverPausedMessages();
 
 private:
     QWebSocket *m_socket = nullptr;
+    bool m_readingPaused = false;
+    QList<QByteArray> m_pausedMessages;
 
 };
 
@@ -65,11 +70,14 @@ public:
     QHostAddress serverAddress() const override;
     int serverPort() const override;
     void close() override;
+    void pauseAccepting() override;
+    void resumeAccepting() override;
 
 signals:
 
 private slots:
     void onNewConnection();
+    void onQueuedClientDisconnected();
 
 private:
     QWebSocketServer *m_server = nullptr;
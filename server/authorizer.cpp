@@ -23,72 +23,91 @@
 * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
 #include "authorizer.h"
+#include "passwordhash.h"
 
 #include <QFile>
+#include <QFileInfo>
+#include <QDir>
 #include <QSettings>
+#include <QCryptographicHash>
+#include <QFutureWatcher>
+#include <QtConcurrent>
 
 Authorizer::Authorizer(const QString &policyFile, QObject *parent):
     QObject{parent},
-    m_settingsFile(policyFile)
+    m_settingsFile(policyFile),
+    m_verificationSecret(PasswordHash::randomBytes(32))
 {
     if (QFile::exists(policyFile)) {
         qInfo() << "Using policy file:" << policyFile;
     }
 
+    loadPolicies();
+
+    // Changing the policies replaces the file, which drops it from the watcher. Watching the
+    // directory as well catches that, as well as the file being created later on.
+    connect(&m_watcher, &QFileSystemWatcher::fileChanged, this, &Authorizer::onPolicyFileChanged);
+    connect(&m_watcher, &QFileSystemWatcher::directoryChanged, this, &Authorizer::onPolicyFileChanged);
+    watchPolicyFile();
 }
 
-Mqtt::ConnectReturnCode Authorizer::authorizeConnect(int serverAddressId, const QString &clientId, const QString &username, const QString &password, const QHostAddress &peerAddress)
+void Authorizer::authorizeConnect(int serverAddressId, const QString &clientId, const QString &username, const QString &password, const QHostAddress &peerAddress, std::function<void(Mqtt::ConnectReturnCode)> result)
 {
     Q_UNUSED(serverAddressId)
     Q_UNUSED(peerAddress);
 
-    if (!QFile::exists(m_settingsFile)) {
-        return Mqtt::ConnectReturnCodeServerUnavailable;
+    if (!m_policyFileExists) {
+        result(Mqtt::ConnectReturnCodeServerUnavailable);
+        return;
     }
-    MqttPolicy policy = loadPolicy(clientId);
+    MqttPolicy policy = m_policies.value(clientId);
     if (!policy.isValid()) {
-        return Mqtt::ConnectReturnCodeNotAuthorized;
+        result(Mqtt::ConnectReturnCodeNotAuthorized);
+        return;
+    }
+    if (policy.username() != username) {
+        result(Mqtt::ConnectReturnCodeBadUsernameOrPassword);
+        return;
     }
-    if (policy.username() != username || policy.password() != password) {
-        return Mqtt::ConnectReturnCodeBadUsernameOrPassword;
+    // The stored password is part of the digest, so changing it invalidates the entry
+    const QByteArray digest = verificationDigest(policy, password);
+    if (m_verifiedPasswords.value(clientId) == digest) {
+        result(Mqtt::ConnectReturnCodeAccepted);
+        return;
     }
-    return Mqtt::ConnectReturnCodeAccepted;
+
+    const QString storedPassword = policy.password();
+    QFutureWatcher<bool> *watcher = new QFutureWatcher<bool>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher, clientId, username, storedPassword, digest, result](){
+        watcher->deleteLater();
+        // The policy may have changed while verifying, the client has to try again then
+        const MqttPolicy policy = m_policies.value(clientId);
+        if (!watcher->result() || policy.username() != username || policy.password() != storedPassword) {
+            result(Mqtt::ConnectReturnCodeBadUsernameOrPassword);
+            return;
+        }
+        m_verifiedPasswords.insert(clientId, digest);
+        result(Mqtt::ConnectReturnCodeAccepted);
+    });
+    watcher->setFuture(QtConcurrent::run([storedPassword, password](){
+        return PasswordHash::verify(storedPassword, password);
+    }));
 }
 
-bool Authorizer::authorizeSubscribe(int serverAddressId, const QString &clientId, const QString &topicFilter)
+void Authorizer::authorizeSubscribe(int serverAddressId, const QString &clientId, const QString &topicFilter, std::function<void(bool)> result)
 {
     Q_UNUSED(serverAddressId)
 
-    qCritical() << "sub filters" << topicFilter;
-    if (!QFile::exists(m_settingsFile)) {
-        return false;
-    }
-    MqttPolicy policy = loadPolicy(clientId);
-    if (!policy.isValid()) {
-        return false;
-    }
-    qCritical() << "policy" << policy.allowedSubscribeTopicFilters();
-    if (policy.allowedSubscribeTopicFilters().contains(topicFilter)) {
-        return true;
-    }
-    return false;
+    MqttPolicy policy = m_policies.value(clientId);
+    result(policy.isValid() && policy.allowsSubscribe(topicFilter));
 }
 
-bool Authorizer::authorizePublish(int serverAddressId, const QString &clientId, const QString &topic)
+void Authorizer::authorizePublish(int serverAddressId, const QString &clientId, const QString &topic, std::function<void(bool)> result)
 {
     Q_UNUSED(serverAddressId)
 
-    if (!QFile::exists(m_settingsFile)) {
-        return false;
-    }
-    MqttPolicy policy = loadPolicy(clientId);
-    if (!policy.isValid()) {
-        return false;
-    }
-    if (policy.allowedPublishTopicFilters().contains(topic)) {
-        return true;
-    }
-    return false;
+    MqttPolicy policy = m_policies.value(clientId);
+    result(policy.isValid() && policy.allowsPublish(topic));
 }
 
 void Authorizer::addPolicy(const QString &clientId, const QString &username, const QString &password, const QStringList &allowedSubscribeTopicFilters, const QStringList &allowedPublishTopicFilters)
@@ -96,28 +115,78 @@ void Authorizer::addPolicy(const QString &clientId, const QString &username, con
     QSettings settings(m_settingsFile, QSettings::IniFormat);
     settings.beginGroup(clientId);
     settings.setValue("username", username);
-    settings.setValue("password", password);
+    QString passwordHash = PasswordHash::create(password);
+    settings.setValue("password", passwordHash);
     settings.setValue("allowedSubscribeTopicFilters", allowedSubscribeTopicFilters);
     settings.setValue("allowedPublishTopicFilters", allowedPublishTopicFilters);
+    settings.sync();
+
+    m_policyFileExists = true;
+    m_policies.insert(clientId, MqttPolicy(clientId, username, passwordHash, allowedSubscribeTopicFilters, allowedPublishTopicFilters));
+    m_verifiedPasswords.remove(clientId);
+    invalidateAuthorizations();
 }
 
 void Authorizer::removePolicy(const QString &clientId)
 {
     QSettings settings(m_settingsFile, QSettings::IniFormat);
     settings.remove(clientId);
+    settings.sync();
+
+    m_policies.remove(clientId);
+    m_verifiedPasswords.remove(clientId);
+    invalidateAuthorizations();
 }
 
-MqttPolicy Authorizer::loadPolicy(const QString &clientId)
+QByteArray Authorizer::verificationDigest(const MqttPolicy &policy, const QString &password) const
 {
-    QSettings settings(m_settingsFile, QSettings::IniFormat);
-    if (!settings.childGroups().contains(clientId)) {
-        return MqttPolicy();
+    return QCryptographicHash::hash(m_verificationSecret + policy.password().toUtf8() + '\0' + password.toUtf8(), QCryptographicHash::Sha256);
+}
+
+void Authorizer::onPolicyFileChanged()
+{
+    loadPolicies();
+    watchPolicyFile();
+}
+
+void Authorizer::loadPolicies()
+{
+    invalidateAuthorizations();
+    const QHash<QString, MqttPolicy> previousPolicies = m_policies;
+    m_policies.clear();
+    m_policyFileExists = QFile::exists(m_settingsFile);
+    if (m_policyFileExists) {
+        QSettings settings(m_settingsFile, QSettings::IniFormat);
+        foreach (const QString &clientId, settings.childGroups()) {
+            settings.beginGroup(clientId);
+            MqttPolicy policy(clientId,
+                              settings.value("username").toString(),
+                              settings.value("password").toString(),
+                              settings.value("allowedSubscribeTopicFilters").toStringList(),
+                              settings.value("allowedPublishTopicFilters").toStringList());
+            if (!PasswordHash::isHash(policy.password())) {
+                qWarning() << "The policy for" << clientId << "contains a plain text password. Add the policy again to store a hash instead.";
+            }
+            m_policies.insert(clientId, policy);
+            settings.endGroup();
+        }
+    }
+
+    // Verified passwords of removed or changed policies are of no use any more
+    foreach (const QString &clientId, m_verifiedPasswords.keys()) {
+        if (!m_policies.contains(clientId) || m_policies.value(clientId).password() != previousPolicies.value(clientId).password()) {
+            m_verifiedPasswords.remove(clientId);
+        }
+    }
+}
+
+void Authorizer::watchPolicyFile()
+{
+    QString directory = QFileInfo(m_settingsFile).absolutePath();
+    if (QDir(directory).exists() && !m_watcher.directories().contains(directory)) {
+        m_watcher.addPath(directory);
+    }
+    if (QFile::exists(m_settingsFile) && !m_watcher.files().contains(m_settingsFile)) {
+        m_watcher.addPath(m_settingsFile);
     }
-    settings.beginGroup(clientId);
-    MqttPolicy policy(clientId,
-                      settings.value("username").toString(),
-                      settings.value("password").toString(),
-                      settings.value("allowedSubscribeTopicFilters").toStringList(),
-                      settings.value("allowedPublishTopicFilters").toStringList());
-    return policy;
 }
@@ -30,27 +30,47 @@
 #include <mqttserver.h>
 
 #include <QObject>
+#include <QHash>
+#include <QFileSystemWatcher>
 
 
-class Authorizer : public QObject, public MqttAuthorizer
+// Passwords which haven't been verified before are checked on a thread pool, as the key derivation is deliberately
+// slow. Everything else is decided right away.
+class Authorizer : public QObject, public MqttAsyncAuthorizer
 {
     Q_OBJECT
 public:
     explicit Authorizer(const QString &policyFile, QObject *parent = nullptr);
 
-    Mqtt::ConnectReturnCode authorizeConnect(int serverAddressId, const QString &clientId, const QString &username, const QString &password, const QHostAddress &peerAddress) override;
-    bool authorizeSubscribe(int serverAddressId, const QString &clientId, const QString &topicFilter) override;
-    bool authorizePublish(int serverAddressId, const QString &clientId, const QString &topic) override;
+    void authorizeConnect(int serverAddressId, const QString &clientId, const QString &username, const QString &password, const QHostAddress &peerAddress, std::function<void(Mqtt::ConnectReturnCode)> result) override;
+    void authorizeSubscribe(int serverAddressId, const QString &clientId, const QString &topicFilter, std::function<void(bool)> result) override;
+    void authorizePublish(int serverAddressId, const QString &clientId, const QString &topic, std::function<void(bool)> result) override;
 
     void addPolicy(const QString &clientId, const QString &username, const QString &password, const QStringList &allowedSubscribeTopicFilters, const QStringList &allowedPublishTopicFilters);
     void removePolicy(const QString &clientId);
 
+private slots:
+    void onPolicyFileChanged();
+
 private:
-    MqttPolicy loadPolicy(const QString &clientId);
+    void loadPolicies();
+    void watchPolicyFile();
+    QByteArray verificationDigest(const MqttPolicy &policy, const QString &password) const;
 
 private:
     QString m_settingsFile;
 
+    // All policies of the policy file, reloaded whenever the file changes, so that checking a
+    // connect, subscribe or publish never has to read the file.
+    bool m_policyFileExists = false;
+    QHash<QString, MqttPolicy> m_policies;
+    QFileSystemWatcher m_watcher;
+
+    // Digests of verified passwords by client ID, salted with a random secret. Spares reconnecting clients the key
+    // derivation. There is one entry per policy at most, it is dropped when the policy is removed or changed.
+    QByteArray m_verificationSecret;
+    QHash<QString, QByteArray> m_verifiedPasswords;
+
 };
 
 #endif // AUTHORIZER_H
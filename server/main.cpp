@@ -25,12 +25,14 @@
 #include "mqttserver.h"
 #include "authorizer.h"
 #include "certificateloader.h"
+#include "metricsserver.h"
 
 #include <QCoreApplication>
 #include <QCommandLineParser>
 #include <QStandardPaths>
 #include <QSettings>
 #include <iostream>
+#include <limits>
 
 int main(int argc, char *argv[])
 {
@@ -40,6 +42,8 @@ int main(int argc, char *argv[])
     QString defaultPolicyFile = QStandardPaths::writableLocation(QStandardPaths::ConfigLocation) + "/nymea/mqttpolicies.conf";
     quint16 defaultTcpPort = 1883;
     quint16 defaultWsPort = 0;
+    quint16 defaultMetricsPort = 0;
+    int defaultSysInterval = 0;
     bool useSslDefault = false;
     QString defaultCertKeyFileName = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/certs/certificate.key";
     QString defaultCertFileName = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/certs/certificate.crt";
@@ -51,6 +55,8 @@ int main(int argc, char *argv[])
           {{"insecure", "i"}, "Run in insecure mode (allow all connections, publishes and subscribes)"},
           {{"tcp-port", "t"}, QString("The port for the TCP server (default: %1, 0 to disable)").arg(defaultTcpPort), "port", QString::number(defaultTcpPort)},
           {{"ws-port", "w"}, "The port for the web socket server (default: disabled)", "port", QString::number(defaultWsPort)},
+          {{"metrics-port", "m"}, "The port for serving Prometheus metrics on localhost (default: disabled)", "port", QString::number(defaultMetricsPort)},
+          {{"sys-interval", "s"}, "The interval for publishing broker statistics to $SYS/broker/ topics (default: disabled)", "seconds", QString::number(defaultSysInterval)},
           {{"add-policy", "a"}, "Add a new client policy"},
           {{"remove-policy", "r"}, "Remove a client policy", "clientId"},
           {{"ssl", "S"}, "Enable SSL encryption (default: disabled)"},
@@ -62,7 +68,8 @@ int main(int argc, char *argv[])
                                      "For example:\n\ntcp-port=1883\nssl=true\n\n"
                                      "Note that any passed command line arguments will still override any values set in the configuration file.\n\n"
                                      "Enabling SSL requires an SSL ertificate which can be configured with the certificate and certificate-key options. If no certificate is found in the given locations, a new self-signed certificate will be generated.\n\n"
-                                     "Invoking the application with \"add-policy\" or \"remove-policy\" will allow changing the policies at run time, no broker restart is required. However, existing clients won't be disconnected immediately when a policy is removed but subsequent connect, subscribe or publish operations will be blocked.");
+                                     "Invoking the application with \"add-policy\" or \"remove-policy\" will allow changing the policies at run time, no broker restart is required. However, existing clients won't be disconnected immediately when a policy is removed but subsequent connect, subscribe or publish operations will be blocked.\n\n"
+                                     "Topic filters in policies may use the + and # wildcards. %c and %u are replaced with the client ID and username, for example devices/%c/#.");
     parser.addHelpOption();
 
     parser.process(a.arguments());
@@ -73,6 +80,8 @@ int main(int argc, char *argv[])
     bool insecure = parser.isSet("insecure") ? true : settings.value("insecure", false).toBool();
     quint16 tcpPort = parser.isSet("tcp-port") ? parser.value("tcp-port").toUInt() : settings.value("tcp-port", defaultTcpPort).toUInt();
     quint16 wsPort = parser.isSet("ws-port") ? parser.value("ws-port").toUInt() : settings.value("ws-port", defaultWsPort).toUInt();
+    quint16 metricsPort = parser.isSet("metrics-port") ? parser.value("metrics-port").toUInt() : settings.value("metrics-port", defaultMetricsPort).toUInt();
+    int sysInterval = parser.isSet("sys-interval") ? parser.value("sys-interval").toInt() : settings.value("sys-interval", defaultSysInterval).toInt();
     bool useSsl = parser.isSet("ssl") || settings.value("ssl", useSslDefault).toBool();
     QString certificateKeyFile = parser.isSet("certificate-key") ? parser.value("certificate-key") : settings.value("certificate-key", defaultCertKeyFileName).toString();
     QString certificateFile = parser.isSet("certificate") ? parser.value("certificate") : settings.value("certificate", defaultCertFileName).toString();
@@ -109,9 +118,14 @@ int main(int argc, char *argv[])
     Authorizer *authorizer = nullptr;
     if (!insecure) {
         authorizer = new Authorizer(policyFile);
-        server.setAuthorizer(authorizer);
+        server.setAsyncAuthorizer(authorizer);
     }
 
+    if (sysInterval < 0 || sysInterval > std::numeric_limits<int>::max() / 1000) {
+        qWarning() << "Invalid $SYS topics interval" << sysInterval << "seconds, using" << qBound(0, sysInterval, std::numeric_limits<int>::max() / 1000);
+    }
+    server.setSysTopicsInterval(sysInterval);
+
     QSslConfiguration sslConfiguration;
     if (useSsl) {
         CertificateLoader certLoader;
@@ -143,5 +157,12 @@ int main(int argc, char *argv[])
         }
     }
 
+    MetricsServer metricsServer(&server);
+    if (metricsPort != 0) {
+        if (!metricsServer.listen(QHostAddress::LocalHost, metricsPort)) {
+            exit(EXIT_FAILURE);
+        }
+    }
+
     return a.exec();
 }
@@ -0,0 +1,177 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "metricsserver.h"
+
+#include <mqttserver.h>
+
+#include <QTcpSocket>
+#include <QDebug>
+
+// Requests are tiny, anything larger is not meant for us
+static const int maximumRequestSize = 8192;
+
+static void addMetric(QByteArray &out, const char *name, const char *type, const char *help)
+{
+    out += QByteArray("# HELP nymea_mqtt_") + name + ' ' + help + '\n';
+    out += QByteArray("# TYPE nymea_mqtt_") + name + ' ' + type + '\n';
+}
+
+static void addSample(QByteArray &out, const char *name, const QByteArray &labels, const QByteArray &value)
+{
+    out += QByteArray("nymea_mqtt_") + name;
+    if (!labels.isEmpty()) {
+        out += '{' + labels + '}';
+    }
+    out += ' ' + value + '\n';
+}
+
+static QByteArray seconds(qint64 microseconds)
+{
+    return QByteArray::number(static_cast<double>(microseconds) / 1000000, 'g', 10);
+}
+
+MetricsServer::MetricsServer(MqttServer *mqttServer, QObject *parent):
+    QObject{parent},
+    m_mqttServer(mqttServer)
+{
+    connect(&m_server, &QTcpServer::newConnection, this, &MetricsServer::onNewConnection);
+}
+
+bool MetricsServer::listen(const QHostAddress &address, quint16 port)
+{
+    if (!m_server.listen(address, port)) {
+        qWarning() << "Error listening for metrics on" << address << port << m_server.errorString();
+        return false;
+    }
+    qInfo() << "Serving metrics on" << QString("http://%1:%2/metrics").arg(address.toString()).arg(port);
+    return true;
+}
+
+QByteArray MetricsServer::metrics() const
+{
+    QByteArray out;
+
+    addMetric(out, "connected_clients", "gauge", "Clients which completed the MQTT handshake.");
+    addSample(out, "connected_clients", QByteArray(), QByteArray::number(m_mqttServer->clients().count()));
+
+    addMetric(out, "messages_received_total", "counter", "PUBLISH packets received from clients.");
+    for (int qos = Mqtt::QoS0; qos <= Mqtt::QoS2; qos++) {
+        addSample(out, "messages_received_total", "qos=\"" + QByteArray::number(qos) + '"', QByteArray::number(m_mqttServer->receivedMessagesCount(static_cast<Mqtt::QoS>(qos))));
+    }
+    addMetric(out, "messages_sent_total", "counter", "PUBLISH packets sent to clients, including resent ones.");
+    for (int qos = Mqtt::QoS0; qos <= Mqtt::QoS2; qos++) {
+        addSample(out, "messages_sent_total", "qos=\"" + QByteArray::number(qos) + '"', QByteArray::number(m_mqttServer->sentMessagesCount(static_cast<Mqtt::QoS>(qos))));
+    }
+    addMetric(out, "received_bytes_total", "counter", "Bytes received from clients.");
+    addSample(out, "received_bytes_total", QByteArray(), QByteArray::number(m_mqttServer->receivedBytesCount()));
+    addMetric(out, "sent_bytes_total", "counter", "Bytes written to client connections.");
+    addSample(out, "sent_bytes_total", QByteArray(), QByteArray::number(m_mqttServer->sentBytesCount()));
+
+    addMetric(out, "retained_messages", "gauge", "Retained messages stored.");
+    addSample(out, "retained_messages", QByteArray(), QByteArray::number(m_mqttServer->retainedMessagesCount()));
+    addMetric(out, "inflight_messages", "gauge", "QoS 1 and 2 messages sent to connected clients and not acknowledged yet.");
+    addSample(out, "inflight_messages", QByteArray(), QByteArray::number(m_mqttServer->inFlightMessagesCount()));
+    addMetric(out, "outbound_queue_bytes", "gauge", "Bytes waiting to be sent to clients.");
+    addSample(out, "outbound_queue_bytes", QByteArray(), QByteArray::number(m_mqttServer->totalOutboundQueueBytes()));
+
+    addMetric(out, "dropped_messages_total", "counter", "QoS 0 messages dropped due to full outbound queues.");
+    addSample(out, "dropped_messages_total", QByteArray(), QByteArray::number(m_mqttServer->droppedMessagesCount()));
+    addMetric(out, "retransmitted_messages_total", "counter", "Messages sent again because they were not acknowledged in time.");
+    addSample(out, "retransmitted_messages_total", QByteArray(), QByteArray::number(m_mqttServer->retransmittedMessagesCount()));
+    addMetric(out, "parse_errors_total", "counter", "Connections dropped for malformed or oversized packets.");
+    addSample(out, "parse_errors_total", QByteArray(), QByteArray::number(m_mqttServer->parseErrorsCount()));
+    addMetric(out, "rejected_connections_total", "counter", "Connections closed for exceeding the connection rate of their address.");
+    addSample(out, "rejected_connections_total", QByteArray(), QByteArray::number(m_mqttServer->rejectedConnectionsCount()));
+
+    addMetric(out, "handshakes_in_progress", "gauge", "Connections between being accepted and the CONNACK.");
+    addSample(out, "handshakes_in_progress", QByteArray(), QByteArray::number(m_mqttServer->handshakesInProgress()));
+    addMetric(out, "accept_queue_length", "gauge", "Connections waiting for a handshake slot.");
+    addSample(out, "accept_queue_length", QByteArray(), QByteArray::number(m_mqttServer->acceptQueueLength()));
+
+    addMetric(out, "authorization_latency_seconds", "histogram", "Time taken by the authorizer for a decision.");
+    const QVector<qint64> bounds = MqttServer::authorizationLatencyBounds();
+    const QVector<quint64> counts = m_mqttServer->authorizationLatencyCounts();
+    quint64 cumulative = 0;
+    for (int i = 0; i < bounds.count(); i++) {
+        cumulative += counts.at(i);
+        addSample(out, "authorization_latency_seconds_bucket", "le=\"" + seconds(bounds.at(i)) + '"', QByteArray::number(cumulative));
+    }
+    cumulative += counts.last();
+    addSample(out, "authorization_latency_seconds_bucket", "le=\"+Inf\"", QByteArray::number(cumulative));
+    addSample(out, "authorization_latency_seconds_sum", QByteArray(), seconds(m_mqttServer->authorizationLatencySum()));
+    addSample(out, "authorization_latency_seconds_count", QByteArray(), QByteArray::number(cumulative));
+
+    return out;
+}
+
+void MetricsServer::onNewConnection()
+{
+    while (m_server.hasPendingConnections()) {
+        QTcpSocket *socket = m_server.nextPendingConnection();
+        connect(socket, &QTcpSocket::readyRead, this, &MetricsServer::onReadyRead);
+        connect(socket, &QTcpSocket::disconnected, socket, &QTcpSocket::deleteLater);
+    }
+}
+
+void MetricsServer::onReadyRead()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    QByteArray request = socket->property("request").toByteArray() + socket->readAll();
+    if (!request.contains("\r\n\r\n")) {
+        if (request.size() > maximumRequestSize) {
+            socket->abort();
+            socket->deleteLater();
+            return;
+        }
+        socket->setProperty("request", request);
+        return;
+    }
+    disconnect(socket, &QTcpSocket::readyRead, this, &MetricsServer::onReadyRead);
+
+    QList<QByteArray> requestLine = request.left(request.indexOf("\r\n")).split(' ');
+    QByteArray status;
+    QByteArray contentType = "text/plain; charset=utf-8";
+    QByteArray body;
+    if (requestLine.count() != 3 || (requestLine.at(0) != "GET" && requestLine.at(0) != "HEAD")) {
+        status = "405 Method Not Allowed";
+    } else if (requestLine.at(1) != "/metrics" && !requestLine.at(1).startsWith("/metrics?")) {
+        status = "404 Not Found";
+    } else {
+        status = "200 OK";
+        contentType = "text/plain; version=0.0.4; charset=utf-8";
+        body = metrics();
+    }
+
+    QByteArray response = "HTTP/1.1 " + status + "\r\n"
+            + "Content-Type: " + contentType + "\r\n"
+            + "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+            + "Connection: close\r\n\r\n";
+    if (requestLine.value(0) != "HEAD") {
+        response += body;
+    }
+    socket->write(response);
+    socket->disconnectFromHost();
+}
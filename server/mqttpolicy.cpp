@@ -24,6 +24,9 @@
 
 #include "mqttpolicy.h"
 
+#include <QDebug>
+#include <QRegularExpression>
+
 MqttPolicy::MqttPolicy()
 {
 
@@ -36,7 +39,8 @@ MqttPolicy::MqttPolicy(const QString &clientId, const QString &username, const Q
     m_allowedSubscribeTopicFilters(allowedSubscribeTopicFilters),
     m_allowedPublishTopicFilters(allowedPublishTopicFilters)
 {
-
+    compile(m_allowedSubscribeTopicFilters, &m_subscribeAcl);
+    compile(m_allowedPublishTopicFilters, &m_publishAcl);
 }
 
 QString MqttPolicy::clientId() const
@@ -68,3 +72,34 @@ bool MqttPolicy::isValid() const
 {
     return !m_clientId.isEmpty();
 }
+
+bool MqttPolicy::allowsSubscribe(const QString &topicFilter) const
+{
+    return m_subscribeAcl.coversFilter(topicFilter);
+}
+
+bool MqttPolicy::allowsPublish(const QString &topic) const
+{
+    return m_publishAcl.matchesTopic(topic);
+}
+
+void MqttPolicy::compile(const QStringList &topicFilters, TopicAcl *acl) const
+{
+    foreach (const QString &topicFilter, topicFilters) {
+        if (topicFilter.isEmpty()) {
+            continue;
+        }
+        // Substituted values must not add levels or wildcards, that would grant more than intended
+        if ((topicFilter.contains("%c") && m_clientId.contains(QRegularExpression("[/+#]")))
+                || (topicFilter.contains("%u") && (m_username.isEmpty() || m_username.contains(QRegularExpression("[/+#]"))))) {
+            qWarning() << "Ignoring topic filter" << topicFilter << "for client" << m_clientId << "as the substituted values are not valid topic levels.";
+            continue;
+        }
+        QString substituted = topicFilter;
+        substituted.replace("%c", m_clientId);
+        substituted.replace("%u", m_username);
+        if (!acl->addFilter(substituted)) {
+            qWarning() << "Ignoring invalid topic filter" << topicFilter << "in the policy for client" << m_clientId;
+        }
+    }
+}
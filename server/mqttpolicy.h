@@ -28,6 +28,8 @@
 #include <QString>
 #include <QStringList>
 
+#include "topicacl.h"
+
 class MqttPolicy
 {
 public:
@@ -42,12 +44,22 @@ public:
 
     bool isValid() const;
 
+    // The allowed topic filters may contain wildcards as well as %c and %u, which are replaced by the client ID and username
+    bool allowsSubscribe(const QString &topicFilter) const;
+    bool allowsPublish(const QString &topic) const;
+
+private:
+    void compile(const QStringList &topicFilters, TopicAcl *acl) const;
+
 private:
     QString m_clientId;
     QString m_username;
     QString m_password;
     QStringList m_allowedSubscribeTopicFilters;
     QStringList m_allowedPublishTopicFilters;
+
+    TopicAcl m_subscribeAcl;
+    TopicAcl m_publishAcl;
 };
 
 #endif // MQTTPOLICY_H
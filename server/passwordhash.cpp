@@ -0,0 +1,95 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "passwordhash.h"
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#include <QStringList>
+
+static const QString hashPrefix = QStringLiteral("$pbkdf2-sha256$");
+
+QString PasswordHash::create(const QString &password, int iterations)
+{
+    QByteArray salt = randomBytes(16);
+    QByteArray hash = derive(password.toUtf8(), salt, iterations, 32);
+    return hashPrefix + QString::number(iterations) + '$' + salt.toBase64() + '$' + hash.toBase64();
+}
+
+bool PasswordHash::verify(const QString &storedPassword, const QString &password)
+{
+    QByteArray expected;
+    QByteArray actual;
+    if (isHash(storedPassword)) {
+        QStringList parts = storedPassword.mid(hashPrefix.length()).split('$');
+        bool ok = false;
+        int iterations = parts.count() == 3 ? parts.at(0).toInt(&ok) : 0;
+        if (!ok || iterations <= 0) {
+            return false;
+        }
+        expected = QByteArray::fromBase64(parts.at(2).toLatin1());
+        if (expected.isEmpty()) {
+            return false;
+        }
+        actual = derive(password.toUtf8(), QByteArray::fromBase64(parts.at(1).toLatin1()), iterations, expected.length());
+        if (actual.isEmpty()) {
+            return false;
+        }
+    } else {
+        expected = storedPassword.toUtf8();
+        actual = password.toUtf8();
+        if (expected.length() != actual.length()) {
+            return false;
+        }
+    }
+    return CRYPTO_memcmp(expected.constData(), actual.constData(), expected.length()) == 0;
+}
+
+bool PasswordHash::isHash(const QString &storedPassword)
+{
+    return storedPassword.startsWith(hashPrefix);
+}
+
+QByteArray PasswordHash::randomBytes(int count)
+{
+    QByteArray bytes(count, 0);
+    if (RAND_bytes(reinterpret_cast<unsigned char*>(bytes.data()), count) != 1) {
+        qFatal("Failed to obtain random bytes from OpenSSL.");
+    }
+    return bytes;
+}
+
+QByteArray PasswordHash::derive(const QByteArray &password, const QByteArray &salt, int iterations, int length)
+{
+    QByteArray hash(length, 0);
+    if (PKCS5_PBKDF2_HMAC(password.constData(), password.length(),
+                          reinterpret_cast<const unsigned char*>(salt.constData()), salt.length(),
+                          iterations, EVP_sha256(), length, reinterpret_cast<unsigned char*>(hash.data())) != 1) {
+        return QByteArray();
+    }
+    return hash;
+}
@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#ifndef PASSWORDHASH_H
+#define PASSWORDHASH_H
+
+#include <QString>
+#include <QByteArray>
+
+// Salted PBKDF2-HMAC-SHA256 password hashes, stored as $pbkdf2-sha256$<iterations>$<salt>$<hash>
+// with salt and hash in base64.
+class PasswordHash
+{
+public:
+    static QString create(const QString &password, int iterations = 100000);
+
+    // Verifies in constant time. Stored values which aren't hashes are compared as plain text,
+    // so policy files from before hashing was introduced keep working.
+    static bool verify(const QString &storedPassword, const QString &password);
+    static bool isHash(const QString &storedPassword);
+
+    static QByteArray randomBytes(int count);
+
+private:
+    static QByteArray derive(const QByteArray &password, const QByteArray &salt, int iterations, int length);
+};
+
+#endif // PASSWORDHASH_H
@@ -3,7 +3,7 @@ TARGET = nymea-mqtt-server
 
 include(../nymea-mqtt.pri)
 
-QT += network
+QT += network concurrent
 QT -= gui
 
 INCLUDEPATH += $$top_srcdir/libnymea-mqtt/
@@ -11,12 +11,18 @@ INCLUDEPATH += $$top_srcdir/libnymea-mqtt/
 HEADERS += \
     authorizer.h \
     certificateloader.h \
-    mqttpolicy.h
+    metricsserver.h \
+    mqttpolicy.h \
+    passwordhash.h \
+    topicacl.h
 
 SOURCES += main.cpp \
     authorizer.cpp \
     certificateloader.cpp \
-    mqttpolicy.cpp
+    metricsserver.cpp \
+    mqttpolicy.cpp \
+    passwordhash.cpp \
+    topicacl.cpp
 
 LIBS += -L$$top_builddir/libnymea-mqtt/ -lnymea-mqtt -lssl -lcrypto
 
@@ -0,0 +1,121 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "topicacl.h"
+#include "mqttsubscription.h"
+
+TopicAcl::TopicAcl()
+{
+    m_nodes.append(Node());
+}
+
+bool TopicAcl::addFilter(const QString &topicFilter)
+{
+    if (!MqttSubscription::isValidTopicFilter(topicFilter.toUtf8())) {
+        return false;
+    }
+
+    int node = 0;
+    foreach (const QString &level, topicFilter.split('/')) {
+        int next = child(node, level);
+        if (next < 0) {
+            next = m_nodes.count();
+            m_nodes.append(Node());
+            m_nodes[node].children.insert(level, next);
+        }
+        node = next;
+    }
+    m_nodes[node].accepting = true;
+    return true;
+}
+
+bool TopicAcl::isEmpty() const
+{
+    return m_nodes.count() == 1;
+}
+
+bool TopicAcl::matchesTopic(const QString &topic) const
+{
+    return matchesTopic(0, topic.split('/'), 0);
+}
+
+bool TopicAcl::coversFilter(const QString &topicFilter) const
+{
+    return coversFilter(0, topicFilter.split('/'), 0);
+}
+
+int TopicAcl::child(int node, const QString &level) const
+{
+    return m_nodes.at(node).children.value(level, -1);
+}
+
+bool TopicAcl::matchesTopic(int node, const QStringList &levels, int level) const
+{
+    // Wildcards in the first level don't match topics starting with $
+    bool wildcards = level > 0 || !levels.first().startsWith('$');
+
+    // # matches the parent level too, so "a/#" matches "a"
+    if (wildcards && child(node, "#") >= 0) {
+        return true;
+    }
+    if (level == levels.count()) {
+        return m_nodes.at(node).accepting;
+    }
+
+    int next = child(node, levels.at(level));
+    if (next >= 0 && matchesTopic(next, levels, level + 1)) {
+        return true;
+    }
+    next = child(node, "+");
+    return wildcards && next >= 0 && matchesTopic(next, levels, level + 1);
+}
+
+bool TopicAcl::coversFilter(int node, const QStringList &levels, int level) const
+{
+    bool wildcards = level > 0 || !levels.first().startsWith('$');
+
+    if (wildcards && child(node, "#") >= 0) {
+        return true;
+    }
+    if (level == levels.count()) {
+        return m_nodes.at(node).accepting;
+    }
+
+    const QString &filterLevel = levels.at(level);
+    if (filterLevel == "#") {
+        // Only covered by a # in the same place, handled above
+        return false;
+    }
+    int next = child(node, filterLevel);
+    if (next >= 0 && coversFilter(next, levels, level + 1)) {
+        return true;
+    }
+    // A + in the given filter is only covered by a +, which has been looked up right above
+    if (filterLevel == "+") {
+        return false;
+    }
+    next = child(node, "+");
+    return wildcards && next >= 0 && coversFilter(next, levels, level + 1);
+}
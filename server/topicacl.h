@@ -0,0 +1,65 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#ifndef TOPICACL_H
+#define TOPICACL_H
+
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+// A set of topic filters, which may contain the MQTT wildcards + and #, compiled into a tree
+// of topic levels. Checks walk the tree level by level, so they cost the same regardless of
+// how many filters there are.
+class TopicAcl
+{
+public:
+    TopicAcl();
+
+    // Invalid filters, like "a/#/b", are rejected as they would grant more than they say
+    bool addFilter(const QString &topicFilter);
+    bool isEmpty() const;
+
+    // Whether the topic matches any of the filters
+    bool matchesTopic(const QString &topic) const;
+    // Whether every topic matching the given filter matches any of the filters
+    bool coversFilter(const QString &topicFilter) const;
+
+private:
+    struct Node {
+        QHash<QString, int> children;
+        bool accepting = false;
+    };
+
+    int child(int node, const QString &level) const;
+    bool matchesTopic(int node, const QStringList &levels, int level) const;
+    bool coversFilter(int node, const QStringList &levels, int level) const;
+
+    // Nodes refer to their children by index, which keeps the tree copyable by value. Node 0 is the root.
+    QVector<Node> m_nodes;
+};
+
+#endif // TOPICACL_H
@@ -0,0 +1,21 @@
+QT += testlib network websockets
+QT -= gui
+
+CONFIG += qt console warn_on depend_includepath
+CONFIG -= app_bundle
+
+TEMPLATE = app
+TARGET = nymeamqttbenchmarks
+
+include(../../nymea-mqtt.pri)
+
+INCLUDEPATH += $$top_srcdir/libnymea-mqtt/
+
+HEADERS += packetcorpus.h
+
+SOURCES += test_benchmarks.cpp
+
+LIBS += -L$$top_builddir/libnymea-mqtt/ -lnymea-mqtt
+
+target.path = $$[QT_INSTALL_PREFIX]/share/tests/nymea-mqtt/
+INSTALLS += target
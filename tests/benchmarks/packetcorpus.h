@@ -0,0 +1,241 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#ifndef PACKETCORPUS_H
+#define PACKETCORPUS_H
+
+// A fixed set of recorded MQTT 3.1.1 packets, one or more of every type, so codec changes can be compared
+// commit by commit. All of them are canonically encoded and serialize back to the exact same bytes.
+struct PacketCorpusEntry {
+    const char *name;
+    const char *hex;
+};
+
+static const PacketCorpusEntry packetCorpus[] = {
+    {"CONNECT minimal",
+     "101500044d5154540402003c000973656e736f722d3432"},
+    {"CONNECT will and credentials",
+     "104800044d51545404ee012c000973656e736f722d34320018646576696365732f73656e736f722d34322f73746174757300076f66666c696e65000673656e73"
+     "6f720006736563726574"},
+    {"CONNACK",
+     "20020000"},
+    {"PUBLISH QoS 0, 0 bytes",
+     "301f001d646576696365732f73656e736f722d34322f74656d7065726174757265"},
+    {"PUBLISH QoS 0, 16 bytes",
+     "302f001d646576696365732f73656e736f722d34322f74656d70657261747572657b2274656d7065726174757265223a32"},
+    {"PUBLISH QoS 0, 256 bytes",
+     "309f02001d646576696365732f73656e736f722d34322f74656d70657261747572657b2274656d7065726174757265223a32312e352c2268756d696469747922"
+     "3a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262"
+     "617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279"
+     "223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c22"
+     "72737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d"},
+    {"PUBLISH QoS 0, 4096 bytes",
+     "309f20001d646576696365732f73656e736f722d34322f74656d70657261747572657b2274656d7065726174757265223a32312e352c2268756d696469747922"
+     "3a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262"
+     "617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279"
+     "223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c22"
+     "72737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a"
+     "2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b22"
+     "74656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d706572"
+     "6174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d706572617475726522"
+     "3a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c"
+     "2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964"
+     "697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34"
+     "382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c22626174"
+     "74657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a"
+     "39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c227273"
+     "7369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36"
+     "377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b227465"
+     "6d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174"
+     "757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32"
+     "312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268"
+     "756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d69646974"
+     "79223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c"
+     "2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c226261747465"
+     "7279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a3937"
+     "2c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369"
+     "223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d"
+     "7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d70"
+     "65726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d70657261747572"
+     "65223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e"
+     "352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d"
+     "6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d696469747922"
+     "3a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262"
+     "617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279"
+     "223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c22"
+     "72737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a"
+     "2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b22"
+     "74656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d706572"
+     "6174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d706572617475726522"
+     "3a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c"
+     "2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964"
+     "697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34"
+     "382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c22626174"
+     "74657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a"
+     "39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c227273"
+     "7369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36"
+     "377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b227465"
+     "6d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174"
+     "757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32"
+     "312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268"
+     "756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d69646974"
+     "79223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c"
+     "2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c226261747465"
+     "7279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a3937"
+     "2c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369"
+     "223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d"
+     "7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d70"
+     "65726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d70657261747572"
+     "65223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e"
+     "352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d"
+     "6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d696469747922"
+     "3a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262"
+     "617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279"
+     "223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c22"
+     "72737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a"
+     "2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b22"
+     "74656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262"},
+    {"PUBLISH QoS 1, 16 bytes",
+     "3231001d646576696365732f73656e736f722d34322f74656d706572617475726512677b2274656d7065726174757265223a32"},
+    {"PUBLISH QoS 1, 256 bytes",
+     "32a102001d646576696365732f73656e736f722d34322f74656d706572617475726512677b2274656d7065726174757265223a32312e352c2268756d69646974"
+     "79223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c"
+     "2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c226261747465"
+     "7279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a3937"
+     "2c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d"},
+    {"PUBLISH QoS 1, 4096 bytes",
+     "32a120001d646576696365732f73656e736f722d34322f74656d706572617475726512677b2274656d7065726174757265223a32312e352c2268756d69646974"
+     "79223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c"
+     "2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c226261747465"
+     "7279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a3937"
+     "2c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369"
+     "223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d"
+     "7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d70"
+     "65726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d70657261747572"
+     "65223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e"
+     "352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d"
+     "6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d696469747922"
+     "3a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262"
+     "617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279"
+     "223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c22"
+     "72737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a"
+     "2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b22"
+     "74656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d706572"
+     "6174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d706572617475726522"
+     "3a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c"
+     "2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964"
+     "697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34"
+     "382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c22626174"
+     "74657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a"
+     "39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c227273"
+     "7369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36"
+     "377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b227465"
+     "6d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174"
+     "757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32"
+     "312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268"
+     "756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d69646974"
+     "79223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c"
+     "2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c226261747465"
+     "7279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a3937"
+     "2c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369"
+     "223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d"
+     "7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d70"
+     "65726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d70657261747572"
+     "65223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e"
+     "352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d"
+     "6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d696469747922"
+     "3a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262"
+     "617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279"
+     "223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c22"
+     "72737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a"
+     "2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b22"
+     "74656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d706572"
+     "6174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d706572617475726522"
+     "3a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c"
+     "2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964"
+     "697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34"
+     "382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c22626174"
+     "74657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a"
+     "39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c227273"
+     "7369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36"
+     "377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b227465"
+     "6d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174"
+     "757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32"
+     "312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268"
+     "756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d69646974"
+     "79223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c"
+     "2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c226261747465"
+     "7279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a3937"
+     "2c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369"
+     "223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a39372c2272737369223a2d36377d"
+     "7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262"},
+    {"PUBLISH QoS 2, 16 bytes",
+     "3431001d646576696365732f73656e736f722d34322f74656d706572617475726512677b2274656d7065726174757265223a32"},
+    {"PUBLISH QoS 2, 256 bytes",
+     "34a102001d646576696365732f73656e736f722d34322f74656d706572617475726512677b2274656d7065726174757265223a32312e352c2268756d69646974"
+     "79223a34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c"
+     "2262617474657279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c226261747465"
+     "7279223a39372c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c2262617474657279223a3937"
+     "2c2272737369223a2d36377d7b2274656d7065726174757265223a32312e352c2268756d"},
+    {"PUBLISH QoS 1, deep topic, 64 bytes",
+     "329a010056736974652f6275696c64696e672d332f666c6f6f722d31322f726f6f6d2d313230372f6465736b2d342f6465766963652d31372f73656e736f722f"
+     "636c696d6174652f74656d70657261747572652f63656c7369757312687b2274656d7065726174757265223a32312e352c2268756d6964697479223a34382c22"
+     "62617474657279223a39372c2272737369223a2d36377d7b2274656d70"},
+    {"PUBLISH QoS 0 retained, 64 bytes",
+     "315f001d646576696365732f73656e736f722d34322f74656d70657261747572657b2274656d7065726174757265223a32312e352c2268756d6964697479223a"
+     "34382c2262617474657279223a39372c2272737369223a2d36377d7b2274656d70"},
+    {"PUBACK",
+     "40021267"},
+    {"PUBREC",
+     "50021267"},
+    {"PUBREL",
+     "62021267"},
+    {"PUBCOMP",
+     "70021267"},
+    {"SUBSCRIBE 1 filter",
+     "821a00110015646576696365732f2b2f74656d706572617475726501"},
+    {"SUBSCRIBE 5 filters",
+     "827700120015646576696365732f2b2f74656d7065726174757265000013646576696365732f73656e736f722d34322f23010020736974652f6275696c64696e"
+     "672d332f2b2f2b2f2b2f2b2f73656e736f722f2302001d245359532f62726f6b65722f636c69656e74732f636f6e6e65637465640000012301"},
+    {"SUBACK 1 return code",
+     "9003001101"},
+    {"SUBACK 5 return codes",
+     "900700120001028000"},
+    {"UNSUBSCRIBE 1 filter",
+     "a21900130015646576696365732f2b2f74656d7065726174757265"},
+    {"UNSUBSCRIBE 5 filters",
+     "a27200140015646576696365732f2b2f74656d70657261747572650013646576696365732f73656e736f722d34322f230020736974652f6275696c64696e672d"
+     "332f2b2f2b2f2b2f2b2f73656e736f722f23001d245359532f62726f6b65722f636c69656e74732f636f6e6e6563746564000123"},
+    {"UNSUBACK",
+     "b0020013"},
+    {"PINGREQ",
+     "c000"},
+    {"PINGRESP",
+     "d000"},
+    {"DISCONNECT",
+     "e000"},
+};
+
+#endif // PACKETCORPUS_H
@@ -0,0 +1,545 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "mqttpacket.h"
+#include "mqttinputbuffer.h"
+#include "mqttretainedmessageindex.h"
+#include "mqtttimerwheel.h"
+#include "mqttserver.h"
+#include "mqttclient.h"
+#include "mqttfilepersistence.h"
+#include "mqttserver_p.h"
+#include "mqttsubscriptionindex.h"
+#include "packetcorpus.h"
+
+#include <QTest>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QTimer>
+
+// Benchmarks are not registered as testcase and thus not run by "make check".
+// Run the binary directly, optionally with QTest's benchmark options, e.g. -callgrind or -iterations.
+class MqttBenchmarks: public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void parsePublish_data();
+    void parsePublish();
+
+    void parsePipelinedBurst_data();
+    void parsePipelinedBurst();
+
+    void parseCorpus_data();
+    void parseCorpus();
+
+    void serializeCorpus_data();
+    void serializeCorpus();
+
+    void matchTopic_data();
+    void matchTopic();
+
+    void validateTopicFilter_data();
+    void validateTopicFilter();
+
+    void subscriptionIndexMatch_data();
+    void subscriptionIndexMatch();
+
+    void relayThroughput_data();
+    void relayThroughput();
+
+    void clientReceiveThroughput_data();
+    void clientReceiveThroughput();
+
+    void idleKeepAliveTracking_data();
+    void idleKeepAliveTracking();
+
+    void retainedWildcardSubscribe_data();
+    void retainedWildcardSubscribe();
+
+    void persistenceColdStart_data();
+    void persistenceColdStart();
+
+    void persistenceWrite_data();
+    void persistenceWrite();
+};
+
+void MqttBenchmarks::parsePublish_data()
+{
+    QTest::addColumn<int>("payloadSize");
+
+    QTest::newRow("1 KiB") << 1024;
+    QTest::newRow("64 KiB") << 64 * 1024;
+    QTest::newRow("1 MiB") << 1024 * 1024;
+}
+
+void MqttBenchmarks::parsePublish()
+{
+    QFETCH(int, payloadSize);
+
+    MqttPacket publish(MqttPacket::TypePublish, 1, Mqtt::QoS1);
+    publish.setTopic("benchmark/payload");
+    publish.setPayload(QByteArray(payloadSize, 'x'));
+    const QByteArray data = publish.serialize();
+
+    MqttPacket parsed;
+    QCOMPARE(parsed.parse(data), data.length());
+    QCOMPARE(parsed.payload(), publish.payload());
+
+    QBENCHMARK {
+        MqttPacket packet;
+        packet.parse(data);
+    }
+}
+
+void MqttBenchmarks::parsePipelinedBurst_data()
+{
+    QTest::addColumn<int>("packetCount");
+
+    QTest::newRow("50 packets") << 50;
+    QTest::newRow("500 packets") << 500;
+    QTest::newRow("5000 packets") << 5000;
+}
+
+void MqttBenchmarks::parsePipelinedBurst()
+{
+    QFETCH(int, packetCount);
+
+    // A client bursting small QoS 0 packets, all arriving in a single read from the socket
+    MqttPacket publish(MqttPacket::TypePublish, 0, Mqtt::QoS0);
+    publish.setTopic("benchmark/burst");
+    publish.setPayload("23.5");
+    const QByteArray packetData = publish.serialize();
+    QByteArray data;
+    for (int i = 0; i < packetCount; i++) {
+        data.append(packetData);
+    }
+
+    QBENCHMARK {
+        MqttInputBuffer inputBuffer;
+        inputBuffer.append(data);
+        int parsedCount = 0;
+        while (!inputBuffer.isEmpty()) {
+            MqttPacket packet;
+            int ret = packet.parse(inputBuffer.data(), inputBuffer.size());
+            if (ret <= 0) {
+                break;
+            }
+            inputBuffer.consume(ret);
+            parsedCount++;
+        }
+        QCOMPARE(parsedCount, packetCount);
+    }
+}
+
+void MqttBenchmarks::parseCorpus_data()
+{
+    QTest::addColumn<QByteArray>("data");
+
+    for (const PacketCorpusEntry &entry : packetCorpus) {
+        QTest::newRow(entry.name) << QByteArray::fromHex(entry.hex);
+    }
+}
+
+void MqttBenchmarks::parseCorpus()
+{
+    QFETCH(QByteArray, data);
+
+    MqttPacket parsed;
+    QCOMPARE(parsed.parse(data), data.length());
+
+    QBENCHMARK {
+        MqttPacket packet;
+        packet.parse(data);
+    }
+}
+
+void MqttBenchmarks::serializeCorpus_data()
+{
+    parseCorpus_data();
+}
+
+void MqttBenchmarks::serializeCorpus()
+{
+    QFETCH(QByteArray, data);
+
+    MqttPacket packet;
+    QCOMPARE(packet.parse(data), data.length());
+    QCOMPARE(packet.serialize(), data);
+
+    QBENCHMARK {
+        packet.serialize();
+    }
+}
+
+void MqttBenchmarks::matchTopic_data()
+{
+    QTest::addColumn<QByteArray>("topicFilter");
+    QTest::addColumn<QByteArray>("topic");
+    QTest::addColumn<bool>("matches");
+
+    const QByteArray deepTopic = "site/building-3/floor-12/room-1207/desk-4/device-17/sensor/climate/temperature/celsius";
+    QTest::newRow("exact") << QByteArray("devices/sensor-42/temperature") << QByteArray("devices/sensor-42/temperature") << true;
+    QTest::newRow("single level wildcard") << QByteArray("devices/+/temperature") << QByteArray("devices/sensor-42/temperature") << true;
+    QTest::newRow("multi level wildcard") << QByteArray("devices/#") << QByteArray("devices/sensor-42/temperature") << true;
+    QTest::newRow("deep exact") << deepTopic << deepTopic << true;
+    QTest::newRow("deep wildcards") << QByteArray("site/+/+/+/+/+/sensor/#") << deepTopic << true;
+    QTest::newRow("first level mismatch") << QByteArray("other/+/temperature") << QByteArray("devices/sensor-42/temperature") << false;
+    QTest::newRow("deep last level mismatch") << QByteArray("site/building-3/floor-12/room-1207/desk-4/device-17/sensor/climate/temperature/fahrenheit") << deepTopic << false;
+    QTest::newRow("system topic") << QByteArray("#") << QByteArray("$SYS/broker/uptime") << false;
+    QTest::newRow("explicit system topic") << QByteArray("$SYS/broker/#") << QByteArray("$SYS/broker/uptime") << true;
+}
+
+void MqttBenchmarks::matchTopic()
+{
+    QFETCH(QByteArray, topicFilter);
+    QFETCH(QByteArray, topic);
+    QFETCH(bool, matches);
+
+    QCOMPARE(MqttSubscription::matchTopic(topicFilter, topic), matches);
+
+    QBENCHMARK {
+        MqttSubscription::matchTopic(topicFilter, topic);
+    }
+}
+
+void MqttBenchmarks::validateTopicFilter_data()
+{
+    QTest::addColumn<QByteArray>("topicFilter");
+    QTest::addColumn<bool>("valid");
+
+    QTest::newRow("exact") << QByteArray("devices/sensor-42/temperature") << true;
+    QTest::newRow("wildcards") << QByteArray("devices/+/sensors/#") << true;
+    QTest::newRow("deep") << QByteArray("site/building-3/floor-12/room-1207/desk-4/device-17/sensor/climate/temperature/+") << true;
+    QTest::newRow("misplaced multi level wildcard") << QByteArray("devices/#/temperature") << false;
+    QTest::newRow("wildcard within level") << QByteArray("devices/sensor+/temperature") << false;
+}
+
+void MqttBenchmarks::validateTopicFilter()
+{
+    QFETCH(QByteArray, topicFilter);
+    QFETCH(bool, valid);
+
+    QCOMPARE(MqttSubscription::isValidTopicFilter(topicFilter), valid);
+
+    QBENCHMARK {
+        MqttSubscription::isValidTopicFilter(topicFilter);
+    }
+}
+
+void MqttBenchmarks::subscriptionIndexMatch_data()
+{
+    QTest::addColumn<int>("subscriptionCount");
+
+    QTest::newRow("1k subscriptions") << 1000;
+    QTest::newRow("10k subscriptions") << 10000;
+    QTest::newRow("100k subscriptions") << 100000;
+}
+
+void MqttBenchmarks::subscriptionIndexMatch()
+{
+    QFETCH(int, subscriptionCount);
+
+    // 1000 clients, each subscribed to the status of its devices on one site and some of them to all devices of that site
+    QVector<ClientContext> contexts(1000);
+    MqttSubscriptionIndex index;
+    for (int i = 0; i < subscriptionCount; i++) {
+        const QByteArray site = "site/" + QByteArray::number(i % 1000);
+        const QByteArray topicFilter = i % 10 == 0 ? site + "/+/status" : site + "/device" + QByteArray::number(i / 1000) + "/status";
+        index.insert(topicFilter, &contexts[i % 1000], Mqtt::QoS1);
+    }
+
+    QCOMPARE(index.match("site/42/device0/status").count(), 1);
+
+    QBENCHMARK {
+        index.match("site/42/device0/status");
+    }
+}
+
+void MqttBenchmarks::relayThroughput_data()
+{
+    QTest::addColumn<int>("workerThreadCount");
+
+    QTest::newRow("no worker threads") << 0;
+    QTest::newRow("1 worker thread") << 1;
+    QTest::newRow("2 worker threads") << 2;
+    QTest::newRow("4 worker threads") << 4;
+    QTest::newRow("8 worker threads") << 8;
+}
+
+void MqttBenchmarks::relayThroughput()
+{
+    QFETCH(int, workerThreadCount);
+
+    const int clientCount = 8;
+    const int messageCount = 500;
+
+    MqttServer server;
+    server.setWorkerThreadCount(workerThreadCount);
+    int serverId = server.listen(QHostAddress::LocalHost, 0);
+    QVERIFY(serverId >= 0);
+    quint16 port = server.listeningAddress(serverId).second;
+
+    // Every client publishes to its own topic and receives the messages of the next client
+    QList<MqttClient*> clients;
+    int receivedCount = 0;
+    for (int i = 0; i < clientCount; i++) {
+        MqttClient *client = new MqttClient(QString("client%1").arg(i), this);
+        QSignalSpy connectedSpy(client, &MqttClient::connected);
+        client->connectToHost("127.0.0.1", port);
+        QVERIFY(connectedSpy.wait());
+        QSignalSpy subscribedSpy(client, &MqttClient::subscribeResult);
+        client->subscribe(QString("benchmark/%1").arg((i + 1) % clientCount));
+        QVERIFY(subscribedSpy.wait());
+        connect(client, &MqttClient::publishReceived, this, [&receivedCount](){ receivedCount++; });
+        clients.append(client);
+    }
+
+    const QByteArray payload(64, 'x');
+    QBENCHMARK {
+        receivedCount = 0;
+        for (int i = 0; i < messageCount; i++) {
+            for (int j = 0; j < clientCount; j++) {
+                clients.at(j)->publish(QString("benchmark/%1").arg(j), payload);
+            }
+        }
+        QTRY_COMPARE_WITH_TIMEOUT(receivedCount, clientCount * messageCount, 30000);
+    }
+
+    qDeleteAll(clients);
+}
+
+void MqttBenchmarks::clientReceiveThroughput_data()
+{
+    QTest::addColumn<Mqtt::QoS>("qos");
+    QTest::addColumn<int>("payloadSize");
+
+    QTest::newRow("QoS 0, 16 bytes") << Mqtt::QoS0 << 16;
+    QTest::newRow("QoS 0, 1 KiB") << Mqtt::QoS0 << 1024;
+    QTest::newRow("QoS 1, 16 bytes") << Mqtt::QoS1 << 16;
+    QTest::newRow("QoS 1, 1 KiB") << Mqtt::QoS1 << 1024;
+}
+
+void MqttBenchmarks::clientReceiveThroughput()
+{
+    QFETCH(Mqtt::QoS, qos);
+    QFETCH(int, payloadSize);
+
+    // Messages received per iteration, the client gets them in large pipelined bursts
+    const int messageCount = 10000;
+
+    MqttServer server;
+    int serverId = server.listen(QHostAddress::LocalHost, 0);
+    QVERIFY(serverId >= 0);
+    quint16 port = server.listeningAddress(serverId).second;
+
+    MqttClient client("receiver", this);
+    QSignalSpy connectedSpy(&client, &MqttClient::connected);
+    client.connectToHost("127.0.0.1", port);
+    QVERIFY(connectedSpy.wait());
+    QSignalSpy subscribedSpy(&client, &MqttClient::subscribeResult);
+    client.subscribe("benchmark/receive", qos);
+    QVERIFY(subscribedSpy.wait());
+
+    int receivedCount = 0;
+    connect(&client, &MqttClient::publishReceived, this, [&receivedCount](){ receivedCount++; });
+
+    const QByteArray payload(payloadSize, 'x');
+    QBENCHMARK {
+        receivedCount = 0;
+        for (int i = 0; i < messageCount; i++) {
+            server.publish("benchmark/receive", payload);
+        }
+        QTRY_COMPARE_WITH_TIMEOUT(receivedCount, messageCount, 30000);
+    }
+}
+
+void MqttBenchmarks::idleKeepAliveTracking_data()
+{
+    QTest::addColumn<bool>("timerWheel");
+
+    QTest::newRow("QTimer per connection") << false;
+    QTest::newRow("timer wheel") << true;
+}
+
+void MqttBenchmarks::idleKeepAliveTracking()
+{
+    QFETCH(bool, timerWheel);
+
+    // One iteration is a second in the life of a server with 50k idle connections, each sending
+    // a PINGREQ every 60 seconds with a keep alive timeout of 90 seconds
+    const int connectionCount = 50000;
+    const int packetsPerSecond = connectionCount / 60;
+    const qint64 timeout = 90000;
+
+    if (!timerWheel) {
+        QList<QTimer*> timers;
+        for (int i = 0; i < connectionCount; i++) {
+            QTimer *timer = new QTimer(this);
+            timer->start(timeout);
+            timers.append(timer);
+        }
+        int next = 0;
+        QBENCHMARK {
+            for (int i = 0; i < packetsPerSecond; i++) {
+                timers.at(next++ % connectionCount)->start();
+            }
+            for (int tick = 0; tick < 10; tick++) {
+                QCoreApplication::processEvents();
+            }
+        }
+        qDeleteAll(timers);
+        return;
+    }
+
+    // The wheel only uses the connections as keys, they are never dereferenced
+    QVector<char> connections(connectionCount);
+    QVector<qint64> lastSeen(connectionCount, 0);
+    MqttTimerWheel wheel;
+    for (int i = 0; i < connectionCount; i++) {
+        wheel.schedule(reinterpret_cast<MqttServerClient*>(&connections[i]), timeout);
+    }
+    int next = 0;
+    qint64 now = 0;
+    QBENCHMARK {
+        for (int i = 0; i < packetsPerSecond; i++) {
+            lastSeen[next++ % connectionCount] = now;
+        }
+        for (int tick = 0; tick < 10; tick++) {
+            now += wheel.tickLength();
+            foreach (MqttServerClient *client, wheel.advance(now)) {
+                int index = reinterpret_cast<char*>(client) - connections.data();
+                wheel.schedule(client, lastSeen.at(index) + timeout);
+            }
+        }
+    }
+    QCOMPARE(wheel.count(), connectionCount);
+}
+
+void MqttBenchmarks::retainedWildcardSubscribe_data()
+{
+    QTest::addColumn<int>("retainedTopicCount");
+
+    QTest::newRow("10k retained topics") << 10000;
+    QTest::newRow("100k retained topics") << 100000;
+    QTest::newRow("1M retained topics") << 1000000;
+}
+
+void MqttBenchmarks::retainedWildcardSubscribe()
+{
+    QFETCH(int, retainedTopicCount);
+
+    // 1000 sites with a status and a power topic for up to 500 devices each
+    MqttRetainedMessageIndex retainedMessages;
+    for (int i = 0; i < retainedTopicCount; i++) {
+        QByteArray topic = "site/" + QByteArray::number(i % 1000) + "/device" + QByteArray::number(i / 2000) + (i / 1000 % 2 ? "/power" : "/status");
+        MqttPacket packet(MqttPacket::TypePublish, 0, Mqtt::QoS0, true);
+        packet.setTopic(topic);
+        packet.setPayload("on");
+        retainedMessages.append(topic, packet);
+    }
+    QCOMPARE(retainedMessages.count(), retainedTopicCount);
+
+    // A dashboard subscribing to the status of all devices of one site
+    QBENCHMARK {
+        MqttPackets packets = retainedMessages.match("site/42/+/status");
+        QCOMPARE(packets.count(), retainedTopicCount / 2000);
+    }
+}
+
+void MqttBenchmarks::persistenceColdStart_data()
+{
+    QTest::addColumn<int>("retainedTopicCount");
+
+    QTest::newRow("10k retained topics") << 10000;
+    QTest::newRow("100k retained topics") << 100000;
+}
+
+void MqttBenchmarks::persistenceColdStart()
+{
+    QFETCH(int, retainedTopicCount);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString fileName = dir.filePath("mqtt.log");
+    {
+        MqttFilePersistence persistence(fileName);
+        persistence.setSyncPolicy(MqttFilePersistence::SyncNever);
+        MqttPackets retainedMessages;
+        QList<MqttPersistentSession> sessions;
+        QVERIFY(persistence.restore(&retainedMessages, &sessions));
+        for (int i = 0; i < retainedTopicCount; i++) {
+            MqttPacket packet(MqttPacket::TypePublish, 0, Mqtt::QoS0, true);
+            packet.setTopic("site/" + QByteArray::number(i % 1000) + "/device" + QByteArray::number(i / 1000) + "/status");
+            packet.setPayload("{\"state\":\"on\",\"power\":23.5}");
+            persistence.storeRetainedMessage(packet);
+        }
+    }
+
+    // Restoring includes rewriting the compacted log
+    QBENCHMARK {
+        MqttFilePersistence persistence(fileName);
+        MqttServer server;
+        server.setPersistence(&persistence);
+    }
+}
+
+void MqttBenchmarks::persistenceWrite_data()
+{
+    QTest::addColumn<MqttFilePersistence::SyncPolicy>("syncPolicy");
+
+    QTest::newRow("SyncNever") << MqttFilePersistence::SyncNever;
+    QTest::newRow("SyncPeriodically") << MqttFilePersistence::SyncPeriodically;
+    QTest::newRow("SyncAlways") << MqttFilePersistence::SyncAlways;
+}
+
+void MqttBenchmarks::persistenceWrite()
+{
+    QFETCH(MqttFilePersistence::SyncPolicy, syncPolicy);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    MqttFilePersistence persistence(dir.filePath("mqtt.log"));
+    persistence.setSyncPolicy(syncPolicy);
+    MqttPackets retainedMessages;
+    QList<MqttPersistentSession> sessions;
+    QVERIFY(persistence.restore(&retainedMessages, &sessions));
+
+    MqttPacket packet(MqttPacket::TypePublish, 0, Mqtt::QoS0, true);
+    packet.setTopic("site/1/device1/status");
+    packet.setPayload("{\"state\":\"on\",\"power\":23.5}");
+
+    // 1000 retained updates of the same topic
+    QBENCHMARK {
+        for (int i = 0; i < 1000; i++) {
+            persistence.removeRetainedMessages(packet.topic());
+            persistence.storeRetainedMessage(packet);
+        }
+    }
+}
+
+QTEST_MAIN(MqttBenchmarks)
+
+#include "test_benchmarks.moc"
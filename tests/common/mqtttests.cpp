@@ -25,14 +25,76 @@
 #include "mqttserver.h"
 #include "mqttclient.h"
 #include "mqttclient_p.h"
+#include "mqttfilepersistence.h"
+#include "mqttretainedmessageindex.h"
 
 #include <QTest>
 #include <QSignalSpy>
+#include <QTemporaryDir>
+
+#include <limits>
 
 #include "mqtttests.h"
 
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 7, 0))
 
+class TestAuthorizer: public MqttAuthorizer
+{
+public:
+    Mqtt::ConnectReturnCode authorizeConnect(int, const QString &, const QString &, const QString &, const QHostAddress &) override {
+        return Mqtt::ConnectReturnCodeAccepted;
+    }
+    bool authorizeSubscribe(int, const QString &, const QString &) override {
+        return true;
+    }
+    bool authorizePublish(int, const QString &, const QString &topic) override {
+        publishChecks++;
+        return !deniedTopics.contains(topic);
+    }
+
+    int publishChecks = 0;
+    QStringList deniedTopics;
+};
+
+// Takes its time for every decision, like one hashing passwords or asking another process would
+class SlowAuthorizer: public MqttAsyncAuthorizer
+{
+public:
+    void authorizeConnect(int, const QString &, const QString &, const QString &, const QHostAddress &, std::function<void(Mqtt::ConnectReturnCode)> result) override {
+        QTimer::singleShot(100, [result](){ result(Mqtt::ConnectReturnCodeAccepted); });
+    }
+    void authorizeSubscribe(int, const QString &, const QString &, std::function<void(bool)> result) override {
+        QTimer::singleShot(100, [result](){ result(true); });
+    }
+    void authorizePublish(int, const QString &, const QString &topic, std::function<void(bool)> result) override {
+        bool allowed = !topic.contains("denied");
+        QTimer::singleShot(100, [result, allowed](){ result(allowed); });
+    }
+};
+
+// Holds back CONNECT decisions until the test releases them
+class HoldingAuthorizer: public MqttAsyncAuthorizer
+{
+public:
+    void authorizeConnect(int, const QString &, const QString &, const QString &, const QHostAddress &, std::function<void(Mqtt::ConnectReturnCode)> result) override {
+        pendingConnects.append(result);
+    }
+    void authorizeSubscribe(int, const QString &, const QString &, std::function<void(bool)> result) override {
+        result(true);
+    }
+    void authorizePublish(int, const QString &, const QString &, std::function<void(bool)> result) override {
+        if (holdPublishes) {
+            pendingPublishes.append(result);
+        } else {
+            result(true);
+        }
+    }
+
+    QList<std::function<void(Mqtt::ConnectReturnCode)> > pendingConnects;
+    bool holdPublishes = false;
+    QList<std::function<void(bool)> > pendingPublishes;
+};
+
 MqttClient *MqttTests::connectAndWait(const QString &clientId, bool cleanSession, quint16 keepAlive, const QString &willTopic, const QString &willMessage, Mqtt::QoS willQoS, bool willRetain)
 {
     QPair<MqttClient*, QSignalSpy*> result = connectToServer(clientId, cleanSession, keepAlive, willTopic, willMessage, willQoS, willRetain);
@@ -94,6 +156,15 @@ void MqttTests::initTestCase()
 
 void MqttTests::cleanup()
 {
+    // In case a test failed before resetting it
+    m_server->setPersistence(nullptr);
+    m_server->setAuthorizer(nullptr);
+    m_server->setMaximumConcurrentHandshakes(0);
+    m_server->setMaximumConnectionRatePerAddress(0);
+    m_server->setMaximumInFlightMessages(0);
+    m_server->setRetransmissionInterval(0);
+    m_server->setSysTopicsInterval(0);
+
     while (!m_clients.isEmpty()) {
         MqttClient *client = m_clients.takeFirst();
         client->disconnectFromHost();
@@ -351,6 +422,74 @@ void MqttTests::testMultiSubscription()
     QCOMPARE(retCodes, subscriptionReturnCodes);
 }
 
+void MqttTests::testOverlappingSubscriptions()
+{
+    MqttClient *subscriber = connectAndWait("subscriber");
+    QSignalSpy subscribedSpy(subscriber, &MqttClient::subscribeResult);
+    MqttSubscriptions subscriptions = { MqttSubscription("a/#", Mqtt::QoS0), MqttSubscription("a/+", Mqtt::QoS1) };
+    subscriber->subscribe(subscriptions);
+    QTRY_VERIFY2(subscribedSpy.count() == 1, "Subscribed signal not received");
+
+    MqttClient *publisher = connectAndWait("publisher");
+    QSignalSpy serverPublishedSpy(m_server, &MqttServer::published);
+    QSignalSpy publishReceivedSpy(subscriber, &MqttClient::publishReceived);
+
+    // Both filters match, the message must be delivered only once, using the highest QoS
+    publisher->publish("a/b", "Hello world");
+    QTRY_VERIFY2(publishReceivedSpy.count() == 1, "Did not receive publish message");
+    QTRY_VERIFY2(serverPublishedSpy.count() == 1, "Server did not emit published");
+    QTest::qWait(200);
+    QVERIFY2(publishReceivedSpy.count() == 1, "Publish message delivered more than once");
+
+    // Dropping one of the filters must keep the other one active
+    QSignalSpy unsubscribedSpy(subscriber, &MqttClient::unsubscribed);
+    subscriber->unsubscribe("a/+");
+    QTRY_VERIFY2(unsubscribedSpy.count() == 1, "Unsubscribed signal not received");
+
+    publishReceivedSpy.clear();
+    publisher->publish("a/b", "Hello world 2");
+    QTRY_VERIFY2(publishReceivedSpy.count() == 1, "Did not receive publish message");
+
+    subscriber->unsubscribe("a/#");
+    QTRY_VERIFY2(unsubscribedSpy.count() == 2, "Unsubscribed signal not received");
+
+    publishReceivedSpy.clear();
+    publisher->publish("a/b", "Hello world 3");
+    QTest::qWait(500);
+    QVERIFY2(publishReceivedSpy.count() == 0, "Received publish packet even though we should not have");
+}
+
+void MqttTests::testFanOutMixedQoS()
+{
+    // Deletes the spies also when a check fails and returns early
+    struct SpyList : public QList<QSignalSpy*> {
+        ~SpyList() { qDeleteAll(*this); }
+    };
+
+    QList<MqttClient*> subscribers;
+    SpyList publishReceivedSpies;
+    for (int i = 0; i < 6; i++) {
+        MqttClient *subscriber = connectAndWait(QString("subscriber%1").arg(i));
+        QSignalSpy subscribedSpy(subscriber, &MqttClient::subscribeResult);
+        subscriber->subscribe("fanout/topic", static_cast<Mqtt::QoS>(i % 3));
+        QTRY_VERIFY2(subscribedSpy.count() == 1, "Subscribed signal not received");
+        subscribers.append(subscriber);
+        publishReceivedSpies.append(new QSignalSpy(subscriber, &MqttClient::publishReceived));
+    }
+
+    MqttClient *publisher = connectAndWait("publisher");
+    QSignalSpy serverPublishedSpy(m_server, &MqttServer::published);
+
+    // Every subscriber must receive an intact copy, regardless of the QoS it subscribed with
+    publisher->publish("fanout/topic", "Hello world", Mqtt::QoS1);
+    for (int i = 0; i < subscribers.count(); i++) {
+        QTRY_VERIFY2(publishReceivedSpies.at(i)->count() == 1, "Did not receive publish message");
+        QCOMPARE(publishReceivedSpies.at(i)->first().at(0).toString(), QString("fanout/topic"));
+        QCOMPARE(publishReceivedSpies.at(i)->first().at(1).toByteArray(), QByteArray("Hello world"));
+    }
+    QTRY_COMPARE(serverPublishedSpy.count(), subscribers.count());
+}
+
 void MqttTests::testSubscriptionTopicFilters_data()
 {
     QTest::addColumn<QString>("topicFilter");
@@ -475,6 +614,54 @@ void MqttTests::testSubscriptionTopicMatching()
     QVERIFY2(publishReceivedSpy.count() == receivedPublishMessageCount, QString("PublishReceived signal not received the expected amount of time.\nActual: %1\nExpected: %2").arg(publishReceivedSpy.count()).arg(receivedPublishMessageCount).toUtf8().data());
 }
 
+void MqttTests::testTopicMatcher_data()
+{
+    QTest::addColumn<QByteArray>("topicFilter");
+    QTest::addColumn<QByteArray>("topic");
+    QTest::addColumn<bool>("matches");
+
+    QList<QList<QByteArray> > rows;
+    rows.append({ "a", "a", "1" });
+    rows.append({ "a", "ab", "0" });
+    rows.append({ "ab", "a", "0" });
+    rows.append({ "/", "/", "1" });
+    rows.append({ "+", "", "1" });
+    rows.append({ "+", "a/", "0" });
+    rows.append({ "a/+", "a", "0" });
+    rows.append({ "a/+", "a/", "1" });
+    rows.append({ "a/+/c", "a/b/c", "1" });
+    rows.append({ "a/+/c", "a/b/d", "0" });
+    rows.append({ "a/#", "a", "1" });
+    rows.append({ "a/#", "ab", "0" });
+    rows.append({ "a/#", "a/b/c", "1" });
+    rows.append({ "a//+/#", "a//b/c", "1" });
+    rows.append({ "#", "$SYS/broker", "0" });
+    rows.append({ "+/broker", "$SYS/broker", "0" });
+    rows.append({ "$SYS/#", "$SYS/broker", "1" });
+    rows.append({ "$SYS/+", "$SYS/broker", "1" });
+    rows.append({ "$SYS/+", "$SYS/broker/uptime", "0" });
+    rows.append({ "a/\xc3\xa4/+", "a/\xc3\xa4/b", "1" });
+
+    foreach (const QList<QByteArray> &row, rows) {
+        QTest::newRow((row.at(0) + ", " + row.at(1)).constData()) << row.at(0) << row.at(1) << (row.at(2) == "1");
+    }
+}
+
+void MqttTests::testTopicMatcher()
+{
+    QFETCH(QByteArray, topicFilter);
+    QFETCH(QByteArray, topic);
+    QFETCH(bool, matches);
+
+    QVERIFY(MqttSubscription::isValidTopicFilter(topicFilter));
+    QCOMPARE(MqttSubscription::matchTopic(topicFilter, topic), matches);
+
+    // The retained message index walks the filter's levels itself and has to agree
+    MqttRetainedMessageIndex retainedMessages;
+    retainedMessages.append(topic, MqttPacket(MqttPacket::TypePublish, 0, Mqtt::QoS0, true));
+    QCOMPARE(retainedMessages.match(topicFilter).count(), matches ? 1 : 0);
+}
+
 void MqttTests::testSessionManagementDropOldSession()
 {
     MqttClient *client1Session1 = connectAndWait("client1");
@@ -633,6 +820,138 @@ void MqttTests::testQoS2PublishToClientIsCompletedOnSessionResume()
     QTRY_VERIFY2(publishReceivedSpy.count() == 1, "Client did not receive publish packet upon session resume");
 }
 
+void MqttTests::testQoS2SamePacketIdInBothDirections()
+{
+    m_server->setRetransmissionInterval(200);
+
+    MqttClient *client1 = connectAndWait("client1");
+    client1->setRetransmissionInterval(200);
+    QVERIFY(subscribeAndWait(client1, "ids/#", Mqtt::QoS2));
+    QSignalSpy publishReceivedSpy(client1, &MqttClient::publishReceived);
+    QSignalSpy client1PublishedSpy(client1, &MqttClient::published);
+    QSignalSpy disconnectedSpy(client1, &MqttClient::disconnected);
+    QSignalSpy serverPublishedSpy(m_server, &MqttServer::published);
+
+    MqttClient *client2 = connectAndWait("client2");
+    QSignalSpy client2PublishedSpy(client2, &MqttClient::published);
+    client2->publish("ids/first", "First", Mqtt::QoS2);
+    QTRY_COMPARE(publishReceivedSpy.count(), 1);
+
+    // Keep the server's next publish to client1 in flight...
+    client1->d_ptr->transport->blockSignals(true);
+    client2->publish("ids/second", "Second", Mqtt::QoS2);
+    QTRY_COMPARE(client2PublishedSpy.count(), 2);
+
+    // ... while client1 publishes with the same packet ID, both IDs count from 1 in this session
+    quint16 packetId = client1->publish("other/topic", "Other", Mqtt::QoS2);
+    QTest::qWait(200);
+    client1->d_ptr->transport->blockSignals(false);
+
+    QTRY_COMPARE(client1PublishedSpy.count(), 1);
+    QCOMPARE(client1PublishedSpy.first().at(0).toInt(), (int)packetId);
+    QTRY_COMPARE(publishReceivedSpy.count(), 2);
+    QCOMPARE(publishReceivedSpy.at(1).at(0).toString(), QString("ids/second"));
+    QTRY_COMPARE(client1->d_ptr->unackedPackets.count(), 0);
+    QVERIFY(client1->d_ptr->receivedQoS2PacketIds.isEmpty());
+    QCOMPARE(disconnectedSpy.count(), 0);
+
+    bool sameId = false;
+    foreach (const QList<QVariant> &published, serverPublishedSpy) {
+        if (published.at(0).toString() == "client1" && published.at(2).toString() == "ids/second") {
+            sameId = published.at(1).toInt() == packetId;
+        }
+    }
+    QVERIFY2(sameId, "The server didn't use the same packet ID... Test is bad.");
+}
+
+void MqttTests::testPersistentSession()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    MqttFilePersistence persistence(dir.filePath("mqtt.log"));
+    m_server->setPersistence(&persistence);
+
+    MqttClient *subscriber = connectAndWait("persistent-subscriber", false);
+    QVERIFY(subscribeAndWait(subscriber, "persistent/#", Mqtt::QoS1));
+    disconnectAndWait(subscriber);
+    QTRY_COMPARE(m_server->clients().count(), 0);
+
+    // Publish while the subscriber is offline
+    MqttClient *publisher = connectAndWait("persistent-publisher");
+    QSignalSpy publishedSpy(publisher, &MqttClient::published);
+    publisher->publish("persistent/retained", "Retained", Mqtt::QoS1, true);
+    publisher->publish("persistent/offline", "Offline", Mqtt::QoS1);
+    QTRY_COMPARE(publishedSpy.count(), 2);
+
+    // Restore a copy of the log, as a restarted server would
+    QVERIFY(QFile::copy(dir.filePath("mqtt.log"), dir.filePath("restored.log")));
+    MqttFilePersistence restoredPersistence(dir.filePath("restored.log"));
+    MqttPackets retainedMessages;
+    QList<MqttPersistentSession> sessions;
+    QVERIFY(restoredPersistence.restore(&retainedMessages, &sessions));
+    QCOMPARE(retainedMessages.count(), 1);
+    QCOMPARE(retainedMessages.first().topic(), QByteArray("persistent/retained"));
+    QCOMPARE(sessions.count(), 1);
+    QCOMPARE(sessions.first().clientId, QString("persistent-subscriber"));
+    QCOMPARE(sessions.first().subscriptions.count(), 1);
+    QCOMPARE(sessions.first().subscriptions.first().topicFilter(), QByteArray("persistent/#"));
+    QCOMPARE(sessions.first().unackedPackets.count(), 2);
+
+    // Resuming the session delivers the messages queued while offline
+    QPair<MqttClient*, QSignalSpy*> result = connectToServer("persistent-subscriber", false);
+    QSignalSpy publishReceivedSpy(result.first, &MqttClient::publishReceived);
+    QTRY_COMPARE(result.second->count(), 1);
+    QVERIFY2(result.second->first().at(1).value<Mqtt::ConnackFlags>().testFlag(Mqtt::ConnackFlagSessionPresent), "Session present flag is not set while it should be.");
+    delete result.second;
+    QTRY_COMPARE(publishReceivedSpy.count(), 2);
+
+    publisher->publish("persistent/retained", QByteArray(), Mqtt::QoS1, true);
+    QTRY_COMPARE(publishedSpy.count(), 3);
+
+    m_server->setPersistence(nullptr);
+}
+
+void MqttTests::testWillLeavesPersistentSessionAlone()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    MqttFilePersistence persistence(dir.filePath("mqtt.log"));
+    m_server->setPersistence(&persistence);
+
+    MqttClient *subscriber = connectAndWait("will-subscriber");
+    QVERIFY(subscribeAndWait(subscriber, "will/#", Mqtt::QoS2));
+    QSignalSpy publishReceivedSpy(subscriber, &MqttClient::publishReceived);
+
+    MqttClient *client = connectAndWait("will-client", false, 300, "will/qos2", "Bye bye", Mqtt::QoS2);
+    client->setAutoReconnect(false);
+    client->d_ptr->transport->abort();
+    QTRY_COMPARE(publishReceivedSpy.count(), 1);
+    QCOMPARE(publishReceivedSpy.first().at(1).toByteArray(), QByteArray("Bye bye"));
+    QTRY_COMPARE(m_server->clients().count(), 1);
+
+    // The will is published by the server, nothing of it ends up in the client's session
+    QVERIFY(QFile::copy(dir.filePath("mqtt.log"), dir.filePath("restored.log")));
+    MqttFilePersistence restoredPersistence(dir.filePath("restored.log"));
+    MqttPackets retainedMessages;
+    QList<MqttPersistentSession> sessions;
+    QVERIFY(restoredPersistence.restore(&retainedMessages, &sessions));
+    QCOMPARE(sessions.count(), 1);
+    QCOMPARE(sessions.first().clientId, QString("will-client"));
+    QCOMPARE(sessions.first().unackedPackets.count(), 0);
+
+    // Resuming the session doesn't send a PUBREC for a publish the client never sent
+    QPair<MqttClient*, QSignalSpy*> result = connectToServer("will-client", false);
+    QSignalSpy publishedSpy(result.first, &MqttClient::published);
+    QTRY_COMPARE(result.second->count(), 1);
+    QVERIFY(result.second->first().at(1).value<Mqtt::ConnackFlags>().testFlag(Mqtt::ConnackFlagSessionPresent));
+    delete result.second;
+    QTest::qWait(500);
+    QCOMPARE(publishedSpy.count(), 0);
+    QCOMPARE(result.first->d_ptr->unackedPackets.count(), 0);
+
+    m_server->setPersistence(nullptr);
+}
+
 void MqttTests::testRetain()
 {
     MqttClient *client1 = connectAndWait("client1", true);
@@ -721,6 +1040,44 @@ void MqttTests::testRetain()
 
 }
 
+void MqttTests::testRetainWildcardSubscription()
+{
+    MqttClient *client1 = connectAndWait("client1");
+    QSignalSpy publishedSpy(client1, &MqttClient::published);
+    client1->publish("site/1/device1/status", "on", Mqtt::QoS1, true);
+    client1->publish("site/1/device2/status", "off", Mqtt::QoS1, true);
+    client1->publish("site/1/device1/power", "10", Mqtt::QoS1, true);
+    client1->publish("site/2/device1/status", "on", Mqtt::QoS1, true);
+    client1->publish("site/1/device3/status", "on", Mqtt::QoS1, false);
+    QTRY_VERIFY(publishedSpy.count() == 5);
+
+    MqttClient *client2 = connectAndWait("client2");
+    QSignalSpy publishReceivedSpy(client2, &MqttClient::publishReceived);
+    client2->subscribe("site/1/+/status", Mqtt::QoS1);
+    QTRY_VERIFY2(publishReceivedSpy.count() == 2, "Did not receive retained messages on subscribe.");
+    QTest::qWait(500);
+    QCOMPARE(publishReceivedSpy.count(), 2);
+    QStringList topics;
+    foreach (const QVariantList &args, publishReceivedSpy) {
+        topics.append(args.at(0).toString());
+        QVERIFY2(args.at(2).toBool() == true, "Retain flag not set");
+    }
+    topics.sort();
+    QCOMPARE(topics, QStringList() << "site/1/device1/status" << "site/1/device2/status");
+
+    publishReceivedSpy.clear();
+    client2->subscribe("site/#", Mqtt::QoS1);
+    QTRY_VERIFY2(publishReceivedSpy.count() == 4, "Did not receive retained messages on subscribe.");
+
+    // Clear the retained messages again, not to interfere with other tests
+    publishedSpy.clear();
+    client1->publish("site/1/device1/status", QByteArray(), Mqtt::QoS1, true);
+    client1->publish("site/1/device2/status", QByteArray(), Mqtt::QoS1, true);
+    client1->publish("site/1/device1/power", QByteArray(), Mqtt::QoS1, true);
+    client1->publish("site/2/device1/status", QByteArray(), Mqtt::QoS1, true);
+    QTRY_VERIFY(publishedSpy.count() == 4);
+}
+
 void MqttTests::testUnsubscribe()
 {
     MqttClient *client1 = connectAndWait("client1");
@@ -780,4 +1137,491 @@ void MqttTests::testBinaryPaylaod()
     QCOMPARE(publishReceivedSpy.first().at(1).toByteArray(), payload);
 }
 
+void MqttTests::testLargePayload_data()
+{
+    QTest::addColumn<int>("payloadSize");
+
+    // Sizes requiring 2, 3 and 4 bytes for the Remaining Length field
+    QTest::newRow("1 KiB") << 1024;
+    QTest::newRow("100 KiB") << 100 * 1024;
+    QTest::newRow("3 MiB") << 3 * 1024 * 1024;
+}
+
+void MqttTests::testLargePayload()
+{
+    QFETCH(int, payloadSize);
+
+    MqttClient *subscriber = connectAndWait("subscriber");
+    QVERIFY(subscribeAndWait(subscriber, "large/#"));
+    QSignalSpy publishReceivedSpy(subscriber, &MqttClient::publishReceived);
+
+    QByteArray payload(payloadSize, '\0');
+    for (int i = 0; i < payload.length(); i++) {
+        payload[i] = static_cast<char>(i % 251);
+    }
+
+    MqttClient *publisher = connectAndWait("publisher");
+    publisher->publish("large/payload", payload, Mqtt::QoS1);
+
+    QTRY_VERIFY2(publishReceivedSpy.count() == 1, "Did not receive publish message");
+    QCOMPARE(publishReceivedSpy.first().at(0).toString(), QString("large/payload"));
+    QVERIFY2(publishReceivedSpy.first().at(1).toByteArray() == payload, "Payload not matching");
+}
+
+void MqttTests::testMaximumPacketSize()
+{
+    m_server->setMaximumPacketSize(1024);
+
+    MqttClient *client = connectAndWait("client1");
+    QVERIFY(subscribeAndWait(client, "#"));
+    QSignalSpy publishReceivedSpy(client, &MqttClient::publishReceived);
+    QSignalSpy disconnectedSpy(client, &MqttClient::disconnected);
+
+    client->publish("small", QByteArray(512, 'a'));
+    QTRY_VERIFY2(publishReceivedSpy.count() == 1, "Did not receive publish message");
+
+    client->publish("large", QByteArray(2048, 'a'));
+    QTRY_VERIFY2(disconnectedSpy.count() == 1, "Server did not drop the connection for an oversized packet");
+    QCOMPARE(publishReceivedSpy.count(), 1);
+
+    m_server->setMaximumPacketSize(268435460);
+}
+
+void MqttTests::testWorkerThreads()
+{
+    m_server->setWorkerThreadCount(2);
+
+    // Connections are distributed round robin, so subscriber and publisher end up in different threads
+    MqttClient *subscriber = connectAndWait("subscriber");
+    QVERIFY(subscribeAndWait(subscriber, "threads/#", Mqtt::QoS1));
+    QSignalSpy publishReceivedSpy(subscriber, &MqttClient::publishReceived);
+
+    MqttClient *publisher = connectAndWait("publisher");
+    QSignalSpy publishedSpy(publisher, &MqttClient::published);
+
+    for (int i = 0; i < 10; i++) {
+        publisher->publish(QString("threads/%1").arg(i), QByteArray::number(i), Mqtt::QoS1);
+    }
+    QTRY_COMPARE(publishedSpy.count(), 10);
+    QTRY_COMPARE(publishReceivedSpy.count(), 10);
+    for (int i = 0; i < 10; i++) {
+        QCOMPARE(publishReceivedSpy.at(i).at(0).toString(), QString("threads/%1").arg(i));
+        QCOMPARE(publishReceivedSpy.at(i).at(1).toByteArray(), QByteArray::number(i));
+    }
+
+    disconnectAndWait(publisher);
+    QTRY_COMPARE(m_server->clients().count(), 1);
+
+    // The worker threads frame and parse the packets, including checking the maximum packet size
+    m_server->setMaximumPacketSize(1024);
+    const quint64 parseErrors = m_server->parseErrorsCount();
+    QSignalSpy disconnectedSpy(subscriber, &MqttClient::disconnected);
+    subscriber->publish("threads/large", QByteArray(2048, 'a'));
+    QTRY_VERIFY2(disconnectedSpy.count() == 1, "Server did not drop the connection for an oversized packet");
+    QCOMPARE(m_server->parseErrorsCount(), parseErrors + 1);
+    QCOMPARE(publishReceivedSpy.count(), 10);
+
+    m_server->setMaximumPacketSize(268435460);
+    m_server->setWorkerThreadCount(0);
+}
+
+void MqttTests::testOutboundQueueLimits()
+{
+    m_server->setMaximumOutboundQueueMessages(10);
+    m_server->setOutboundQueueOverflowPolicy(MqttServer::OutboundQueueOverflowDropOldestQoS0);
+
+    MqttClient *subscriber = connectAndWait("subscriber");
+    QVERIFY(subscribeAndWait(subscriber, "queue/topic", Mqtt::QoS0));
+    QSignalSpy publishReceivedSpy(subscriber, &MqttClient::publishReceived);
+
+    // Without returning to the event loop nothing gets sent, the first publish fills the connection's
+    // write buffer and the following ones pile up in the outbound queue.
+    quint64 droppedBefore = m_server->droppedMessagesCount();
+    quint64 sentBefore = m_server->sentMessagesCount(Mqtt::QoS0);
+    for (int i = 0; i < 100; i++) {
+        m_server->publish("queue/topic", QByteArray::number(i).leftJustified(100 * 1024, ' '));
+    }
+    QCOMPARE(m_server->outboundQueueMessages("subscriber"), 10);
+    QVERIFY(m_server->outboundQueueBytes("subscriber") >= 11 * 100 * 1024);
+    QCOMPARE(m_server->droppedMessagesCount() - droppedBefore, static_cast<quint64>(89));
+    // Every publish is either sent or dropped, never both
+    QCOMPARE(m_server->sentMessagesCount(Mqtt::QoS0) - sentBefore + m_server->droppedMessagesCount() - droppedBefore, static_cast<quint64>(100));
+
+    // The first one and the newest ones make it through
+    QTRY_COMPARE(publishReceivedSpy.count(), 11);
+    QCOMPARE(publishReceivedSpy.first().at(1).toByteArray().trimmed(), QByteArray("0"));
+    QCOMPARE(publishReceivedSpy.last().at(1).toByteArray().trimmed(), QByteArray("99"));
+    QCOMPARE(m_server->outboundQueueMessages("subscriber"), 0);
+
+    m_server->setOutboundQueueOverflowPolicy(MqttServer::OutboundQueueOverflowDisconnect);
+    QSignalSpy disconnectedSpy(subscriber, &MqttClient::disconnected);
+    for (int i = 0; i < 20; i++) {
+        m_server->publish("queue/topic", QByteArray(100 * 1024, 'x'));
+    }
+    QTRY_COMPARE(disconnectedSpy.count(), 1);
+    QTRY_VERIFY(!m_server->clients().contains("subscriber"));
+
+    // Pausing keeps queueing past the limits as long as the queue drains
+    m_server->setOutboundQueueOverflowPolicy(MqttServer::OutboundQueueOverflowPausePublishers);
+    MqttClient *pausingSubscriber = connectAndWait("pausing-subscriber");
+    QVERIFY(subscribeAndWait(pausingSubscriber, "queue/topic", Mqtt::QoS0));
+    QSignalSpy pausingPublishReceivedSpy(pausingSubscriber, &MqttClient::publishReceived);
+    QSignalSpy pausingDisconnectedSpy(pausingSubscriber, &MqttClient::disconnected);
+    for (int i = 0; i < 15; i++) {
+        m_server->publish("queue/topic", QByteArray(100 * 1024, 'x'));
+    }
+    QTRY_COMPARE(pausingPublishReceivedSpy.count(), 15);
+    QCOMPARE(pausingDisconnectedSpy.count(), 0);
+
+    // But not without bound
+    for (int i = 0; i < 30; i++) {
+        m_server->publish("queue/topic", QByteArray(100 * 1024, 'x'));
+    }
+    QTRY_COMPARE(pausingDisconnectedSpy.count(), 1);
+    QTRY_VERIFY(!m_server->clients().contains("pausing-subscriber"));
+
+    m_server->setMaximumOutboundQueueMessages(0);
+    m_server->setOutboundQueueOverflowPolicy(MqttServer::OutboundQueueOverflowDropOldestQoS0);
+}
+
+void MqttTests::testPublishAuthorizationCache()
+{
+    TestAuthorizer authorizer;
+    authorizer.deniedTopics << "auth/denied";
+    m_server->setAuthorizer(&authorizer);
+
+    MqttClient *subscriber = connectAndWait("subscriber");
+    QVERIFY(subscribeAndWait(subscriber, "auth/#", Mqtt::QoS1));
+    QSignalSpy publishReceivedSpy(subscriber, &MqttClient::publishReceived);
+
+    MqttClient *publisher = connectAndWait("publisher");
+    QSignalSpy publishedSpy(publisher, &MqttClient::published);
+    for (int i = 0; i < 10; i++) {
+        publisher->publish("auth/allowed", QByteArray::number(i), Mqtt::QoS1);
+        publisher->publish("auth/denied", QByteArray::number(i), Mqtt::QoS1);
+    }
+    QTRY_COMPARE(publishedSpy.count(), 20);
+    QTRY_COMPARE(publishReceivedSpy.count(), 10);
+    for (int i = 0; i < publishReceivedSpy.count(); i++) {
+        QCOMPARE(publishReceivedSpy.at(i).at(0).toString(), QString("auth/allowed"));
+    }
+    // The authorizer is asked once per topic only
+    QCOMPARE(authorizer.publishChecks, 2);
+
+    // Invalidating makes the server ask again
+    authorizer.deniedTopics.clear();
+    authorizer.invalidateAuthorizations();
+    publisher->publish("auth/denied", "allowed now", Mqtt::QoS1);
+    QTRY_COMPARE(publishReceivedSpy.count(), 11);
+    QCOMPARE(publishReceivedSpy.last().at(0).toString(), QString("auth/denied"));
+    QCOMPARE(authorizer.publishChecks, 3);
+
+    m_server->setAuthorizer(nullptr);
+}
+
+void MqttTests::testAsyncAuthorizer()
+{
+    SlowAuthorizer authorizer;
+    m_server->setAsyncAuthorizer(&authorizer);
+
+    MqttClient *subscriber = connectAndWait("subscriber");
+    QVERIFY(subscriber->isConnected());
+    QVERIFY(subscribeAndWait(subscriber, "async/#", Mqtt::QoS1));
+    QSignalSpy publishReceivedSpy(subscriber, &MqttClient::publishReceived);
+
+    // Packets following one which waits for a decision are held back, so everything is relayed in order
+    MqttClient *publisher = connectAndWait("publisher");
+    QSignalSpy publishedSpy(publisher, &MqttClient::published);
+    for (int i = 0; i < 5; i++) {
+        publisher->publish(QString("async/%1").arg(i), QByteArray::number(i), Mqtt::QoS1);
+        publisher->publish("async/denied", QByteArray::number(i), Mqtt::QoS1);
+    }
+    QTRY_COMPARE(publishedSpy.count(), 10);
+    QTRY_COMPARE(publishReceivedSpy.count(), 5);
+    for (int i = 0; i < 5; i++) {
+        QCOMPARE(publishReceivedSpy.at(i).at(0).toString(), QString("async/%1").arg(i));
+    }
+
+    // While a connection waits for a decision, the others are served
+    QPair<MqttClient*, QSignalSpy*> slowClient = connectToServer("slow");
+    publisher->publish("async/0", "cached", Mqtt::QoS1);
+    QTRY_COMPARE(publishReceivedSpy.count(), 6);
+    QCOMPARE(slowClient.second->count(), 0);
+    QTRY_COMPARE(slowClient.second->count(), 1);
+    delete slowClient.second;
+
+    m_server->setAsyncAuthorizer(nullptr);
+}
+
+void MqttTests::testAdmissionControl()
+{
+    HoldingAuthorizer authorizer;
+    m_server->setAsyncAuthorizer(&authorizer);
+    m_server->setMaximumConcurrentHandshakes(1);
+    quint64 handshakeCount = m_server->handshakeCount();
+
+    // The first handshake lasts until its CONNACK, the second connection waits in the accept queue meanwhile
+    QPair<MqttClient*, QSignalSpy*> first = connectToServer("first");
+    QTRY_COMPARE(authorizer.pendingConnects.count(), 1);
+    QPair<MqttClient*, QSignalSpy*> second = connectToServer("second");
+    QTRY_COMPARE(m_server->acceptQueueLength(), 1);
+    QCOMPARE(m_server->handshakesInProgress(), 1);
+    QTest::qWait(200);
+    QCOMPARE(authorizer.pendingConnects.count(), 1);
+
+    authorizer.pendingConnects.takeFirst()(Mqtt::ConnectReturnCodeAccepted);
+    QTRY_COMPARE(first.second->count(), 1);
+    QTRY_COMPARE(authorizer.pendingConnects.count(), 1);
+    QCOMPARE(m_server->acceptQueueLength(), 0);
+    QCOMPARE(second.second->count(), 0);
+
+    authorizer.pendingConnects.takeFirst()(Mqtt::ConnectReturnCodeAccepted);
+    QTRY_COMPARE(second.second->count(), 1);
+    QCOMPARE(m_server->handshakesInProgress(), 0);
+    QCOMPARE(m_server->handshakeCount(), handshakeCount + 2);
+    delete first.second;
+    delete second.second;
+
+    m_server->setAsyncAuthorizer(nullptr);
+    m_server->setMaximumConcurrentHandshakes(0);
+
+    // Connections exceeding the rate of their address are closed before their handshake
+    m_server->setMaximumConnectionRatePerAddress(2);
+    quint64 rejectedConnections = m_server->rejectedConnectionsCount();
+    QVERIFY(connectAndWait("rate1")->isConnected());
+    QVERIFY(connectAndWait("rate2")->isConnected());
+    QPair<MqttClient*, QSignalSpy*> rejected = connectToServer("rate3");
+    QSignalSpy disconnectedSpy(rejected.first, &MqttClient::disconnected);
+    QTRY_COMPARE(disconnectedSpy.count(), 1);
+    QCOMPARE(rejected.second->count(), 0);
+    QCOMPARE(m_server->rejectedConnectionsCount(), rejectedConnections + 1);
+    delete rejected.second;
+}
+
+void MqttTests::testHandshakeTimeout()
+{
+    HoldingAuthorizer authorizer;
+    m_server->setAsyncAuthorizer(&authorizer);
+    m_server->setMaximumConcurrentHandshakes(1);
+
+    // An authorizer which never decides holds neither the connection nor its handshake slot for good
+    QPair<MqttClient*, QSignalSpy*> held = connectToServer("held");
+    held.first->setAutoReconnect(false);
+    QSignalSpy disconnectedSpy(held.first, &MqttClient::disconnected);
+    QTRY_COMPARE(authorizer.pendingConnects.count(), 1);
+    QPair<MqttClient*, QSignalSpy*> waiting = connectToServer("waiting");
+    QTRY_COMPARE(m_server->acceptQueueLength(), 1);
+
+    QTRY_COMPARE_WITH_TIMEOUT(disconnectedSpy.count(), 1, 15000);
+    QCOMPARE(held.second->count(), 0);
+    QTRY_COMPARE(authorizer.pendingConnects.count(), 2);
+
+    // A late decision for the dropped connection is ignored
+    authorizer.pendingConnects.takeFirst()(Mqtt::ConnectReturnCodeAccepted);
+    authorizer.pendingConnects.takeFirst()(Mqtt::ConnectReturnCodeAccepted);
+    QTRY_COMPARE(waiting.second->count(), 1);
+    QCOMPARE(m_server->handshakesInProgress(), 0);
+    QCOMPARE(m_server->clients(), QStringList{"waiting"});
+    delete held.second;
+    delete waiting.second;
+
+    m_server->setAsyncAuthorizer(nullptr);
+    m_server->setMaximumConcurrentHandshakes(0);
+}
+
+void MqttTests::testPendingAuthorizationPausesReading()
+{
+    HoldingAuthorizer authorizer;
+    m_server->setAsyncAuthorizer(&authorizer);
+
+    QPair<MqttClient*, QSignalSpy*> subscriber = connectToServer("subscriber");
+    QTRY_COMPARE(authorizer.pendingConnects.count(), 1);
+    authorizer.pendingConnects.takeFirst()(Mqtt::ConnectReturnCodeAccepted);
+    QTRY_COMPARE(subscriber.second->count(), 1);
+    QVERIFY(subscribeAndWait(subscriber.first, "held/#", Mqtt::QoS0));
+    QSignalSpy publishReceivedSpy(subscriber.first, &MqttClient::publishReceived);
+
+    QPair<MqttClient*, QSignalSpy*> publisher = connectToServer("publisher");
+    QTRY_COMPARE(authorizer.pendingConnects.count(), 1);
+    authorizer.pendingConnects.takeFirst()(Mqtt::ConnectReturnCodeAccepted);
+    QTRY_COMPARE(publisher.second->count(), 1);
+
+    // While the decision for the first publish is held, what the publisher sends waits in the network instead of the server
+    authorizer.holdPublishes = true;
+    publisher.first->publish("held/0", "0");
+    QTRY_COMPARE(authorizer.pendingPublishes.count(), 1);
+    const quint64 receivedBytes = m_server->receivedBytesCount();
+    for (int i = 1; i <= 100; i++) {
+        publisher.first->publish(QString("held/%1").arg(i), QByteArray::number(i).leftJustified(10 * 1024, ' '));
+    }
+    QTest::qWait(500);
+    QCOMPARE(authorizer.pendingPublishes.count(), 1);
+    QVERIFY(m_server->receivedBytesCount() - receivedBytes < 100 * 10 * 1024 / 2);
+
+    // Reading resumes with the decision and nothing is lost or reordered
+    authorizer.holdPublishes = false;
+    authorizer.pendingPublishes.takeFirst()(true);
+    QTRY_COMPARE(publishReceivedSpy.count(), 101);
+    for (int i = 0; i <= 100; i++) {
+        QCOMPARE(publishReceivedSpy.at(i).at(0).toString(), QString("held/%1").arg(i));
+    }
+    delete subscriber.second;
+    delete publisher.second;
+
+    m_server->setAsyncAuthorizer(nullptr);
+}
+
+void MqttTests::testInFlightWindow()
+{
+    m_server->setMaximumInFlightMessages(1);
+
+    MqttClient *subscriber = connectAndWait("subscriber");
+    QVERIFY(subscribeAndWait(subscriber, "window/#", Mqtt::QoS2));
+    QSignalSpy publishReceivedSpy(subscriber, &MqttClient::publishReceived);
+
+    // The publisher only sends the next publish once the previous one has been acknowledged
+    MqttClient *publisher = connectAndWait("publisher");
+    publisher->setMaximumInFlightMessages(1);
+    QSignalSpy publishedSpy(publisher, &MqttClient::published);
+    for (int i = 0; i < 5; i++) {
+        publisher->publish(QString("window/%1").arg(i), QByteArray::number(i), i % 2 ? Mqtt::QoS1 : Mqtt::QoS2);
+    }
+    QCOMPARE(publisher->d_ptr->unackedPackets.count(), 5);
+    QCOMPARE(publisher->d_ptr->unackedPackets.inFlightCount(), 1);
+
+    QTRY_COMPARE(publishedSpy.count(), 5);
+    QTRY_COMPARE(publishReceivedSpy.count(), 5);
+    for (int i = 0; i < 5; i++) {
+        QCOMPARE(publishedSpy.at(i).at(1).toString(), QString("window/%1").arg(i));
+        QCOMPARE(publishReceivedSpy.at(i).at(0).toString(), QString("window/%1").arg(i));
+    }
+    QTRY_COMPARE(publisher->d_ptr->unackedPackets.count(), 0);
+}
+
+void MqttTests::testRetransmission()
+{
+    m_server->setRetransmissionInterval(200);
+
+    MqttClient *subscriber = connectAndWait("subscriber");
+    QVERIFY(subscribeAndWait(subscriber, "retransmission/#", Mqtt::QoS1));
+    QSignalSpy publishReceivedSpy(subscriber, &MqttClient::publishReceived);
+
+    // Everything sent to the subscriber is lost for now
+    subscriber->d_ptr->transport->blockSignals(true);
+
+    MqttClient *publisher = connectAndWait("publisher");
+    QSignalSpy publishedSpy(m_server, &MqttServer::published);
+    publisher->publish("retransmission/topic", "payload", Mqtt::QoS1);
+
+    // Retransmitted after 200 and another 400 milliseconds
+    QTRY_VERIFY(m_server->retransmittedMessagesCount() >= 2);
+    QCOMPARE(publishedSpy.count(), 0);
+
+    subscriber->d_ptr->transport->blockSignals(false);
+    QTRY_VERIFY(publishReceivedSpy.count() > 0);
+    QTRY_COMPARE(publishedSpy.count(), 1);
+    QCOMPARE(publishReceivedSpy.first().at(0).toString(), QString("retransmission/topic"));
+
+    // Nothing is retransmitted once acknowledged
+    const quint64 retransmitted = m_server->retransmittedMessagesCount();
+    QTest::qWait(1000);
+    QCOMPARE(m_server->retransmittedMessagesCount(), retransmitted);
+}
+
+void MqttTests::testStatistics()
+{
+    TestAuthorizer authorizer;
+    m_server->setAuthorizer(&authorizer);
+
+    const quint64 receivedMessages = m_server->receivedMessagesCount(Mqtt::QoS1);
+    const quint64 sentMessages = m_server->sentMessagesCount(Mqtt::QoS1);
+    const quint64 receivedBytes = m_server->receivedBytesCount();
+    const quint64 sentBytes = m_server->sentBytesCount();
+    quint64 authorizations = 0;
+    foreach (quint64 count, m_server->authorizationLatencyCounts()) {
+        authorizations += count;
+    }
+    QCOMPARE(m_server->authorizationLatencyCounts().count(), MqttServer::authorizationLatencyBounds().count() + 1);
+
+    MqttClient *subscriber = connectAndWait("subscriber");
+    QVERIFY(subscribeAndWait(subscriber, "statistics/#", Mqtt::QoS1));
+    QSignalSpy publishReceivedSpy(subscriber, &MqttClient::publishReceived);
+
+    MqttClient *publisher = connectAndWait("publisher");
+    QSignalSpy publishedSpy(publisher, &MqttClient::published);
+    publisher->publish("statistics/topic", "payload", Mqtt::QoS1);
+    QTRY_COMPARE(publishedSpy.count(), 1);
+    QTRY_COMPARE(publishReceivedSpy.count(), 1);
+
+    QCOMPARE(m_server->receivedMessagesCount(Mqtt::QoS1), receivedMessages + 1);
+    QCOMPARE(m_server->sentMessagesCount(Mqtt::QoS1), sentMessages + 1);
+    QVERIFY(m_server->receivedBytesCount() > receivedBytes);
+    QVERIFY(m_server->sentBytesCount() > sentBytes);
+
+    // Two connects, a subscribe and a publish
+    quint64 authorizationsAfter = 0;
+    foreach (quint64 count, m_server->authorizationLatencyCounts()) {
+        authorizationsAfter += count;
+    }
+    QCOMPARE(authorizationsAfter, authorizations + 4);
+}
+
+void MqttTests::testSysTopics()
+{
+    MqttClient *sysSubscriber = connectAndWait("sys-subscriber");
+    QVERIFY(subscribeAndWait(sysSubscriber, "$SYS/broker/#", Mqtt::QoS0));
+    QSignalSpy sysPublishReceivedSpy(sysSubscriber, &MqttClient::publishReceived);
+    MqttClient *wildcardSubscriber = connectAndWait("wildcard-subscriber");
+    QVERIFY(subscribeAndWait(wildcardSubscriber, "#", Mqtt::QoS0));
+    QSignalSpy wildcardPublishReceivedSpy(wildcardSubscriber, &MqttClient::publishReceived);
+
+    // Published right away
+    m_server->setSysTopicsInterval(1);
+    QTRY_VERIFY(sysPublishReceivedSpy.count() > 0);
+    QHash<QString, QByteArray> values;
+    for (int i = 0; i < sysPublishReceivedSpy.count(); i++) {
+        values.insert(sysPublishReceivedSpy.at(i).at(0).toString(), sysPublishReceivedSpy.at(i).at(1).toByteArray());
+    }
+    QCOMPARE(values.value("$SYS/broker/clients/connected"), QByteArray("2"));
+    QVERIFY(values.contains("$SYS/broker/uptime"));
+    QVERIFY(values.contains("$SYS/broker/publish/messages/received"));
+    QVERIFY(values.contains("$SYS/broker/load/publish/sent/15min"));
+
+    // And again after the interval
+    const int count = sysPublishReceivedSpy.count();
+    QTRY_VERIFY_WITH_TIMEOUT(sysPublishReceivedSpy.count() >= count * 2, 3000);
+    QCOMPARE(wildcardPublishReceivedSpy.count(), 0);
+
+    // Clients can't publish to $ topics
+    MqttClient *publisher = connectAndWait("publisher");
+    QSignalSpy publishedSpy(publisher, &MqttClient::published);
+    publisher->publish("$SYS/broker/uptime", "forever", Mqtt::QoS1);
+    QTRY_COMPARE(publishedSpy.count(), 1);
+    QTest::qWait(200);
+    for (int i = 0; i < sysPublishReceivedSpy.count(); i++) {
+        QVERIFY(sysPublishReceivedSpy.at(i).at(1).toByteArray() != "forever");
+    }
+
+    // New subscribers get the retained values
+    MqttClient *lateSubscriber = connectAndWait("late-subscriber");
+    QSignalSpy latePublishReceivedSpy(lateSubscriber, &MqttClient::publishReceived);
+    QVERIFY(subscribeAndWait(lateSubscriber, "$SYS/broker/uptime", Mqtt::QoS0));
+    QTRY_VERIFY(latePublishReceivedSpy.count() > 0);
+    QVERIFY(latePublishReceivedSpy.first().at(2).toBool());
+
+    // Disabling drops them
+    m_server->setSysTopicsInterval(0);
+    MqttClient *lastSubscriber = connectAndWait("last-subscriber");
+    QSignalSpy lastPublishReceivedSpy(lastSubscriber, &MqttClient::publishReceived);
+    QVERIFY(subscribeAndWait(lastSubscriber, "$SYS/broker/#", Mqtt::QoS0));
+    QTest::qWait(500);
+    QCOMPARE(lastPublishReceivedSpy.count(), 0);
+
+    // Intervals are capped at what fits in the timer's milliseconds
+    m_server->setSysTopicsInterval(std::numeric_limits<int>::max());
+    QCOMPARE(m_server->sysTopicsInterval(), std::numeric_limits<int>::max() / 1000);
+    m_server->setSysTopicsInterval(-1);
+    QCOMPARE(m_server->sysTopicsInterval(), 0);
+}
+
 #endif
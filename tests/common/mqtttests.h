@@ -57,12 +57,19 @@ private slots:
 
     void testMultiSubscription();
 
+    void testOverlappingSubscriptions();
+
+    void testFanOutMixedQoS();
+
     void testSubscriptionTopicFilters_data();
     void testSubscriptionTopicFilters();
 
     void testSubscriptionTopicMatching_data();
     void testSubscriptionTopicMatching();
 
+    void testTopicMatcher_data();
+    void testTopicMatcher();
+
     void testSessionManagementDropOldSession();
     void testSessionManagementResumeOldSession();
     void testSessionManagementFailResumeOldSession();
@@ -74,13 +81,44 @@ private slots:
 
     void testQoS2PublishToClientIsCompletedOnSessionResume();
 
+    void testQoS2SamePacketIdInBothDirections();
+
+    void testPersistentSession();
+    void testWillLeavesPersistentSessionAlone();
+
     void testRetain();
+    void testRetainWildcardSubscription();
 
     void testUnsubscribe();
 
     void testEmptyClientId();
 
     void testBinaryPaylaod();
+
+    void testLargePayload_data();
+    void testLargePayload();
+
+    void testMaximumPacketSize();
+
+    void testWorkerThreads();
+
+    void testOutboundQueueLimits();
+
+    void testPublishAuthorizationCache();
+
+    void testAsyncAuthorizer();
+
+    void testAdmissionControl();
+    void testHandshakeTimeout();
+    void testPendingAuthorizationPausesReading();
+
+    void testInFlightWindow();
+
+    void testRetransmission();
+
+    void testStatistics();
+
+    void testSysTopics();
 #endif
 
 private:
@@ -0,0 +1,355 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "loadtest.h"
+#include "mqttserver.h"
+#include "mqttclient.h"
+
+#include <QDebug>
+#include <QEventLoop>
+#include <QFile>
+#include <QTimer>
+#include <QtEndian>
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#endif
+
+// Connections are opened in batches to stay within the listen backlog
+static const int connectBatchSize = 100;
+
+LoadTest::LoadTest(const LoadTestOptions &options, QObject *parent):
+    QObject(parent),
+    m_options(options)
+{
+    m_clock.start();
+
+    m_server = new MqttServer(this);
+    m_server->setWorkerThreadCount(m_options.workerThreads);
+    int serverId = m_server->listen(QHostAddress::LocalHost, 0);
+    if (serverId >= 0) {
+        m_port = m_server->listeningAddress(serverId).second;
+    }
+}
+
+LoadTest::~LoadTest()
+{
+    delete m_server;
+}
+
+bool LoadTest::isListening() const
+{
+    return m_port != 0;
+}
+
+QJsonObject LoadTest::runFanOut(Mqtt::QoS qos)
+{
+    return runRelay("fanout", qos, 1, m_options.clients);
+}
+
+QJsonObject LoadTest::runIngest(Mqtt::QoS qos)
+{
+    return runRelay("ingest", qos, m_options.clients, 1);
+}
+
+QJsonObject LoadTest::runRetainedSubscribe(Mqtt::QoS qos)
+{
+    const QString scenario = "retained";
+    QList<MqttClient*> publishers = connectClients(scenario + "-publisher", 1);
+    if (publishers.isEmpty()) {
+        return createError(scenario, qos, "Publisher could not connect");
+    }
+
+    // The retained messages are stored with QoS 1 to know when the server has them
+    MqttClient *publisher = publishers.first();
+    int storedCount = 0;
+    connect(publisher, &MqttClient::published, this, [&storedCount](){ storedCount++; });
+    for (int i = 0; i < m_options.retainedMessages; i++) {
+        // Packet IDs are limited, keep at most 1000 publishes in flight
+        publisher->publish(QString("loadtest/retained/%1").arg(i), createPayload(), Mqtt::QoS1, true);
+        if (storedCount + 1000 <= i && !waitFor([&](){ return storedCount + 1000 > i; })) {
+            break;
+        }
+    }
+    const bool stored = waitFor([&](){ return storedCount == m_options.retainedMessages; });
+    disconnectClients(publishers);
+    if (!stored) {
+        return createError(scenario, qos, "Retained messages have not been stored in time");
+    }
+
+    QList<MqttClient*> subscribers = connectClients(scenario + "-subscriber", m_options.clients);
+    if (subscribers.count() != m_options.clients) {
+        disconnectClients(subscribers);
+        return createError(scenario, qos, "Subscribers could not connect");
+    }
+    foreach (MqttClient *subscriber, subscribers) {
+        connect(subscriber, &MqttClient::publishReceived, this, [this](const QString &, const QByteArray &payload, bool){
+            onPublishReceived(payload);
+        });
+    }
+
+    const int expectedCount = m_options.clients * m_options.retainedMessages;
+    m_latencies.clear();
+    m_latencies.reserve(expectedCount);
+    m_receivedCount = 0;
+    m_subscribeTime = m_clock.nsecsElapsed();
+    foreach (MqttClient *subscriber, subscribers) {
+        subscriber->subscribe("loadtest/retained/#", qos);
+    }
+    const bool received = waitFor([&](){ return m_receivedCount >= expectedCount; });
+    const qint64 durationNs = m_clock.nsecsElapsed() - m_subscribeTime;
+    m_subscribeTime = -1;
+
+    QJsonObject result = received ? createResult(scenario, qos, durationNs, m_receivedCount)
+                                  : createError(scenario, qos, QString("Received %1 of %2 retained messages").arg(m_receivedCount).arg(expectedCount));
+    result.insert("subscribers", m_options.clients);
+    result.insert("retainedMessages", m_options.retainedMessages);
+    disconnectClients(subscribers);
+    return result;
+}
+
+QJsonObject LoadTest::runIdleConnections()
+{
+    const QString scenario = "idle";
+    const qint64 memoryBefore = residentMemory();
+    const qint64 start = m_clock.nsecsElapsed();
+    QList<MqttClient*> clients = connectClients(scenario, m_options.idleConnections, 60);
+    const qint64 durationNs = m_clock.nsecsElapsed() - start;
+
+    QJsonObject result;
+    if (clients.count() != m_options.idleConnections) {
+        result = createError(scenario, -1, QString("Connected %1 of %2 clients, check the limit for open files").arg(clients.count()).arg(m_options.idleConnections));
+    } else {
+        result.insert("scenario", scenario);
+        result.insert("connections", clients.count());
+        result.insert("durationMs", durationNs / 1e6);
+        result.insert("connectionsPerSecond", clients.count() * 1e9 / qMax<qint64>(1, durationNs));
+        const qint64 memoryAfter = residentMemory();
+        result.insert("rssBytes", memoryAfter);
+        // Client and server side of the connections
+        result.insert("rssBytesPerConnection", clients.isEmpty() ? 0 : static_cast<double>(memoryAfter - memoryBefore) / clients.count());
+    }
+    disconnectClients(clients);
+    return result;
+}
+
+qint64 LoadTest::residentMemory()
+{
+#ifdef Q_OS_LINUX
+    QFile file("/proc/self/statm");
+    if (!file.open(QFile::ReadOnly)) {
+        return 0;
+    }
+    const QList<QByteArray> fields = file.readAll().split(' ');
+    if (fields.count() < 2) {
+        return 0;
+    }
+    return fields.at(1).toLongLong() * sysconf(_SC_PAGESIZE);
+#else
+    return 0;
+#endif
+}
+
+QJsonObject LoadTest::runRelay(const QString &scenario, Mqtt::QoS qos, int publisherCount, int subscriberCount)
+{
+    QList<MqttClient*> subscribers = connectClients(scenario + "-subscriber", subscriberCount);
+    QList<MqttClient*> publishers = connectClients(scenario + "-publisher", publisherCount);
+    QJsonObject result;
+    if (subscribers.count() != subscriberCount || publishers.count() != publisherCount) {
+        result = createError(scenario, qos, "Clients could not connect");
+    } else if (!subscribeClients(subscribers, QString("loadtest/%1/+").arg(scenario), qos)) {
+        result = createError(scenario, qos, "Clients could not subscribe");
+    } else {
+        foreach (MqttClient *subscriber, subscribers) {
+            connect(subscriber, &MqttClient::publishReceived, this, [this](const QString &, const QByteArray &payload, bool){
+                onPublishReceived(payload);
+            });
+        }
+
+        // Every publisher sends a burst per round, the next round starts once everything has been delivered
+        const int rounds = qMax(1, m_options.messages / (publisherCount * m_options.burst));
+        const int deliveriesPerRound = publisherCount * m_options.burst * subscriberCount;
+        m_latencies.clear();
+        m_latencies.reserve(rounds * deliveriesPerRound);
+        m_receivedCount = 0;
+
+        bool delivered = true;
+        const qint64 start = m_clock.nsecsElapsed();
+        for (int round = 0; round < rounds && delivered; round++) {
+            for (int i = 0; i < publisherCount; i++) {
+                const QString topic = QString("loadtest/%1/%2").arg(scenario).arg(i);
+                for (int j = 0; j < m_options.burst; j++) {
+                    publishers.at(i)->publish(topic, createPayload(), qos);
+                }
+            }
+            const int expectedCount = (round + 1) * deliveriesPerRound;
+            delivered = waitFor([&](){ return m_receivedCount >= expectedCount; });
+        }
+        const qint64 durationNs = m_clock.nsecsElapsed() - start;
+
+        result = delivered ? createResult(scenario, qos, durationNs, m_receivedCount)
+                           : createError(scenario, qos, QString("Delivered %1 of %2 messages").arg(m_receivedCount).arg(rounds * deliveriesPerRound));
+        result.insert("published", rounds * publisherCount * m_options.burst);
+    }
+    result.insert("publishers", publisherCount);
+    result.insert("subscribers", subscriberCount);
+
+    disconnectClients(publishers);
+    disconnectClients(subscribers);
+    return result;
+}
+
+QList<MqttClient*> LoadTest::connectClients(const QString &prefix, int count, quint16 keepAlive)
+{
+    QList<MqttClient*> clients;
+    int connectedCount = 0;
+    while (clients.count() < count) {
+        const int batchEnd = qMin(count, clients.count() + connectBatchSize);
+        while (clients.count() < batchEnd) {
+            MqttClient *client = new MqttClient(QString("%1-%2").arg(prefix).arg(clients.count()), keepAlive, QString(), QByteArray(), Mqtt::QoS0, false, this);
+            client->setAutoReconnect(false);
+            connect(client, &MqttClient::connected, this, [&connectedCount](Mqtt::ConnectReturnCode returnCode){
+                if (returnCode == Mqtt::ConnectReturnCodeAccepted) {
+                    connectedCount++;
+                }
+            });
+            client->connectToHost("127.0.0.1", m_port);
+            clients.append(client);
+        }
+        if (!waitFor([&](){ return connectedCount == clients.count(); })) {
+            qWarning() << "Connected" << connectedCount << "of" << count << "clients";
+            disconnectClients(clients);
+            return QList<MqttClient*>();
+        }
+    }
+    // Counting connections is done, the lambdas mustn't outlive connectedCount
+    foreach (MqttClient *client, clients) {
+        disconnect(client, &MqttClient::connected, this, nullptr);
+    }
+    return clients;
+}
+
+bool LoadTest::subscribeClients(const QList<MqttClient*> &clients, const QString &topicFilter, Mqtt::QoS qos)
+{
+    int subscribedCount = 0;
+    foreach (MqttClient *client, clients) {
+        connect(client, &MqttClient::subscribeResult, this, [&subscribedCount](){ subscribedCount++; });
+        client->subscribe(topicFilter, qos);
+    }
+    const bool subscribed = waitFor([&](){ return subscribedCount == clients.count(); });
+    foreach (MqttClient *client, clients) {
+        disconnect(client, &MqttClient::subscribeResult, this, nullptr);
+    }
+    return subscribed;
+}
+
+void LoadTest::disconnectClients(const QList<MqttClient*> &clients)
+{
+    foreach (MqttClient *client, clients) {
+        client->disconnectFromHost();
+    }
+    if (!waitFor([this](){ return m_server->clients().isEmpty(); })) {
+        qWarning() << m_server->clients().count() << "clients are still connected";
+    }
+    qDeleteAll(clients);
+}
+
+bool LoadTest::waitFor(const std::function<bool()> &condition)
+{
+    if (condition()) {
+        return true;
+    }
+
+    QEventLoop loop;
+    QTimer pollTimer;
+    connect(&pollTimer, &QTimer::timeout, &loop, [&](){
+        if (condition()) {
+            loop.quit();
+        }
+    });
+    pollTimer.start(1);
+    QTimer::singleShot(m_options.timeout, &loop, &QEventLoop::quit);
+    loop.exec();
+    return condition();
+}
+
+QByteArray LoadTest::createPayload() const
+{
+    QByteArray payload(qMax(m_options.payloadSize, static_cast<int>(sizeof(qint64))), 'x');
+    qToLittleEndian<qint64>(m_clock.nsecsElapsed(), payload.data());
+    return payload;
+}
+
+void LoadTest::onPublishReceived(const QByteArray &payload)
+{
+    if (payload.size() < static_cast<int>(sizeof(qint64))) {
+        return;
+    }
+    const qint64 sent = m_subscribeTime >= 0 ? m_subscribeTime : qFromLittleEndian<qint64>(payload.constData());
+    m_latencies.append(m_clock.nsecsElapsed() - sent);
+    m_receivedCount++;
+}
+
+QJsonObject LoadTest::createResult(const QString &scenario, int qos, qint64 durationNs, int messageCount) const
+{
+    QJsonObject result;
+    result.insert("scenario", scenario);
+    result.insert("qos", qos);
+    result.insert("delivered", messageCount);
+    result.insert("durationMs", durationNs / 1e6);
+    result.insert("messagesPerSecond", messageCount * 1e9 / qMax<qint64>(1, durationNs));
+
+    QVector<qint64> latencies = m_latencies;
+    std::sort(latencies.begin(), latencies.end());
+    QJsonObject latency;
+    if (!latencies.isEmpty()) {
+        // Nearest rank percentiles in microseconds
+        auto percentile = [&latencies](double p) {
+            const int rank = qBound(0, static_cast<int>(std::ceil(p * latencies.count())) - 1, latencies.count() - 1);
+            return latencies.at(rank) / 1e3;
+        };
+        latency.insert("p50", percentile(0.5));
+        latency.insert("p99", percentile(0.99));
+        latency.insert("p999", percentile(0.999));
+        latency.insert("max", latencies.last() / 1e3);
+    }
+    result.insert("latencyUs", latency);
+    result.insert("rssBytes", residentMemory());
+    return result;
+}
+
+QJsonObject LoadTest::createError(const QString &scenario, int qos, const QString &error)
+{
+    QJsonObject result;
+    result.insert("scenario", scenario);
+    if (qos >= 0) {
+        result.insert("qos", qos);
+    }
+    result.insert("error", error);
+    return result;
+}
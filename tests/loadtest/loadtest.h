@@ -0,0 +1,100 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#ifndef LOADTEST_H
+#define LOADTEST_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QVector>
+
+#include <functional>
+
+#include "mqttpacket.h"
+
+class MqttServer;
+class MqttClient;
+
+struct LoadTestOptions {
+    int clients = 100;
+    int idleConnections = 10000;
+    int messages = 10000;
+    int burst = 100;
+    int payloadSize = 64;
+    int retainedMessages = 1000;
+    int workerThreads = 0;
+    // Milliseconds to wait for a step of a scenario before giving up
+    int timeout = 60000;
+};
+
+// Runs load scenarios against a server in the same process over loopback. Clients and server share the event
+// loop unless the server uses worker threads, the memory figures include both sides.
+class LoadTest : public QObject
+{
+    Q_OBJECT
+public:
+    explicit LoadTest(const LoadTestOptions &options, QObject *parent = nullptr);
+    ~LoadTest() override;
+
+    bool isListening() const;
+
+    // One publisher, options.clients subscribers
+    QJsonObject runFanOut(Mqtt::QoS qos);
+    // options.clients publishers, one subscriber
+    QJsonObject runIngest(Mqtt::QoS qos);
+    // options.clients subscribers subscribing at once to options.retainedMessages retained messages
+    QJsonObject runRetainedSubscribe(Mqtt::QoS qos);
+    // options.idleConnections connections which only keep themselves alive
+    QJsonObject runIdleConnections();
+
+    // The resident set size of this process in bytes, 0 if unknown
+    static qint64 residentMemory();
+
+private:
+    QJsonObject runRelay(const QString &scenario, Mqtt::QoS qos, int publisherCount, int subscriberCount);
+    QList<MqttClient*> connectClients(const QString &prefix, int count, quint16 keepAlive = 300);
+    bool subscribeClients(const QList<MqttClient*> &clients, const QString &topicFilter, Mqtt::QoS qos);
+    void disconnectClients(const QList<MqttClient*> &clients);
+    bool waitFor(const std::function<bool()> &condition);
+
+    QByteArray createPayload() const;
+    void onPublishReceived(const QByteArray &payload);
+    QJsonObject createResult(const QString &scenario, int qos, qint64 durationNs, int messageCount) const;
+    static QJsonObject createError(const QString &scenario, int qos, const QString &error);
+
+    LoadTestOptions m_options;
+    MqttServer *m_server = nullptr;
+    quint16 m_port = 0;
+
+    // Payloads start with the time they have been published at on this clock
+    QElapsedTimer m_clock;
+    QVector<qint64> m_latencies;
+    // Set while retained messages are measured from the time of subscribing rather than publishing
+    qint64 m_subscribeTime = -1;
+    int m_receivedCount = 0;
+};
+
+#endif // LOADTEST_H
@@ -0,0 +1,22 @@
+QT += network websockets
+QT -= gui
+
+CONFIG += qt console warn_on depend_includepath
+CONFIG -= app_bundle
+
+TEMPLATE = app
+TARGET = nymeamqttloadtest
+
+include(../../nymea-mqtt.pri)
+
+INCLUDEPATH += $$top_srcdir/libnymea-mqtt/
+
+HEADERS += loadtest.h
+
+SOURCES += main.cpp \
+    loadtest.cpp
+
+LIBS += -L$$top_builddir/libnymea-mqtt/ -lnymea-mqtt
+
+target.path = $$[QT_INSTALL_PREFIX]/share/tests/nymea-mqtt/
+INSTALLS += target
@@ -0,0 +1,141 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "loadtest.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QLoggingCategory>
+#include <QFile>
+#include <iostream>
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    LoadTestOptions options;
+    QCommandLineParser parser;
+    parser.addOptions({
+          {{"scenario", "s"}, "Comma separated scenarios to run: fanout, ingest, retained, idle (default: all)", "scenarios", "fanout,ingest,retained,idle"},
+          {{"qos", "q"}, "Comma separated QoS levels for the fanout, ingest and retained scenarios (default: 0,1,2)", "levels", "0,1,2"},
+          {{"clients", "c"}, QString("Subscribers for fanout and retained, publishers for ingest (default: %1)").arg(options.clients), "count", QString::number(options.clients)},
+          {{"idle-connections", "i"}, QString("Connections for the idle scenario (default: %1)").arg(options.idleConnections), "count", QString::number(options.idleConnections)},
+          {{"messages", "m"}, QString("Messages published per fanout and ingest run (default: %1)").arg(options.messages), "count", QString::number(options.messages)},
+          {{"burst", "b"}, QString("Messages each publisher sends before waiting for their delivery (default: %1)").arg(options.burst), "count", QString::number(options.burst)},
+          {{"payload-size", "p"}, QString("Payload size in bytes, at least 8 (default: %1)").arg(options.payloadSize), "bytes", QString::number(options.payloadSize)},
+          {{"retained-messages", "r"}, QString("Retained messages for the retained scenario (default: %1)").arg(options.retainedMessages), "count", QString::number(options.retainedMessages)},
+          {{"worker-threads", "w"}, "Worker threads of the server (default: 0)", "count", "0"},
+          {{"timeout", "t"}, QString("Milliseconds to wait for each step before failing (default: %1)").arg(options.timeout), "ms", QString::number(options.timeout)},
+          {{"output", "o"}, "Write the results to the given file instead of stdout", "file"},
+      });
+    parser.setApplicationDescription("nymeamqttloadtest measures throughput, latency and memory of nymea-mqtt with a server and its clients in the same process, connected over loopback.\n\n"
+                                     "The results are written as JSON. Latencies are in microseconds, from publishing to receiving or from subscribing to receiving for retained messages. "
+                                     "Memory figures include the server and the client side of the connections.\n\n"
+                                     "The idle scenario needs two file descriptors per connection.");
+    parser.addHelpOption();
+    parser.process(a.arguments());
+
+    options.clients = qMax(1, parser.value("clients").toInt());
+    options.idleConnections = qMax(1, parser.value("idle-connections").toInt());
+    options.messages = qMax(1, parser.value("messages").toInt());
+    options.burst = qMax(1, parser.value("burst").toInt());
+    options.payloadSize = parser.value("payload-size").toInt();
+    options.retainedMessages = qMax(1, parser.value("retained-messages").toInt());
+    options.workerThreads = qMax(0, parser.value("worker-threads").toInt());
+    options.timeout = qMax(1, parser.value("timeout").toInt());
+    const QStringList scenarios = parser.value("scenario").split(",");
+    QList<Mqtt::QoS> qosLevels;
+    foreach (const QString &level, parser.value("qos").split(",")) {
+        qosLevels.append(static_cast<Mqtt::QoS>(qBound(0, level.toInt(), 2)));
+    }
+
+    // The library logs every packet otherwise
+    QLoggingCategory::setFilterRules("nymea.mqtt.*.debug=false");
+
+#ifdef Q_OS_UNIX
+    // Both ends of every connection are in this process
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+#endif
+
+    LoadTest loadTest(options);
+    if (!loadTest.isListening()) {
+        qCritical() << "Could not start the server";
+        exit(EXIT_FAILURE);
+    }
+
+    QJsonArray results;
+    foreach (Mqtt::QoS qos, qosLevels) {
+        if (scenarios.contains("fanout")) {
+            results.append(loadTest.runFanOut(qos));
+        }
+        if (scenarios.contains("ingest")) {
+            results.append(loadTest.runIngest(qos));
+        }
+        if (scenarios.contains("retained")) {
+            results.append(loadTest.runRetainedSubscribe(qos));
+        }
+    }
+    if (scenarios.contains("idle")) {
+        results.append(loadTest.runIdleConnections());
+    }
+
+    bool failed = false;
+    foreach (const QJsonValue &result, results) {
+        failed |= result.toObject().contains("error");
+    }
+
+    QJsonObject report;
+    report.insert("clients", options.clients);
+    report.insert("messages", options.messages);
+    report.insert("burst", options.burst);
+    report.insert("payloadSize", options.payloadSize);
+    report.insert("workerThreads", options.workerThreads);
+    report.insert("results", results);
+    const QByteArray json = QJsonDocument(report).toJson();
+
+    if (parser.isSet("output")) {
+        QFile file(parser.value("output"));
+        if (!file.open(QFile::WriteOnly | QFile::Truncate)) {
+            qCritical() << "Could not open" << file.fileName() << "for writing";
+            exit(EXIT_FAILURE);
+        }
+        file.write(json);
+    } else {
+        std::cout << json.constData();
+    }
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
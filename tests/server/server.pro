@@ -0,0 +1,29 @@
+QT += testlib network concurrent
+QT -= gui
+
+CONFIG += qt console warn_on depend_includepath testcase
+CONFIG -= app_bundle
+
+TEMPLATE = app
+TARGET = nymeamqtttestsserver
+
+include(../../nymea-mqtt.pri)
+
+INCLUDEPATH += $$top_srcdir/libnymea-mqtt/ $$top_srcdir/server/
+
+HEADERS += \
+    $$top_srcdir/server/authorizer.h \
+    $$top_srcdir/server/mqttpolicy.h \
+    $$top_srcdir/server/passwordhash.h \
+    $$top_srcdir/server/topicacl.h
+
+SOURCES += test_server.cpp \
+    $$top_srcdir/server/authorizer.cpp \
+    $$top_srcdir/server/mqttpolicy.cpp \
+    $$top_srcdir/server/passwordhash.cpp \
+    $$top_srcdir/server/topicacl.cpp
+
+LIBS += -L$$top_builddir/libnymea-mqtt/ -lnymea-mqtt -lssl -lcrypto
+
+target.path = $$[QT_INSTALL_PREFIX]/share/tests/nymea-mqtt/
+INSTALLS += target
@@ -0,0 +1,401 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-mqtt.
+*
+* nymea-mqtt is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* nymea-mqtt is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with nymea-mqtt. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "topicacl.h"
+#include "mqttpolicy.h"
+#include "authorizer.h"
+#include "passwordhash.h"
+
+#include <QTest>
+#include <QTemporaryDir>
+#include <QSettings>
+#include <QFile>
+#include <QRegularExpression>
+#include <QSharedPointer>
+
+class ServerTests: public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testTopicAclMatchesTopic_data();
+    void testTopicAclMatchesTopic();
+
+    void testTopicAclCoversFilter_data();
+    void testTopicAclCoversFilter();
+
+    void testPolicySubstitution_data();
+    void testPolicySubstitution();
+
+    void testInvalidTopicFilters_data();
+    void testInvalidTopicFilters();
+
+    void testAuthorizerReload();
+
+    void testPasswordHash();
+    void testMalformedPasswordHash_data();
+    void testMalformedPasswordHash();
+    void testPlainTextPassword();
+    void testPasswordVerificationCache();
+
+private:
+    // Waits for the decision if the authorizer doesn't answer right away
+    Mqtt::ConnectReturnCode authorizeConnect(Authorizer *authorizer, const QString &clientId, const QString &username, const QString &password, bool *answeredRightAway = nullptr);
+    bool authorizeSubscribe(Authorizer *authorizer, const QString &clientId, const QString &topicFilter);
+    bool authorizePublish(Authorizer *authorizer, const QString &clientId, const QString &topic);
+    void writePolicy(const QString &policyFile, const QString &clientId, const QString &username, const QString &password, const QStringList &allowedTopicFilters);
+};
+
+void ServerTests::testTopicAclMatchesTopic_data()
+{
+    QTest::addColumn<QStringList>("topicFilters");
+    QTest::addColumn<QString>("topic");
+    QTest::addColumn<bool>("matches");
+
+    QTest::newRow("exact") << QStringList{"a/b"} << "a/b" << true;
+    QTest::newRow("exact, other topic") << QStringList{"a/b"} << "a/c" << false;
+    QTest::newRow("exact, deeper topic") << QStringList{"a/b"} << "a/b/c" << false;
+    QTest::newRow("# matches the parent level") << QStringList{"a/#"} << "a" << true;
+    QTest::newRow("# matches all levels below") << QStringList{"a/#"} << "a/b/c" << true;
+    QTest::newRow("# doesn't match siblings") << QStringList{"a/#"} << "b/c" << false;
+    QTest::newRow("+ matches one level") << QStringList{"a/+/c"} << "a/b/c" << true;
+    QTest::newRow("+ matches an empty level") << QStringList{"a/+/c"} << "a//c" << true;
+    QTest::newRow("+ matches exactly one level") << QStringList{"+"} << "a/b" << false;
+    QTest::newRow("+ followed by a mismatch") << QStringList{"a/+/c"} << "a/b/d" << false;
+    QTest::newRow("any of the filters") << QStringList{"x/y", "a/+"} << "a/b" << true;
+    QTest::newRow("no filters") << QStringList() << "a" << false;
+    QTest::newRow("# doesn't match $ topics") << QStringList{"#"} << "$SYS/broker" << false;
+    QTest::newRow("+ doesn't match $ topics") << QStringList{"+/broker"} << "$SYS/broker" << false;
+    QTest::newRow("explicit $ filter") << QStringList{"$SYS/#"} << "$SYS/broker" << true;
+    QTest::newRow("+ in a later level matches $") << QStringList{"a/+"} << "a/$b" << true;
+}
+
+void ServerTests::testTopicAclMatchesTopic()
+{
+    QFETCH(QStringList, topicFilters);
+    QFETCH(QString, topic);
+    QFETCH(bool, matches);
+
+    TopicAcl acl;
+    foreach (const QString &topicFilter, topicFilters) {
+        acl.addFilter(topicFilter);
+    }
+    QCOMPARE(acl.isEmpty(), topicFilters.isEmpty());
+    QCOMPARE(acl.matchesTopic(topic), matches);
+}
+
+void ServerTests::testTopicAclCoversFilter_data()
+{
+    QTest::addColumn<QStringList>("topicFilters");
+    QTest::addColumn<QString>("topicFilter");
+    QTest::addColumn<bool>("covers");
+
+    QTest::newRow("same filter") << QStringList{"a/b"} << "a/b" << true;
+    QTest::newRow("a covered by a/#") << QStringList{"a/#"} << "a" << true;
+    QTest::newRow("+ covered by #") << QStringList{"#"} << "+" << true;
+    QTest::newRow("# covered by #") << QStringList{"#"} << "#" << true;
+    QTest::newRow("a/+ covered by a/#") << QStringList{"a/#"} << "a/+" << true;
+    QTest::newRow("a/# covered by a/#") << QStringList{"a/#"} << "a/#" << true;
+    QTest::newRow("a/b/# covered by a/#") << QStringList{"a/#"} << "a/b/#" << true;
+    QTest::newRow("+ covered by +") << QStringList{"a/+/c"} << "a/+/c" << true;
+    QTest::newRow("a/b covered by a/+") << QStringList{"a/+"} << "a/b" << true;
+    QTest::newRow("# not covered by a/#") << QStringList{"a/#"} << "#" << false;
+    QTest::newRow("a/# not covered by a/+") << QStringList{"a/+"} << "a/#" << false;
+    QTest::newRow("+ not covered by a") << QStringList{"a"} << "+" << false;
+    QTest::newRow("a/+ not covered by a/b") << QStringList{"a/b"} << "a/+" << false;
+    QTest::newRow("a/b/c not covered by a/+") << QStringList{"a/+"} << "a/b/c" << false;
+    QTest::newRow("a not covered by a/+") << QStringList{"a/+"} << "a" << false;
+    QTest::newRow("$ filter not covered by #") << QStringList{"#"} << "$SYS/#" << false;
+    QTest::newRow("$ filter not covered by +") << QStringList{"+/broker"} << "$SYS/broker" << false;
+    QTest::newRow("$ filter covered by an explicit $ filter") << QStringList{"$SYS/#"} << "$SYS/broker/+" << true;
+    QTest::newRow("+/broker covered by #") << QStringList{"#"} << "+/broker" << true;
+}
+
+void ServerTests::testTopicAclCoversFilter()
+{
+    QFETCH(QStringList, topicFilters);
+    QFETCH(QString, topicFilter);
+    QFETCH(bool, covers);
+
+    TopicAcl acl;
+    foreach (const QString &filter, topicFilters) {
+        acl.addFilter(filter);
+    }
+    QCOMPARE(acl.coversFilter(topicFilter), covers);
+}
+
+void ServerTests::testPolicySubstitution_data()
+{
+    QTest::addColumn<QString>("clientId");
+    QTest::addColumn<QString>("username");
+    QTest::addColumn<QStringList>("topicFilters");
+    QTest::addColumn<QString>("topic");
+    QTest::addColumn<bool>("allowed");
+
+    QTest::newRow("client ID") << "dev1" << "user" << QStringList{"devices/%c/#"} << "devices/dev1/state" << true;
+    QTest::newRow("other client ID") << "dev1" << "user" << QStringList{"devices/%c/#"} << "devices/dev2/state" << false;
+    QTest::newRow("username") << "dev1" << "user" << QStringList{"users/%u/+"} << "users/user/state" << true;
+    QTest::newRow("other username") << "dev1" << "user" << QStringList{"users/%u/+"} << "users/other/state" << false;
+    QTest::newRow("both") << "dev1" << "user" << QStringList{"%u/%c"} << "user/dev1" << true;
+    QTest::newRow("client ID with /") << "dev/1" << "user" << QStringList{"devices/%c/#"} << "devices/dev/1/state" << false;
+    QTest::newRow("client ID with / adding a level") << "dev/1" << "user" << QStringList{"devices/%c"} << "devices/dev/1" << false;
+    QTest::newRow("client ID with +") << "+" << "user" << QStringList{"devices/%c"} << "devices/other" << false;
+    QTest::newRow("client ID with #") << "#" << "user" << QStringList{"devices/%c"} << "devices/other/state" << false;
+    QTest::newRow("username with /") << "dev1" << "us/er" << QStringList{"users/%u/#"} << "users/us/er/state" << false;
+    QTest::newRow("username with +") << "dev1" << "+" << QStringList{"users/%u"} << "users/other" << false;
+    QTest::newRow("username with #") << "dev1" << "#" << QStringList{"users/%u"} << "users/other" << false;
+    QTest::newRow("empty username") << "dev1" << "" << QStringList{"users/%u/#"} << "users//state" << false;
+    QTest::newRow("rejected filter leaves others") << "dev/1" << "user" << QStringList{"devices/%c/#", "public/#"} << "public/state" << true;
+    QTest::newRow("no placeholders") << "dev/1" << "" << QStringList{"devices/#"} << "devices/dev/1" << true;
+}
+
+void ServerTests::testPolicySubstitution()
+{
+    QFETCH(QString, clientId);
+    QFETCH(QString, username);
+    QFETCH(QStringList, topicFilters);
+    QFETCH(QString, topic);
+    QFETCH(bool, allowed);
+
+    MqttPolicy policy(clientId, username, "password", topicFilters, topicFilters);
+    QCOMPARE(policy.allowsPublish(topic), allowed);
+    QCOMPARE(policy.allowsSubscribe(topic), allowed);
+}
+
+void ServerTests::testInvalidTopicFilters_data()
+{
+    QTest::addColumn<QString>("topicFilter");
+    QTest::addColumn<QString>("topic");
+
+    QTest::newRow("# not in the last level") << "a/#/b" << "a/x";
+    QTest::newRow("# within a level") << "a/b#" << "a/b";
+    QTest::newRow("+ within a level") << "a/b+" << "a/b+";
+    QTest::newRow("# after +") << "+#" << "a";
+}
+
+void ServerTests::testInvalidTopicFilters()
+{
+    QFETCH(QString, topicFilter);
+    QFETCH(QString, topic);
+
+    TopicAcl acl;
+    QVERIFY(!acl.addFilter(topicFilter));
+    QVERIFY(acl.isEmpty());
+    QVERIFY(!acl.matchesTopic(topic));
+
+    // The policy ignores the invalid filter and keeps the others
+    QTest::ignoreMessage(QtWarningMsg, QRegularExpression("Ignoring invalid topic filter .* for client \"dev1\""));
+    MqttPolicy policy("dev1", "user", "password", QStringList{topicFilter, "public/#"}, QStringList());
+    QVERIFY(!policy.allowsSubscribe(topic));
+    QVERIFY(policy.allowsSubscribe("public/state"));
+}
+
+void ServerTests::testAuthorizerReload()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString policyFile = dir.filePath("mqttpolicies.conf");
+
+    Authorizer authorizer(policyFile);
+    QCOMPARE(authorizeConnect(&authorizer, "client", "user", "password"), Mqtt::ConnectReturnCodeServerUnavailable);
+
+    // Creating the file is picked up by watching the directory
+    quint32 generation = authorizer.authorizationGeneration();
+    writePolicy(policyFile, "client", "user", "password", {"allowed/#"});
+    QTRY_COMPARE(authorizeConnect(&authorizer, "client", "user", "password"), Mqtt::ConnectReturnCodeAccepted);
+    QVERIFY(authorizer.authorizationGeneration() != generation);
+    QVERIFY(authorizePublish(&authorizer, "client", "allowed/topic"));
+    QVERIFY(!authorizePublish(&authorizer, "client", "denied/topic"));
+
+    // Changes replace the file, which drops it from the watcher, and are picked up nonetheless
+    generation = authorizer.authorizationGeneration();
+    writePolicy(policyFile, "client", "user", "password", {"denied/#"});
+    QTRY_VERIFY(authorizePublish(&authorizer, "client", "denied/topic"));
+    QVERIFY(!authorizePublish(&authorizer, "client", "allowed/topic"));
+    QVERIFY(authorizer.authorizationGeneration() != generation);
+
+    // And again
+    QSettings settings(policyFile, QSettings::IniFormat);
+    settings.remove("client");
+    settings.sync();
+    QTRY_COMPARE(authorizeConnect(&authorizer, "client", "user", "password"), Mqtt::ConnectReturnCodeNotAuthorized);
+    QVERIFY(!authorizeSubscribe(&authorizer, "client", "denied/#"));
+
+    // Removing the file locks everyone out
+    QVERIFY(QFile::remove(policyFile));
+    QTRY_COMPARE(authorizeConnect(&authorizer, "client", "user", "password"), Mqtt::ConnectReturnCodeServerUnavailable);
+}
+
+void ServerTests::testPasswordHash()
+{
+    const QString hash = PasswordHash::create("secret", 1000);
+    QVERIFY(PasswordHash::isHash(hash));
+    QVERIFY(hash.startsWith("$pbkdf2-sha256$1000$"));
+    QVERIFY(PasswordHash::verify(hash, "secret"));
+    QVERIFY(!PasswordHash::verify(hash, "Secret"));
+    QVERIFY(!PasswordHash::verify(hash, "secret "));
+    QVERIFY(!PasswordHash::verify(hash, QString()));
+    QVERIFY(!PasswordHash::verify(hash, hash));
+
+    // Salted, the same password never gives the same hash
+    const QString otherHash = PasswordHash::create("secret", 1000);
+    QVERIFY(otherHash != hash);
+    QVERIFY(PasswordHash::verify(otherHash, "secret"));
+}
+
+void ServerTests::testMalformedPasswordHash_data()
+{
+    QTest::addColumn<QString>("storedPassword");
+
+    QTest::newRow("prefix only") << "$pbkdf2-sha256$";
+    QTest::newRow("iterations only") << "$pbkdf2-sha256$1000";
+    QTest::newRow("missing hash") << "$pbkdf2-sha256$1000$c2FsdHNhbHRzYWx0c2FsdA==";
+    QTest::newRow("empty hash") << "$pbkdf2-sha256$1000$c2FsdHNhbHRzYWx0c2FsdA==$";
+    QTest::newRow("empty salt and hash") << "$pbkdf2-sha256$1000$$";
+    QTest::newRow("too many parts") << "$pbkdf2-sha256$1000$c2FsdA==$aGFzaA==$aGFzaA==";
+    QTest::newRow("iterations not a number") << "$pbkdf2-sha256$many$c2FsdA==$aGFzaA==";
+    QTest::newRow("zero iterations") << "$pbkdf2-sha256$0$c2FsdA==$aGFzaA==";
+    QTest::newRow("negative iterations") << "$pbkdf2-sha256$-1000$c2FsdA==$aGFzaA==";
+    QTest::newRow("iterations overflowing") << "$pbkdf2-sha256$99999999999999999999$c2FsdA==$aGFzaA==";
+    QTest::newRow("hash not base64") << "$pbkdf2-sha256$1000$c2FsdA==$!!!!";
+}
+
+void ServerTests::testMalformedPasswordHash()
+{
+    QFETCH(QString, storedPassword);
+
+    QVERIFY(PasswordHash::isHash(storedPassword));
+    QVERIFY(!PasswordHash::verify(storedPassword, "secret"));
+    QVERIFY(!PasswordHash::verify(storedPassword, QString()));
+    QVERIFY(!PasswordHash::verify(storedPassword, storedPassword));
+}
+
+void ServerTests::testPlainTextPassword()
+{
+    // Policy files from before hashing was introduced
+    QVERIFY(!PasswordHash::isHash("secret"));
+    QVERIFY(PasswordHash::verify("secret", "secret"));
+    QVERIFY(!PasswordHash::verify("secret", "Secret"));
+    QVERIFY(!PasswordHash::verify("secret", "secre"));
+    QVERIFY(!PasswordHash::verify("secret", "secrets"));
+    QVERIFY(!PasswordHash::verify("secret", QString()));
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString policyFile = dir.filePath("mqttpolicies.conf");
+    writePolicy(policyFile, "client", "user", "secret", {"#"});
+    Authorizer authorizer(policyFile);
+    QCOMPARE(authorizeConnect(&authorizer, "client", "user", "secret"), Mqtt::ConnectReturnCodeAccepted);
+    QCOMPARE(authorizeConnect(&authorizer, "client", "user", "wrong"), Mqtt::ConnectReturnCodeBadUsernameOrPassword);
+    QCOMPARE(authorizeConnect(&authorizer, "client", "other", "secret"), Mqtt::ConnectReturnCodeBadUsernameOrPassword);
+}
+
+void ServerTests::testPasswordVerificationCache()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString policyFile = dir.filePath("mqttpolicies.conf");
+    writePolicy(policyFile, "client", "user", PasswordHash::create("old", 1000), {"#"});
+
+    Authorizer authorizer(policyFile);
+    // The key derivation doesn't block the caller, the second time is answered right away from the cache
+    bool answeredRightAway = true;
+    QCOMPARE(authorizeConnect(&authorizer, "client", "user", "old", &answeredRightAway), Mqtt::ConnectReturnCodeAccepted);
+    QVERIFY(!answeredRightAway);
+    QCOMPARE(authorizeConnect(&authorizer, "client", "user", "old", &answeredRightAway), Mqtt::ConnectReturnCodeAccepted);
+    QVERIFY(answeredRightAway);
+    QCOMPARE(authorizeConnect(&authorizer, "client", "user", "new", &answeredRightAway), Mqtt::ConnectReturnCodeBadUsernameOrPassword);
+    QVERIFY(!answeredRightAway);
+
+    // Changing the stored hash invalidates the cached verification
+    writePolicy(policyFile, "client", "user", PasswordHash::create("new", 1000), {"#"});
+    QTRY_COMPARE(authorizeConnect(&authorizer, "client", "user", "new"), Mqtt::ConnectReturnCodeAccepted);
+    QCOMPARE(authorizeConnect(&authorizer, "client", "user", "old"), Mqtt::ConnectReturnCodeBadUsernameOrPassword);
+
+    // So does adding the policy again
+    authorizer.addPolicy("client", "user", "newer", {"#"}, {"#"});
+    QCOMPARE(authorizeConnect(&authorizer, "client", "user", "new"), Mqtt::ConnectReturnCodeBadUsernameOrPassword);
+    QCOMPARE(authorizeConnect(&authorizer, "client", "user", "newer"), Mqtt::ConnectReturnCodeAccepted);
+    QCOMPARE(authorizeConnect(&authorizer, "client", "user", "newer", &answeredRightAway), Mqtt::ConnectReturnCodeAccepted);
+    QVERIFY(answeredRightAway);
+
+    // Removing the policy drops its verified password, adding it back requires verifying again
+    authorizer.removePolicy("client");
+    QCOMPARE(authorizeConnect(&authorizer, "client", "user", "newer"), Mqtt::ConnectReturnCodeNotAuthorized);
+    writePolicy(policyFile, "client", "user", PasswordHash::create("newer", 1000), {"#"});
+    QTRY_COMPARE(authorizeConnect(&authorizer, "client", "user", "newer", &answeredRightAway), Mqtt::ConnectReturnCodeAccepted);
+    QVERIFY(!answeredRightAway);
+}
+
+Mqtt::ConnectReturnCode ServerTests::authorizeConnect(Authorizer *authorizer, const QString &clientId, const QString &username, const QString &password, bool *answeredRightAway)
+{
+    // Shared with the callback, which may be called after giving up on it
+    QSharedPointer<bool> decided(new bool(false));
+    QSharedPointer<Mqtt::ConnectReturnCode> returnCode(new Mqtt::ConnectReturnCode(Mqtt::ConnectReturnCodeServerUnavailable));
+    authorizer->authorizeConnect(0, clientId, username, password, QHostAddress::LocalHost, [decided, returnCode](Mqtt::ConnectReturnCode code){
+        *returnCode = code;
+        *decided = true;
+    });
+    if (answeredRightAway) {
+        *answeredRightAway = *decided;
+    }
+    for (int i = 0; i < 500 && !*decided; i++) {
+        QTest::qWait(10);
+    }
+    if (!*decided) {
+        qWarning() << "The authorizer did not decide within 5 seconds";
+    }
+    return *returnCode;
+}
+
+bool ServerTests::authorizeSubscribe(Authorizer *authorizer, const QString &clientId, const QString &topicFilter)
+{
+    bool allowed = false;
+    authorizer->authorizeSubscribe(0, clientId, topicFilter, [&allowed](bool decision){ allowed = decision; });
+    return allowed;
+}
+
+bool ServerTests::authorizePublish(Authorizer *authorizer, const QString &clientId, const QString &topic)
+{
+    bool allowed = false;
+    authorizer->authorizePublish(0, clientId, topic, [&allowed](bool decision){ allowed = decision; });
+    return allowed;
+}
+
+void ServerTests::writePolicy(const QString &policyFile, const QString &clientId, const QString &username, const QString &password, const QStringList &allowedTopicFilters)
+{
+    QSettings settings(policyFile, QSettings::IniFormat);
+    settings.beginGroup(clientId);
+    settings.setValue("username", username);
+    settings.setValue("password", password);
+    settings.setValue("allowedSubscribeTopicFilters", allowedTopicFilters);
+    settings.setValue("allowedPublishTopicFilters", allowedTopicFilters);
+    settings.endGroup();
+    settings.sync();
+}
+
+QTEST_MAIN(ServerTests)
+
+#include "test_server.moc"
@@ -1,3 +1,3 @@
 TEMPLATE = subdirs
-SUBDIRS += tcp websocket
+SUBDIRS += tcp websocket server benchmarks loadtest
 